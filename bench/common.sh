@@ -0,0 +1,37 @@
+# Shared helpers for the benchmark scripts, sourced with $root and $work set.
+
+# build <name> [config.h sed expression]
+#
+# Builds a copy of the emulator in $work/<name> with the debugger and
+# tracing disabled, applying the optional edit to config.h first.
+build() {
+    mkdir -p "$work/$1"
+    cp -r "$root/src" "$root/Makefile" "$work/$1"
+    sed -i 's|^#define ENABLE_DEBUGGER|// &|; s|^#define ENABLE_TRACE|// &|' \
+        "$work/$1/src/config.h"
+    if [ -n "$2" ]; then
+        sed -i "$2" "$work/$1/src/config.h"
+    fi
+    make -s -C "$work/$1" clean all >/dev/null
+}
+
+# best <command...>, prints the best wall time of $runs runs in seconds
+best() {
+    local t min=
+    for _ in $(seq "$runs"); do
+        t=$( { TIMEFORMAT=%3R; time "$@" >/dev/null 2>&1; } 2>&1 )
+        # compare as integer milliseconds
+        if [ -z "$min" ] || ((10#${t/./} < 10#${min/./})); then
+            min=$t
+        fi
+    done
+    echo "$min"
+}
+
+# assemble bench/*.s16 into $work
+assemble() {
+    for src in "$root"/bench/*.s16; do
+        python3 "$root/tooling/assembler.py" "$src" \
+            "$work/$(basename "$src" .s16).bin" >/dev/null
+    done
+}
@@ -0,0 +1,27 @@
+#!/bin/bash
+# Compare big-endian and host-endian VM memory (ENABLE_HOST_ENDIAN_MEM).
+#
+# usage: bench/endian.sh [runs]
+#
+# Builds both variants and reports the best wall time of each engine on the
+# programs in bench/.
+set -e
+
+root=$(cd "$(dirname "$0")/.." && pwd)
+runs=${1:-5}
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+. "$root/bench/common.sh"
+
+build big 's|^#define ENABLE_HOST_ENDIAN_MEM|// &|'
+build host
+assemble
+
+printf "%-16s %-8s %10s %10s\n" program engine big host
+for prog in "$work"/*.bin; do
+    for engine in interp block jit; do
+        printf "%-16s %-8s %10s %10s\n" "$(basename "$prog" .bin)" "$engine" \
+            "$(best "$work/big/sigma16-emu" --engine=$engine "$prog")" \
+            "$(best "$work/host/sigma16-emu" --engine=$engine "$prog")"
+    done
+done
@@ -0,0 +1,86 @@
+/*
+ * Runs a program on every engine and checks that they end in the same
+ * state: status, registers, pc, adr and all of memory. The interpreter's
+ * run is the reference; the others may take twice its instructions, so an
+ * engine which loops where the interpreter halts stops with a difference.
+ *
+ * usage: engines <program>
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "vm.h"
+
+static const struct {
+    const char* name;
+    enum sigma16_engine engine;
+} engines[] = {{"block", ENGINE_BLOCK},
+               {"jit", ENGINE_JIT},
+               {"tailcall", ENGINE_TAILCALL}};
+
+static sigma16_vm_t* run(char* fname, enum sigma16_engine engine,
+                         uint64_t budget, int* status) {
+    sigma16_vm_t* vm;
+
+    if (sigma16_vm_init(&vm, fname) < 0) {
+        exit(EXIT_FAILURE);
+    }
+    vm->engine = engine;
+    if (budget) {
+        sigma16_vm_set_budget(vm, budget, 0);
+    }
+    *status = sigma16_vm_exec(vm);
+    return vm;
+}
+
+/* prints the first difference from ref, returning whether there is one */
+static _Bool differs(const char* name, sigma16_vm_t* ref, int ref_status,
+                     sigma16_vm_t* vm, int status) {
+    if (status != ref_status) {
+        fprintf(stderr, "%s: status %d, interp %d\n", name, status,
+                ref_status);
+        return 1;
+    }
+    for (int r = 0; r < 16; ++r) {
+        if (vm->cpu.regs[r] != ref->cpu.regs[r]) {
+            fprintf(stderr, "%s: R%d=%04x, interp %04x\n", name, r,
+                    vm->cpu.regs[r], ref->cpu.regs[r]);
+            return 1;
+        }
+    }
+    if (vm->cpu.pc != ref->cpu.pc || vm->cpu.adr != ref->cpu.adr) {
+        fprintf(stderr, "%s: pc=%04x adr=%04x, interp pc=%04x adr=%04x\n",
+                name, vm->cpu.pc, vm->cpu.adr, ref->cpu.pc, ref->cpu.adr);
+        return 1;
+    }
+    for (int a = 0; a < 1 << 16; ++a) {
+        if (read_mem(vm, a) != read_mem(ref, a)) {
+            fprintf(stderr, "%s: mem[%04x]=%04x, interp %04x\n", name, a,
+                    read_mem(vm, a), read_mem(ref, a));
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    sigma16_vm_t* ref;
+    sigma16_vm_t* vm;
+    int ref_status;
+    int status;
+    int failed = 0;
+
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s <program>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    ref = run(argv[1], ENGINE_INTERP, 0, &ref_status);
+    for (int e = 0; e < sizeof engines / sizeof *engines; ++e) {
+        vm = run(argv[1], engines[e].engine, 2 * ref->icount + 1, &status);
+        failed |= differs(engines[e].name, ref, ref_status, vm, status);
+        sigma16_vm_del(vm);
+    }
+    sigma16_vm_del(ref);
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,94 @@
+/*
+ * Runs many instances of one program, each with its instance number in R1,
+ * on every scalar engine and on the lockstep batch engine. Checks that the
+ * final states agree and reports the time each engine took.
+ *
+ * usage: lockstep <program> [instances]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "batch.h"
+#include "vm.h"
+
+static const struct {
+    const char* name;
+    enum sigma16_engine engine;
+} engines[] = {
+    {"interp", ENGINE_INTERP}, {"block", ENGINE_BLOCK}, {"jit", ENGINE_JIT}};
+
+static double now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static sigma16_vm_t** load(char* fname, int n, enum sigma16_engine engine) {
+    sigma16_vm_t** vms = calloc(n, sizeof *vms);
+
+    for (int i = 0; i < n; ++i) {
+        if (sigma16_vm_init(&vms[i], fname) < 0) {
+            exit(EXIT_FAILURE);
+        }
+        vms[i]->engine = engine;
+        vms[i]->cpu.regs[1] = i;
+    }
+    return vms;
+}
+
+static void unload(sigma16_vm_t** vms, int n) {
+    for (int i = 0; i < n; ++i) {
+        sigma16_vm_del(vms[i]);
+    }
+    free(vms);
+}
+
+static _Bool same_state(sigma16_vm_t* a, sigma16_vm_t* b) {
+    return !memcmp(a->cpu.regs, b->cpu.regs, sizeof a->cpu.regs) &&
+           a->cpu.pc == b->cpu.pc && a->cpu.adr == b->cpu.adr;
+}
+
+int main(int argc, char** argv) {
+    sigma16_vm_t** batch;
+    sigma16_vm_t** vms;
+    int* status;
+    double start;
+    int n;
+
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s <program> [instances]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    n = argc > 2 ? atoi(argv[2]) : 1024;
+    status = calloc(n, sizeof *status);
+
+    batch = load(argv[1], n, ENGINE_INTERP);
+    start = now();
+    sigma16_batch_exec(batch, n, status);
+    printf("%-8s %8.3fs\n", "batch", now() - start);
+
+    for (int e = 0; e < sizeof engines / sizeof *engines; ++e) {
+        vms = load(argv[1], n, engines[e].engine);
+        start = now();
+        for (int i = 0; i < n; ++i) {
+            sigma16_vm_exec(vms[i]);
+        }
+        printf("%-8s %8.3fs\n", engines[e].name, now() - start);
+
+        for (int i = 0; i < n; ++i) {
+            if (!same_state(vms[i], batch[i])) {
+                fprintf(stderr, "instance %d differs from the batch engine\n",
+                        i);
+                return EXIT_FAILURE;
+            }
+        }
+        unload(vms, n);
+    }
+
+    unload(batch, n);
+    free(status);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,25 @@
+#!/bin/bash
+# Compare the lockstep batch engine with running each instance separately.
+#
+# usage: bench/lockstep.sh [instances]
+#
+# Uses bench/hash.s16, where every instance takes the same path, and
+# bench/gcd.s16, whose instances diverge.
+set -e
+
+root=$(cd "$(dirname "$0")/.." && pwd)
+instances=${1:-1024}
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+. "$root/bench/common.sh"
+
+build emu
+assemble
+objs=$(ls "$work"/emu/src/*.o | grep -v '/main\.o$')
+${CC:-cc} -O2 -flto -fno-strict-aliasing -I"$work/emu/src" \
+    "$root/bench/lockstep.c" $objs -o "$work/lockstep" -pthread -lreadline
+
+for prog in hash gcd; do
+    echo "$prog, $instances instances"
+    "$work/lockstep" "$work/$prog.bin" "$instances"
+done
@@ -0,0 +1,53 @@
+/*
+ * Run a command with its output discarded, then print its wall time in
+ * seconds and peak RSS in KiB and exit with its status. bench/suite.py runs
+ * programs through this rather than directly, since a child's peak RSS
+ * starts out at its parent's and the harness itself is a Python process.
+ *
+ * usage: rusage command [args...]
+ */
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+int main(int argc, char** argv) {
+    struct timespec start, end;
+    struct rusage usage;
+    int status;
+    int null;
+    pid_t pid;
+
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s command [args...]\n", argv[0]);
+        return 2;
+    }
+    if ((null = open("/dev/null", O_WRONLY)) < 0) {
+        perror("unable to open /dev/null");
+        return 2;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if ((pid = fork()) < 0) {
+        perror("unable to fork");
+        return 2;
+    }
+    if (!pid) {
+        dup2(null, STDOUT_FILENO);
+        dup2(null, STDERR_FILENO);
+        execvp(argv[1], argv + 1);
+        _exit(127);
+    }
+    if (wait4(pid, &status, 0, &usage) < 0) {
+        perror("unable to wait for command");
+        return 2;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    printf("%.9f %ld\n",
+           (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9,
+           usage.ru_maxrss);
+    return WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+}
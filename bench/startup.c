@@ -0,0 +1,95 @@
+/*
+ * Measures how long it takes to start a program: loading its image,
+ * creating a vm and running it to completion. Each loader is timed loading
+ * the image for every run, then once more with one image shared by all
+ * runs. Checks that every run ends in the same state.
+ *
+ * usage: startup <program> [runs]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "image.h"
+#include "vm.h"
+
+static const struct {
+    const char* name;
+    enum sigma16_loader loader;
+} loaders[] = {{"read", LOADER_READ}, {"mmap", LOADER_MMAP}};
+
+static sigma16_cpu_t expected;
+
+static double now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void run(sigma16_image_t* image) {
+    sigma16_vm_t* vm;
+
+    if (sigma16_vm_init_image(&vm, image) < 0 || sigma16_vm_exec(vm) < 0) {
+        exit(EXIT_FAILURE);
+    }
+    if (memcmp(&vm->cpu, &expected, sizeof expected)) {
+        fprintf(stderr, "run ended in a different state\n");
+        exit(EXIT_FAILURE);
+    }
+    sigma16_vm_del(vm);
+}
+
+static sigma16_image_t* load(char* fname, enum sigma16_loader loader) {
+    sigma16_image_t* image;
+
+    if (sigma16_image_load(&image, fname, loader) < 0) {
+        exit(EXIT_FAILURE);
+    }
+    return image;
+}
+
+int main(int argc, char** argv) {
+    sigma16_image_t* image;
+    sigma16_vm_t* vm;
+    double start;
+    int n;
+
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s <program> [runs]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    n = argc > 2 ? atoi(argv[2]) : 1000;
+
+    if (sigma16_vm_init(&vm, argv[1]) < 0 || sigma16_vm_exec(vm) < 0) {
+        return EXIT_FAILURE;
+    }
+    expected = vm->cpu;
+    sigma16_vm_del(vm);
+
+    printf("%-8s %12s %12s\n", "loader", "us/start", "us/shared");
+    for (int l = 0; l < sizeof loaders / sizeof *loaders; ++l) {
+        double separate, shared;
+
+        start = now();
+        for (int i = 0; i < n; ++i) {
+            image = load(argv[1], loaders[l].loader);
+            run(image);
+            sigma16_image_del(image);
+        }
+        separate = (now() - start) / n;
+
+        start = now();
+        image = load(argv[1], loaders[l].loader);
+        for (int i = 0; i < n; ++i) {
+            run(image);
+        }
+        sigma16_image_del(image);
+        shared = (now() - start) / n;
+
+        printf("%-8s %12.1f %12.1f\n", loaders[l].name, separate * 1e6,
+               shared * 1e6);
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,33 @@
+#!/bin/bash
+# Compare the time to start a program with each image loader.
+#
+# usage: bench/startup.sh [runs]
+#
+# Uses bench/table.s16 padded with a random table to fill memory, and
+# bench/hash.s16 as a small image. Both memory byte orders are measured:
+# with host-endian memory the mmap loader swaps straight from the page
+# cache, with big-endian memory it maps the executable itself.
+set -e
+
+root=$(cd "$(dirname "$0")/.." && pwd)
+runs=${1:-1000}
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+. "$root/bench/common.sh"
+
+build big 's|^#define ENABLE_HOST_ENDIAN_MEM|// &|'
+build host
+assemble
+(cat "$work/table.bin"; head -c 131072 /dev/urandom) | head -c 131072 \
+    >"$work/table_full.bin"
+
+for variant in big host; do
+    objs=$(ls "$work/$variant"/src/*.o | grep -v '/main\.o$')
+    ${CC:-cc} -O2 -flto -fno-strict-aliasing -pthread \
+        -I"$work/$variant/src" "$root/bench/startup.c" $objs \
+        -o "$work/startup_$variant" -lreadline
+    for prog in table_full hash; do
+        echo "$prog ($(stat -c %s "$work/$prog.bin") bytes), $variant-endian"
+        "$work/startup_$variant" "$work/$prog.bin" "$runs"
+    done
+done
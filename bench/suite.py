@@ -0,0 +1,478 @@
+#!/usr/bin/env python3
+"""Benchmark suite: times the corpus in bench/ under every engine configuration.
+
+usage: bench/suite.py [--runs N] [--output FILE] [--baseline FILE] ...
+
+Builds private copies of the emulator (as bench/common.sh does): one with the
+debugger and tracing disabled, one with the debugger, and the Python
+bindings. Every program of the corpus then runs under each configuration:
+
+    interp, block, jit  untraced, on that engine
+    tailcall            untraced, on the tail-call threaded interpreter,
+                        for comparison with interp's computed goto
+    traced              --trace to /dev/null, capped at --trace-limit
+                        instructions since every instruction is printed
+    debugger            the debugger build, continuing to the end
+    python              Emulator.execute() in the bindings, timed in-process
+
+Before any timing, bench/engines.c runs every program on each engine and
+checks that they all end with the same registers and memory as interp.
+
+Each measurement is the best of --runs runs, made through bench/rusage.c.
+Startup latency is the best time to run a program which halts at once; it
+is subtracted before computing ns/instruction. Peak RSS is the largest of
+the runs, and includes the interpreter for python.
+
+The results are written as JSON. With --baseline, every result is compared
+with the baseline's ns/instruction for the same program and configuration,
+and the exit status is 1 if any became more than --threshold percent slower.
+"""
+
+import argparse
+import json
+import os
+import platform
+import re
+import shutil
+import subprocess
+import sys
+import tempfile
+
+from dataclasses import dataclass, asdict
+from typing import Dict, List, Optional
+
+ROOT = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+
+# program name: (source in bench/, what it stresses)
+CORPUS = {
+    "compute": ("compute.s16", "register arithmetic, multiply and divide"),
+    "memory": ("memory.s16", "loads and stores"),
+    "branch": ("branch.s16", "unpredictable conditional branches"),
+    "trap": ("trap.s16", "output traps"),
+    "call": ("call.s16", "subroutine calls and returns"),
+}
+
+CONFIGS = [
+    "interp", "block", "jit", "tailcall", "traced", "debugger", "python"
+]
+
+# trap r0, r0, r0
+EMPTY_PROGRAM = b"\xd0\x00"
+
+# times itself, leaving out the interpreter's own startup
+PYTHON_RUNNER = """
+import json, sys, time
+sys.path.insert(0, sys.argv[1])
+import sigma16
+start = time.perf_counter()
+emu = sigma16.Emulator(sys.argv[2])
+emu.execute()
+seconds = time.perf_counter() - start
+with open(sys.argv[3], "w") as f:
+    json.dump({"seconds": seconds, "icount": emu.icount}, f)
+"""
+
+
+@dataclass
+class Result:
+    program: str
+    config: str
+    instructions: int
+    seconds: float
+    startup_ms: float
+    ns_per_instruction: float
+    instructions_per_second: float
+    peak_rss_kib: int
+
+
+class BenchError(Exception):
+    pass
+
+
+def log(msg: str) -> None:
+    print(msg, file=sys.stderr, flush=True)
+
+
+def build_emulator(work: str, name: str, debugger: bool) -> str:
+    """Build a copy of the emulator in work/name, returning the executable."""
+    dest = os.path.join(work, name)
+    shutil.copytree(os.path.join(ROOT, "src"), os.path.join(dest, "src"))
+    shutil.copy(os.path.join(ROOT, "Makefile"), dest)
+    edit_config(dest, debugger)
+    subprocess.run(
+        ["make", "-s", "-C", dest, "clean", "all"],
+        check=True,
+        stdout=subprocess.DEVNULL,
+        stderr=subprocess.DEVNULL,
+    )
+    return os.path.join(dest, "sigma16-emu")
+
+
+def build_python(work: str) -> Optional[str]:
+    """Build the bindings in work/python, None if they cannot be built."""
+    dest = os.path.join(work, "python")
+    shutil.copytree(os.path.join(ROOT, "src"), os.path.join(dest, "src"))
+    shutil.copy(os.path.join(ROOT, "setup.py"), dest)
+    edit_config(dest, debugger=False)
+    proc = subprocess.run(
+        [sys.executable, "setup.py", "build_ext", "--inplace"],
+        cwd=dest,
+        stdout=subprocess.DEVNULL,
+        stderr=subprocess.PIPE,
+        text=True,
+    )
+    if proc.returncode:
+        log(f"skipping python, the bindings did not build:\n{proc.stderr}")
+        return None
+    return dest
+
+
+def edit_config(dest: str, debugger: bool) -> None:
+    path = os.path.join(dest, "src", "config.h")
+    with open(path) as f:
+        config = f.read()
+    config = re.sub(r"(?m)^#define ENABLE_TRACE\b", r"// \g<0>", config)
+    if not debugger:
+        config = re.sub(r"(?m)^#define ENABLE_DEBUGGER\b", r"// \g<0>", config)
+    with open(path, "w") as f:
+        f.write(config)
+
+
+def assemble(work: str, programs: List[str]) -> Dict[str, str]:
+    binaries = {}
+    for name in programs:
+        src = os.path.join(ROOT, "bench", CORPUS[name][0])
+        binaries[name] = os.path.join(work, name + ".bin")
+        subprocess.run(
+            [
+                sys.executable,
+                os.path.join(ROOT, "tooling", "assembler.py"),
+                src,
+                binaries[name],
+            ],
+            check=True,
+            stdout=subprocess.DEVNULL,
+        )
+    binaries["empty"] = os.path.join(work, "empty.bin")
+    with open(binaries["empty"], "wb") as f:
+        f.write(EMPTY_PROGRAM)
+    return binaries
+
+
+def count_instructions(emu: str, binary: str) -> int:
+    """Instructions executed by a whole run, as batch mode reports them."""
+    proc = subprocess.run(
+        [emu, "--batch=-"],
+        input=binary + "\n",
+        stdout=subprocess.PIPE,
+        stderr=subprocess.DEVNULL,
+        text=True,
+        check=True,
+    )
+    match = re.search(r"status 0, (\d+) instructions", proc.stdout)
+    if not match:
+        raise BenchError(f"{binary} did not halt cleanly")
+    return int(match.group(1))
+
+
+def build_rusage(work: str) -> str:
+    """Build bench/rusage.c, which every measured run goes through."""
+    exe = os.path.join(work, "rusage")
+    subprocess.run(
+        [
+            os.environ.get("CC", "cc"),
+            "-O2",
+            os.path.join(ROOT, "bench", "rusage.c"),
+            "-o",
+            exe,
+        ],
+        check=True,
+    )
+    return exe
+
+
+def build_engines(work: str, emu: str) -> str:
+    """Build bench/engines.c against the objects of the emulator emu."""
+    src = os.path.join(os.path.dirname(emu), "src")
+    objs = [
+        os.path.join(src, name)
+        for name in sorted(os.listdir(src))
+        if name.endswith(".o") and name != "main.o"
+    ]
+    exe = os.path.join(work, "engines")
+    subprocess.run(
+        [
+            os.environ.get("CC", "cc"),
+            "-O2",
+            "-flto",
+            "-fno-strict-aliasing",
+            "-I" + src,
+            os.path.join(ROOT, "bench", "engines.c"),
+        ]
+        + objs
+        + ["-o", exe, "-pthread", "-lreadline"],
+        check=True,
+        stderr=subprocess.DEVNULL,
+    )
+    return exe
+
+
+def check_engines(engines: str, name: str, binary: str) -> None:
+    """Fail unless every engine ends a run of binary in interp's state."""
+    proc = subprocess.run(
+        [engines, binary],
+        stdout=subprocess.DEVNULL,
+        stderr=subprocess.PIPE,
+        text=True,
+    )
+    if proc.returncode:
+        raise BenchError(f"the engines disagree on {name}:\n{proc.stderr}")
+
+
+class Runner:
+    def __init__(
+        self, args, rusage: str, emu: str, debugger_emu: str, pydir: Optional[str]
+    ):
+        self.args = args
+        self.rusage = rusage
+        self.emu = emu
+        self.debugger_emu = debugger_emu
+        self.pydir = pydir
+
+    def run_once(self, argv: List[str], stdin: Optional[bytes] = None):
+        """Wall time in seconds and peak RSS in KiB of one run of argv."""
+        proc = subprocess.run(
+            [self.rusage] + argv,
+            input=stdin or b"",
+            stdout=subprocess.PIPE,
+        )
+        # exhausting the budget of a capped run is expected
+        if proc.returncode not in (0, 124):
+            raise BenchError(f"{' '.join(argv)} exited with {proc.returncode}")
+        seconds, rss = proc.stdout.split()
+        return float(seconds), int(rss)
+
+    def command(self, config: str, binary: str):
+        """argv and stdin of one run under config."""
+        if config in ("interp", "block", "jit", "tailcall"):
+            return [self.emu, "--no-trace", f"--engine={config}", binary], None
+        if config == "traced":
+            return [
+                self.emu,
+                "--trace",
+                f"--max-instructions={self.args.trace_limit}",
+                binary,
+            ], None
+        if config == "debugger":
+            return [self.debugger_emu, "--no-trace", binary], b"c\ne\n"
+        raise ValueError(config)
+
+    def measure(self, config: str, binary: str):
+        """Best wall time and largest peak RSS over the runs."""
+        best, rss = float("inf"), 0
+        for _ in range(self.args.runs):
+            if config == "python":
+                seconds, peak = self.run_python(binary)
+            else:
+                seconds, peak = self.run_once(*self.command(config, binary))
+            best, rss = min(best, seconds), max(rss, peak)
+        return best, rss
+
+    def run_python(self, binary: str):
+        with tempfile.NamedTemporaryFile(suffix=".json") as out:
+            _, peak = self.run_once(
+                [
+                    sys.executable,
+                    "-c",
+                    PYTHON_RUNNER,
+                    self.pydir,
+                    binary,
+                    out.name,
+                ]
+            )
+            with open(out.name) as f:
+                report = json.load(f)
+        return report["seconds"], peak
+
+
+def run_suite(args) -> dict:
+    configs = [c for c in args.configs.split(",") if c]
+    programs = [p for p in args.programs.split(",") if p]
+    for name in configs:
+        if name not in CONFIGS:
+            raise BenchError(f"unknown configuration {name}")
+    for name in programs:
+        if name not in CORPUS:
+            raise BenchError(f"unknown program {name}")
+
+    work = tempfile.mkdtemp(prefix="sigma16-bench-")
+    try:
+        log("building")
+        emu = build_emulator(work, "plain", debugger=False)
+        debugger_emu = build_emulator(work, "debugger", debugger=True)
+        pydir = build_python(work) if "python" in configs else None
+        if pydir is None and "python" in configs:
+            configs.remove("python")
+        binaries = assemble(work, programs)
+        engines = build_engines(work, emu)
+        for name in programs:
+            log(f"{name} engines")
+            check_engines(engines, name, binaries[name])
+        runner = Runner(args, build_rusage(work), emu, debugger_emu, pydir)
+
+        startup = {}
+        for config in configs:
+            startup[config] = runner.measure(config, binaries["empty"])[0]
+
+        results = []
+        for name in programs:
+            total = count_instructions(emu, binaries[name])
+            for config in configs:
+                log(f"{name} {config}")
+                seconds, rss = runner.measure(config, binaries[name])
+                insts = total
+                if config == "traced":
+                    # the traced interpreter keeps to budgets exactly
+                    insts = min(total, args.trace_limit)
+                net = max(seconds - startup[config], 1e-9)
+                results.append(
+                    Result(
+                        program=name,
+                        config=config,
+                        instructions=insts,
+                        seconds=round(seconds, 6),
+                        startup_ms=round(startup[config] * 1e3, 3),
+                        ns_per_instruction=round(net * 1e9 / insts, 4),
+                        instructions_per_second=round(insts / net),
+                        peak_rss_kib=rss,
+                    )
+                )
+    finally:
+        shutil.rmtree(work, ignore_errors=True)
+
+    return {
+        "host": {
+            "machine": platform.machine(),
+            "system": platform.system(),
+            "release": platform.release(),
+            "processor": cpu_model(),
+            "python": platform.python_version(),
+        },
+        "commit": git_commit(),
+        "runs": args.runs,
+        "trace_limit": args.trace_limit,
+        "programs": {name: CORPUS[name][1] for name in programs},
+        "results": [asdict(r) for r in results],
+    }
+
+
+def cpu_model() -> str:
+    try:
+        with open("/proc/cpuinfo") as f:
+            for line in f:
+                if line.startswith("model name"):
+                    return line.split(":", 1)[1].strip()
+    except OSError:
+        pass
+    return platform.processor()
+
+
+def git_commit() -> Optional[str]:
+    proc = subprocess.run(
+        ["git", "-C", ROOT, "rev-parse", "--short", "HEAD"],
+        stdout=subprocess.PIPE,
+        stderr=subprocess.DEVNULL,
+        text=True,
+    )
+    return proc.stdout.strip() or None
+
+
+def print_table(report: dict, out) -> None:
+    print(
+        f"{'program':<10} {'config':<9} {'Minst/s':>9} {'ns/inst':>9} "
+        f"{'startup ms':>10} {'RSS KiB':>8}",
+        file=out,
+    )
+    for r in report["results"]:
+        print(
+            f"{r['program']:<10} {r['config']:<9} "
+            f"{r['instructions_per_second'] / 1e6:>9.1f} "
+            f"{r['ns_per_instruction']:>9.3f} {r['startup_ms']:>10.3f} "
+            f"{r['peak_rss_kib']:>8}",
+            file=out,
+        )
+
+
+def compare(report: dict, baseline: dict, threshold: float, out) -> int:
+    """Print the change from the baseline, returning the number of regressions."""
+    old = {(r["program"], r["config"]): r for r in baseline["results"]}
+    regressions = 0
+
+    commit = baseline.get("commit") or "(unknown commit)"
+    print(f"\nagainst baseline {commit}:", file=out)
+    for r in report["results"]:
+        base = old.get((r["program"], r["config"]))
+        if not base:
+            continue
+        change = (r["ns_per_instruction"] / base["ns_per_instruction"] - 1) * 100
+        slower = change > threshold
+        regressions += slower
+        print(
+            f"{r['program']:<10} {r['config']:<9} "
+            f"{base['ns_per_instruction']:>9.3f} -> "
+            f"{r['ns_per_instruction']:>9.3f} ns/inst {change:+7.1f}%"
+            + ("  REGRESSION" if slower else ""),
+            file=out,
+        )
+    return regressions
+
+
+def main() -> None:
+    parser = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+    parser.add_argument("--runs", type=int, default=5, help="runs per measurement")
+    parser.add_argument("--output", help="write the JSON report here")
+    parser.add_argument("--baseline", help="compare with this JSON report")
+    parser.add_argument(
+        "--threshold",
+        type=float,
+        default=10.0,
+        help="percent slowdown counted as a regression",
+    )
+    parser.add_argument(
+        "--trace-limit",
+        type=int,
+        default=200000,
+        help="instructions per traced run",
+    )
+    parser.add_argument("--configs", default=",".join(CONFIGS))
+    parser.add_argument("--programs", default=",".join(CORPUS))
+    args = parser.parse_args()
+
+    try:
+        report = run_suite(args)
+    except (BenchError, subprocess.CalledProcessError) as e:
+        sys.exit(f"bench: {e}")
+
+    # the report goes to standard output unless written to a file
+    if args.output:
+        with open(args.output, "w") as f:
+            json.dump(report, f, indent=2)
+            f.write("\n")
+        out = sys.stdout
+    else:
+        json.dump(report, sys.stdout, indent=2)
+        print()
+        out = sys.stderr
+    print_table(report, out)
+
+    if args.baseline and os.path.exists(args.baseline):
+        with open(args.baseline) as f:
+            baseline = json.load(f)
+        if compare(report, baseline, args.threshold, out):
+            sys.exit(1)
+    elif args.baseline:
+        log(f"no baseline at {args.baseline}, run make bench-baseline first")
+
+
+if __name__ == "__main__":
+    main()
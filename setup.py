@@ -2,7 +2,9 @@ from distutils.core import setup, Extension
 
 sigma16 = Extension(
     "sigma16",
-    ["src/sigma16module.c", "src/tracing.c", "src/vm.c"],
+    ["src/sigma16module.c", "src/tracing.c", "src/vm.c", "src/block.c",
+     "src/jit.c", "src/batch.c", "src/image.c", "src/io.c", "src/expr.c",
+     "src/history.c", "src/disasm.c", "src/tailcall.c"],
     extra_compile_args=["-O2", "-DPYTHON_COMPAT", "-flto"],
 )
 
@@ -0,0 +1,558 @@
+#include "batch.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "config.h"
+#include "cpu.h"
+#include "ops.h"
+#include "vm.h"
+
+/*
+ * Lockstep engine for many instances of one program. Up to BATCH_LANES vms
+ * form a group whose registers are held as a structure of arrays, one
+ * vector array per register, so arithmetic runs across lanes at once. Each
+ * step executes the instruction at the lowest pc of the running lanes for
+ * every lane at that pc; lanes that diverged are masked off until the rest
+ * catch up. Loads, stores, traps and division fall back to a loop over the
+ * active lanes. Code is decoded from one lane, and a lane whose code no
+ * longer matches it (self-modifying programs) leaves the group to finish
+ * on its own engine, as does a lane reaching an EXP instruction other
+ * than a shift. Trace handlers are not invoked. Each lane is checked
+ * against its vm's budget at taken branches, but only once the group has
+ * taken enough steps for some lane to have reached its next_check.
+ */
+
+/* native vector width, generic vectors wider than the target are slow */
+#ifdef __AVX2__
+#define VEC_BYTES 32
+#else
+#define VEC_BYTES 16
+#endif
+
+typedef uint16_t lane_vec __attribute__((vector_size(VEC_BYTES)));
+typedef int16_t lane_svec __attribute__((vector_size(VEC_BYTES)));
+
+#define VEC_LANES (int)(sizeof(lane_vec) / sizeof(uint16_t))
+#define BATCH_VECS (BATCH_LANES / VEC_LANES)
+
+#define LANE(vecs, l) (vecs)[(l) / VEC_LANES][(l) % VEC_LANES]
+#define BLEND(mask, a, b) (((a) & (mask)) | ((b) & ~(mask)))
+#define FOR_VECS(v) for (int v = 0; v < BATCH_VECS; ++v)
+#define FOR_LANES(g, mask, l) \
+    for (int l = 0; l < (g)->n; ++l) if (LANE(mask, l))
+
+/* R15 bits set by cmp, see sigma16_reg_status_t */
+#define FLAG_L 0x0800
+#define FLAG_l 0x1000
+#define FLAG_E 0x2000
+#define FLAG_g 0x4000
+#define FLAG_G 0x8000
+
+struct batch_group {
+    lane_vec regs[16][BATCH_VECS];
+    lane_vec pc[BATCH_VECS];
+    lane_vec adr[BATCH_VECS];
+    /* all ones while the lane runs in the group */
+    lane_vec live[BATCH_VECS];
+    /* instructions executed since the counts were last added to the vms */
+    lane_vec icount[BATCH_VECS];
+    int steps;
+    /* steps before any lane can reach its vm's next budget check */
+    int check_steps;
+    sigma16_vm_t* vms[BATCH_LANES];
+    int* status;
+    int n;
+    int running;
+    /* lanes that left to finish on their own engine */
+    uint64_t ejected;
+    /* words stored by any lane, code there is checked lane by lane */
+    uint64_t written[(1 << 16) / 64];
+};
+
+static inline _Bool is_written(struct batch_group* g, uint16_t addr) {
+    return g->written[addr >> 6] & (1ULL << (addr & 63));
+}
+
+static void load_group(struct batch_group* g, sigma16_vm_t** vms, int n,
+                       int* status) {
+    memset(g, 0, sizeof *g);
+    g->n = g->running = n;
+    g->status = status;
+
+    for (int l = 0; l < n; ++l) {
+        g->vms[l] = vms[l];
+        for (int r = 0; r < 16; ++r) {
+            LANE(g->regs[r], l) = vms[l]->cpu.regs[r];
+        }
+        LANE(g->pc, l) = vms[l]->cpu.pc;
+        LANE(g->adr, l) = vms[l]->cpu.adr;
+        LANE(g->live, l) = 0xffff;
+        status[l] = 0;
+    }
+}
+
+static void store_lane(struct batch_group* g, int l) {
+    sigma16_cpu_t* cpu = &g->vms[l]->cpu;
+
+    for (int r = 0; r < 16; ++r) {
+        cpu->regs[r] = LANE(g->regs[r], l);
+    }
+    cpu->pc = LANE(g->pc, l);
+    cpu->adr = LANE(g->adr, l);
+    g->vms[l]->icount += LANE(g->icount, l);
+    LANE(g->icount, l) = 0;
+}
+
+/* lanes run at most one instruction a step, so none reaches it sooner */
+static void plan_check(struct batch_group* g) {
+    uint64_t left = 0xffff;
+    uint64_t icount;
+
+    FOR_LANES(g, g->live, l) {
+        icount = g->vms[l]->icount + LANE(g->icount, l);
+        if (g->vms[l]->next_check <= icount) {
+            left = 0;
+            break;
+        }
+        if (g->vms[l]->next_check - icount < left) {
+            left = g->vms[l]->next_check - icount;
+        }
+    }
+    g->check_steps = g->steps + left;
+}
+
+/* move the instruction counts to the vms before they can overflow */
+static void flush_icount(struct batch_group* g) {
+    for (int l = 0; l < g->n; ++l) {
+        g->vms[l]->icount += LANE(g->icount, l);
+        LANE(g->icount, l) = 0;
+    }
+    g->steps = 0;
+    plan_check(g);
+}
+
+/* input may overwrite code like any store */
+static void trap_read_lane(struct batch_group* g, int l, uint8_t sa,
+                           uint8_t sb) {
+    sigma16_vm_t* vm = g->vms[l];
+    uint16_t addr = vm->cpu.regs[sa];
+
+    trap_read(vm, sa, sb);
+    LANE(g->regs[sb], l) = vm->cpu.regs[sb];
+    for (int i = 0; i < vm->cpu.regs[sb]; ++i, ++addr) {
+        g->written[addr >> 6] |= 1ULL << (addr & 63);
+    }
+}
+
+static void stop_lane(struct batch_group* g, int l, int status) {
+    LANE(g->live, l) = 0;
+    g->status[l] = status;
+    g->running--;
+}
+
+static void eject_lane(struct batch_group* g, int l) {
+    store_lane(g, l);
+    stop_lane(g, l, 0);
+    g->ejected |= 1ULL << l;
+}
+
+/*
+ * Budget check of the lanes in mask which reached their vm's next_check,
+ * as the other engines make at taken branches. Lanes out of budget stop
+ * with SIGMA16_EXEC_BUDGET and leave mask.
+ */
+static void check_budget(struct batch_group* g, lane_vec* mask) {
+    sigma16_vm_t* vm;
+
+    FOR_LANES(g, mask, l) {
+        vm = g->vms[l];
+        if (vm->icount + LANE(g->icount, l) < vm->next_check) {
+            continue;
+        }
+        store_lane(g, l);
+        if (sigma16_vm_budget_check(vm)) {
+            LANE(mask, l) = 0;
+            stop_lane(g, l, SIGMA16_EXEC_BUDGET);
+        } else {
+            /* the check may have entered an interrupt handler */
+            LANE(g->pc, l) = vm->cpu.pc;
+        }
+    }
+    plan_check(g);
+}
+
+/* lowest pc of the running lanes, where execution resumes */
+static uint16_t next_pc(struct batch_group* g) {
+    lane_vec min = g->pc[0] | ~g->live[0];
+    lane_vec key;
+    uint16_t pc;
+
+    for (int v = 1; v < BATCH_VECS; ++v) {
+        key = g->pc[v] | ~g->live[v];
+        min = BLEND((lane_vec)(key < min), key, min);
+    }
+    pc = min[0];
+    for (int i = 1; i < VEC_LANES; ++i) {
+        if (min[i] < pc) {
+            pc = min[i];
+        }
+    }
+    return pc;
+}
+
+/* running lanes at pc */
+static int lanes_at(struct batch_group* g, uint16_t pc) {
+    lane_vec count = {};
+    int total = 0;
+
+    FOR_VECS(v) { count += g->live[v] & (lane_vec)(g->pc[v] == pc) & 1; }
+    for (int i = 0; i < VEC_LANES; ++i) {
+        total += count[i];
+    }
+    return total;
+}
+
+/* after a branch, continue with whichever successor has more lanes */
+static uint16_t branch_pc(struct batch_group* g, lane_vec* taken, int leader,
+                          uint16_t fallthrough) {
+    uint16_t target;
+    int l = leader;
+
+    if (!LANE(taken, l)) {
+        for (l = 0; l < g->n && !LANE(taken, l); ++l)
+            ;
+        if (l == g->n) {
+            return fallthrough;
+        }
+    }
+    target = LANE(g->pc, l);
+    if (target == fallthrough ||
+        lanes_at(g, target) >= lanes_at(g, fallthrough)) {
+        return target;
+    }
+    return fallthrough;
+}
+
+static void run_group(struct batch_group* g) {
+    static const void* rrr_table[] = {
+        &&op_add,   &&op_sub,   &&op_mul, &&op_div, &&op_cmp,
+        &&op_cmplt, &&op_cmpeq, &&op_cmpgt, &&op_inv, &&op_and,
+        &&op_or,    &&op_xor,   &&op_nop, &&op_trap};
+    static const void* rx_table[] = {
+        &&op_lea,   &&op_load,  &&op_store, &&op_jump, &&op_jumpc0,
+        &&op_jumpc1, &&op_jumpf, &&op_jumpt, &&op_jal,  &&op_bad,
+        &&op_bad,   &&op_bad,   &&op_bad,  &&op_bad,  &&op_bad,
+        &&op_bad};
+    static const void* exp_table[] = {&&op_exp, &&op_exp, &&op_exp,
+                                      &&op_shiftl, &&op_shiftr};
+    lane_vec mask[BATCH_VECS];
+    lane_vec taken[BATCH_VECS];
+    lane_vec ea;
+    lane_vec a, b;
+    const void* handler;
+    sigma16_vm_t* vm;
+    uint16_t pc, word, disp, flags;
+    uint8_t d, sa, sb, len;
+    int leader = 0;
+
+/* wrapping around memory checks the budget like a taken branch */
+#define ADVANCE()                                                     \
+    FOR_VECS(v) { g->pc[v] += mask[v] & len; }                        \
+    pc += len;                                                        \
+    if (__builtin_expect(pc < len, 0) && g->steps >= g->check_steps) { \
+        check_budget(g, mask);                                        \
+    }                                                                 \
+    goto next
+
+#define APPLY_RRR(expr)                                            \
+    if (d) {                                                       \
+        FOR_VECS(v) {                                              \
+            a = g->regs[sa][v];                                    \
+            b = g->regs[sb][v];                                    \
+            g->regs[d][v] = BLEND(mask[v], (expr), g->regs[d][v]); \
+        }                                                          \
+    }
+
+#define SET_FLAGS(val) \
+    FOR_VECS(v) { g->regs[15][v] = BLEND(mask[v], (val), g->regs[15][v]); }
+
+/* effective address into adr for the lanes in m */
+#define COMPUTE_EADDR(v, m)                    \
+    ea = g->regs[sa][v] + disp;                \
+    g->adr[v] = BLEND((m)[v], ea, g->adr[v])
+
+/* branch the lanes in taken, the rest of mask fall through */
+#define BRANCH()                                                   \
+    FOR_VECS(v) {                                                  \
+        COMPUTE_EADDR(v, taken);                                   \
+        g->pc[v] =                                                 \
+            BLEND(taken[v], ea, g->pc[v] + (mask[v] & len));       \
+    }                                                              \
+    if (g->steps >= g->check_steps) {                              \
+        check_budget(g, taken);                                    \
+    }                                                              \
+    pc = branch_pc(g, taken, leader, pc + len);                    \
+    goto next
+
+    pc = next_pc(g);
+next:
+    /* lanes waiting at pc join in here */
+    FOR_VECS(v) { mask[v] = g->live[v] & (lane_vec)(g->pc[v] == pc); }
+    if (!LANE(mask, leader)) {
+        for (leader = 0; leader < g->n && !LANE(mask, leader); ++leader)
+            ;
+        if (leader == g->n) {
+            /* every lane here stopped, resume those left behind */
+            leader = 0;
+            if (!g->running) {
+                return;
+            }
+            pc = next_pc(g);
+            goto next;
+        }
+    }
+
+    vm = g->vms[leader];
+    word = read_mem(vm, pc);
+    d = (word >> 8) & 0xf;
+    sa = (word >> 4) & 0xf;
+    sb = word & 0xf;
+    disp = 0;
+
+    switch (word >> 12) {
+        case 0xe:
+            disp = read_mem(vm, pc + 1);
+            len = sizeof vm->cpu.ir.exp0 >> 1;
+            /* the shifts' source register */
+            sa = disp >> 12;
+            handler = (word & 0xff) < sizeof exp_table / sizeof *exp_table
+                          ? exp_table[word & 0xff]
+                          : &&op_bad;
+            break;
+        case 0xf:
+            disp = read_mem(vm, pc + 1);
+            len = sizeof vm->cpu.ir.rx >> 1;
+            handler = rx_table[sb];
+            break;
+        default:
+            len = sizeof vm->cpu.ir.rrr >> 1;
+            handler = rrr_table[word >> 12];
+    }
+
+    if (is_written(g, pc) || (len > 1 && is_written(g, pc + 1))) {
+        FOR_LANES(g, mask, l) {
+            if (read_mem(g->vms[l], pc) != word ||
+                (len > 1 && read_mem(g->vms[l], pc + 1) != disp)) {
+                LANE(mask, l) = 0;
+                eject_lane(g, l);
+            }
+        }
+    }
+
+    FOR_VECS(v) { g->icount[v] += mask[v] & 1; }
+    if (++g->steps == 0xffff) {
+        flush_icount(g);
+    }
+    goto* handler;
+
+op_add:
+    APPLY_RRR(a + b);
+    flags = add_flags_value(d);
+    SET_FLAGS(flags + (lane_vec){});
+    ADVANCE();
+op_sub:
+    APPLY_RRR(a - b);
+    ADVANCE();
+op_mul:
+    APPLY_RRR(a * b);
+    ADVANCE();
+op_div:
+    FOR_LANES(g, mask, l) {
+        int x = LANE(g->regs[sa], l);
+        int y = LANE(g->regs[sb], l);
+
+        if (!y) {
+            continue;
+        }
+        if (d) {
+            LANE(g->regs[d], l) = x / y;
+        }
+        if (d != 15) {
+            LANE(g->regs[15], l) = x % y;
+        }
+    }
+    ADVANCE();
+op_cmp:
+    FOR_VECS(v) {
+        a = g->regs[sa][v];
+        b = g->regs[sb][v];
+        ea = ((lane_vec)(a > b) & FLAG_G) |
+             ((lane_vec)((lane_svec)a > (lane_svec)b) & FLAG_g) |
+             ((lane_vec)(a == b) & FLAG_E) |
+             ((lane_vec)((lane_svec)a < (lane_svec)b) & FLAG_l) |
+             ((lane_vec)(a < b) & FLAG_L);
+        g->regs[15][v] = BLEND(mask[v], ea, g->regs[15][v]);
+    }
+    ADVANCE();
+op_cmplt:
+    APPLY_RRR((lane_vec)(a < b) & 1);
+    SET_FLAGS((lane_vec){});
+    ADVANCE();
+op_cmpeq:
+    APPLY_RRR((lane_vec)(a == b) & 1);
+    SET_FLAGS((lane_vec){});
+    ADVANCE();
+op_cmpgt:
+    APPLY_RRR((lane_vec)(a > b) & 1);
+    SET_FLAGS((lane_vec){});
+    ADVANCE();
+op_inv:
+    APPLY_RRR(~a);
+    SET_FLAGS((lane_vec){});
+    ADVANCE();
+op_and:
+    APPLY_RRR(a & b);
+    SET_FLAGS((lane_vec){});
+    ADVANCE();
+op_or:
+    APPLY_RRR(a | b);
+    SET_FLAGS((lane_vec){});
+    ADVANCE();
+op_xor:
+    APPLY_RRR(a ^ b);
+    SET_FLAGS((lane_vec){});
+    ADVANCE();
+op_nop:
+    SET_FLAGS((lane_vec){});
+    ADVANCE();
+op_trap:
+    FOR_LANES(g, mask, l) {
+        switch (LANE(g->regs[d], l)) {
+            case 0:
+                /* halted lanes stay at the trap like the other engines */
+                LANE(mask, l) = 0;
+                stop_lane(g, l, 0);
+                break;
+            case 1:
+                store_lane(g, l);
+                trap_read_lane(g, l, sa, sb);
+                break;
+            case 2:
+                store_lane(g, l);
+                trap_write(g->vms[l], sa, sb);
+                break;
+        }
+    }
+    SET_FLAGS((lane_vec){});
+    ADVANCE();
+op_shiftl:
+    APPLY_RRR(a << (disp & 0xf));
+    ADVANCE();
+op_shiftr:
+    APPLY_RRR(a >> (disp & 0xf));
+    ADVANCE();
+op_exp:
+    /* control registers and interrupts are per vm, so leave before them */
+    FOR_LANES(g, mask, l) {
+        LANE(g->icount, l)--;
+        eject_lane(g, l);
+    }
+    goto next;
+op_lea:
+    FOR_VECS(v) {
+        COMPUTE_EADDR(v, mask);
+        if (d) {
+            g->regs[d][v] = BLEND(mask[v], ea, g->regs[d][v]);
+        }
+    }
+    ADVANCE();
+op_load:
+    FOR_VECS(v) { COMPUTE_EADDR(v, mask); }
+    if (d) {
+        FOR_LANES(g, mask, l) {
+            LANE(g->regs[d], l) = read_mem(g->vms[l], LANE(g->adr, l));
+        }
+    }
+    ADVANCE();
+op_store:
+    FOR_VECS(v) { COMPUTE_EADDR(v, mask); }
+    FOR_LANES(g, mask, l) {
+        uint16_t addr = LANE(g->adr, l);
+
+        write_mem(g->vms[l], addr, LANE(g->regs[d], l));
+        g->written[addr >> 6] |= 1ULL << (addr & 63);
+    }
+    ADVANCE();
+op_jump:
+    FOR_VECS(v) { taken[v] = mask[v]; }
+    BRANCH();
+op_jumpc0:
+    FOR_VECS(v) {
+        taken[v] =
+            mask[v] & (lane_vec)(((g->regs[15][v] >> (15 - d)) & 1) == 0);
+    }
+    BRANCH();
+op_jumpc1:
+    FOR_VECS(v) {
+        taken[v] =
+            mask[v] & (lane_vec)(((g->regs[15][v] >> (15 - d)) & 1) != 0);
+    }
+    BRANCH();
+op_jumpf:
+    FOR_VECS(v) { taken[v] = mask[v] & (lane_vec)(g->regs[d][v] == 0); }
+    BRANCH();
+op_jumpt:
+    FOR_VECS(v) { taken[v] = mask[v] & (lane_vec)(g->regs[d][v] != 0); }
+    BRANCH();
+op_jal:
+    if (d) {
+        FOR_VECS(v) {
+            g->regs[d][v] =
+                BLEND(mask[v], (uint16_t)(pc + len) + (lane_vec){},
+                      g->regs[d][v]);
+        }
+    }
+    FOR_VECS(v) { taken[v] = mask[v]; }
+    BRANCH();
+op_bad:
+    FOR_LANES(g, mask, l) {
+        fprintf(stderr, "invalid opcode: pc=%04x\n", pc);
+        stop_lane(g, l, -1);
+    }
+    goto next;
+#undef ADVANCE
+#undef APPLY_RRR
+#undef SET_FLAGS
+#undef COMPUTE_EADDR
+#undef BRANCH
+}
+
+int sigma16_batch_exec(sigma16_vm_t** vms, int n, int* status) {
+    struct batch_group* g;
+    int lanes;
+
+    if (!(g = aligned_alloc(sizeof(lane_vec), sizeof *g))) {
+        perror("unable to allocate batch group");
+        return -1;
+    }
+
+    for (int i = 0; i < n; i += BATCH_LANES) {
+        lanes = n - i < BATCH_LANES ? n - i : BATCH_LANES;
+        load_group(g, vms + i, lanes, status + i);
+        plan_check(g);
+        run_group(g);
+
+        for (int l = 0; l < lanes; ++l) {
+            if (g->ejected & (1ULL << l)) {
+                status[i + l] = sigma16_vm_exec(g->vms[l]);
+            } else {
+                store_lane(g, l);
+                sigma16_io_flush(g->vms[l]);
+            }
+        }
+    }
+    free(g);
+    return 0;
+}
@@ -0,0 +1,14 @@
+#pragma once
+#include "vm.h"
+
+/* instances executed in lockstep by one group, a multiple of 16 up to 64 */
+#define BATCH_LANES 64
+
+/*
+ * Run n vms to completion in lockstep, leaving what sigma16_vm_exec would
+ * have returned for each in status. Every vm keeps to its own budget (see
+ * sigma16_vm_set_budget), checked at taken branches and wrap-around like
+ * the other engines, and one whose budget runs out stops with
+ * SIGMA16_EXEC_BUDGET while the rest of its group carries on.
+ */
+int sigma16_batch_exec(sigma16_vm_t**, int, int*);
@@ -0,0 +1,540 @@
+#include "block.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "config.h"
+#include "cpu.h"
+#include "jit.h"
+#include "ops.h"
+#include "vm.h"
+
+#ifdef ENABLE_FLIGHT_RECORDER
+#include "tracing.h"
+#endif
+
+/*
+ * Basic block engine. Straight-line runs of code are translated once into
+ * arrays of operations with the handler and operands already bound. Blocks
+ * end at a control transfer (or MAX_BLOCK_OPS) and remember their
+ * successors, so a chained edge costs one comparison instead of a lookup.
+ * With ENGINE_JIT every block starts with a counter op that hands the block
+ * to the native compiler once it gets hot. Interrupts are taken between
+ * blocks, by the budget check.
+ */
+
+#define MAX_BLOCK_OPS 64
+
+struct block_link {
+    struct sigma16_block* blk;
+    struct block_link* next;
+};
+
+struct sigma16_block {
+    uint16_t start;
+    uint16_t len;
+    _Bool valid;
+    /* [0] falls through, [1] is the taken branch */
+    struct sigma16_block* succ[2];
+    uint32_t succ_epoch[2];
+    struct block_link links[2];
+    struct sigma16_block* retired_next;
+    uint32_t count;
+    uint16_t n_ops;
+    /* sigma16 instructions in the block, counted on entry */
+    uint16_t n_insts;
+    sigma16_native_fn native;
+    struct block_op ops[];
+};
+
+struct sigma16_block_cache {
+    struct sigma16_block* map[1 << 16];
+    /* blocks touching each 256 word page */
+    struct block_link* pages[1 << 8];
+    /* words covered by a translated block */
+    uint64_t code[(1 << 16) / 64];
+    /* bumped on invalidation, stale chains are then re-resolved */
+    uint32_t epoch;
+    struct sigma16_block* retired;
+};
+
+static const enum block_op_kind rrr_kinds[] = {
+    BOP_ADD, BOP_SUB, BOP_MUL, BOP_DIV, BOP_CMP, BOP_CMPLT, BOP_CMPEQ,
+    BOP_CMPGT, BOP_INV, BOP_AND, BOP_OR, BOP_XOR, BOP_NOP, BOP_TRAP};
+
+static const enum block_op_kind rx_kinds[] = {
+    BOP_LEA,    BOP_LOAD,  BOP_STORE, BOP_JUMP, BOP_JUMPC0, BOP_JUMPC1,
+    BOP_JUMPF,  BOP_JUMPT, BOP_JAL,   BOP_BAD,  BOP_BAD,    BOP_BAD,
+    BOP_BAD,    BOP_BAD,   BOP_BAD,   BOP_BAD};
+
+static const enum block_op_kind exp_kinds[] = {
+    BOP_RFI, BOP_GETCTL, BOP_PUTCTL, BOP_SHIFTL, BOP_SHIFTR};
+
+/*
+ * Control register instructions end blocks too: the timer reads icount, which
+ * then counts no further than them, and interrupts rfi and putctl allow are
+ * taken at the next block boundary.
+ */
+static _Bool ends_block(enum block_op_kind kind) {
+    return kind == BOP_TRAP || kind == BOP_BAD ||
+           (BOP_RFI <= kind && kind <= BOP_PUTCTL) ||
+           (BOP_JUMP <= kind && kind <= BOP_JAL);
+}
+
+static struct sigma16_block_cache* cache_create(void) {
+    struct sigma16_block_cache* cache;
+
+    if (!(cache = calloc(1, sizeof *cache))) {
+        perror("unable to allocate block cache");
+        return NULL;
+    }
+    cache->epoch = 1;
+    return cache;
+}
+
+static void link_page(struct sigma16_block_cache* cache,
+                      struct block_link* link, uint8_t page) {
+    link->next = cache->pages[page];
+    cache->pages[page] = link;
+}
+
+static void unlink_page(struct sigma16_block_cache* cache,
+                        struct block_link* link, uint8_t page) {
+    for (struct block_link** it = &cache->pages[page]; *it;
+         it = &(*it)->next) {
+        if (*it == link) {
+            *it = link->next;
+            return;
+        }
+    }
+}
+
+static uint8_t first_page(struct sigma16_block* blk) { return blk->start >> 8; }
+
+static uint8_t last_page(struct sigma16_block* blk) {
+    return (uint16_t)(blk->start + blk->len - 1) >> 8;
+}
+
+static void retire_block(struct sigma16_block_cache* cache,
+                         struct sigma16_block* blk) {
+    blk->valid = 0;
+    cache->map[blk->start] = NULL;
+    unlink_page(cache, &blk->links[0], first_page(blk));
+    if (last_page(blk) != first_page(blk)) {
+        unlink_page(cache, &blk->links[1], last_page(blk));
+    }
+    blk->retired_next = cache->retired;
+    cache->retired = blk;
+    cache->epoch++;
+}
+
+static void release_retired(struct sigma16_block_cache* cache) {
+    struct sigma16_block* next;
+
+    for (struct sigma16_block* blk = cache->retired; blk; blk = next) {
+        next = blk->retired_next;
+        free(blk);
+    }
+    cache->retired = NULL;
+}
+
+static struct sigma16_block* translate_block(sigma16_vm_t* vm, uint16_t pc,
+                                             const void** op_table) {
+    struct sigma16_block_cache* cache = vm->blocks;
+    struct block_op ops[MAX_BLOCK_OPS + 1];
+    struct sigma16_block* blk;
+    enum block_op_kind kind;
+    uint16_t word;
+    int addr = pc;
+    int n = 0;
+    int insts = 0;
+
+#ifdef HAVE_JIT
+    if (vm->engine == ENGINE_JIT) {
+        ops[n].pc = pc;
+        ops[n].kind = BOP_COUNT;
+        ops[n++].handler = op_table[BOP_COUNT];
+    }
+#endif
+    do {
+        word = read_mem(vm, addr);
+        ops[n].pc = addr;
+        ops[n].d = (word >> 8) & 0xf;
+        ops[n].sa = (word >> 4) & 0xf;
+        ops[n].sb = word & 0xf;
+        ops[n].disp = 0;
+
+        switch (word >> 12) {
+            case 0xe:
+                ops[n].disp = read_mem(vm, addr + 1);
+                kind = (word & 0xff) < sizeof exp_kinds / sizeof *exp_kinds
+                           ? exp_kinds[word & 0xff]
+                           : BOP_BAD;
+                addr += sizeof vm->cpu.ir.exp0 >> 1;
+                break;
+            case 0xf:
+                ops[n].disp = read_mem(vm, addr + 1);
+                kind = rx_kinds[ops[n].sb];
+                addr += sizeof vm->cpu.ir.rx >> 1;
+                break;
+            default:
+                kind = rrr_kinds[word >> 12];
+                addr += sizeof vm->cpu.ir.rrr >> 1;
+        }
+        ops[n].kind = kind;
+        ops[n++].handler = op_table[kind];
+        insts++;
+    } while (!ends_block(kind) && n < MAX_BLOCK_OPS && addr <= 0xffff);
+
+    if (!ends_block(kind)) {
+        ops[n].pc = addr;
+        ops[n].kind = BOP_FALLTHROUGH;
+        ops[n++].handler = op_table[BOP_FALLTHROUGH];
+    }
+
+    if (!(blk = malloc(sizeof *blk + n * sizeof *ops))) {
+        perror("unable to allocate block");
+        return NULL;
+    }
+    memcpy(blk->ops, ops, n * sizeof *ops);
+    blk->start = pc;
+    blk->len = addr - pc;
+    blk->valid = 1;
+    blk->succ[0] = blk->succ[1] = NULL;
+    blk->succ_epoch[0] = blk->succ_epoch[1] = 0;
+    blk->retired_next = NULL;
+    blk->count = 0;
+    blk->n_ops = n;
+    blk->n_insts = insts;
+    blk->native = NULL;
+
+    for (uint16_t i = 0; i < blk->len; ++i) {
+        uint16_t w = pc + i;
+        cache->code[w >> 6] |= 1ULL << (w & 63);
+    }
+    blk->links[0].blk = blk->links[1].blk = blk;
+    link_page(cache, &blk->links[0], first_page(blk));
+    if (last_page(blk) != first_page(blk)) {
+        link_page(cache, &blk->links[1], last_page(blk));
+    }
+
+    cache->map[pc] = blk;
+    return blk;
+}
+
+static inline struct sigma16_block* lookup_block(sigma16_vm_t* vm, uint16_t pc,
+                                                 const void** op_table) {
+    struct sigma16_block* blk = vm->blocks->map[pc];
+    return blk ? blk : translate_block(vm, pc, op_table);
+}
+
+void sigma16_block_invalidate(sigma16_vm_t* vm, uint16_t addr) {
+    struct sigma16_block_cache* cache = vm->blocks;
+    struct sigma16_block* blk;
+    struct block_link** it;
+
+    if (!(cache->code[addr >> 6] & (1ULL << (addr & 63)))) {
+        return;
+    }
+
+    it = &cache->pages[addr >> 8];
+    while (*it) {
+        blk = (*it)->blk;
+        if ((uint16_t)(addr - blk->start) < blk->len) {
+            /* unlinks *it, which then refers to the following entry */
+            retire_block(cache, blk);
+        } else {
+            it = &(*it)->next;
+        }
+    }
+}
+
+void sigma16_block_del(sigma16_vm_t* vm) {
+    struct sigma16_block_cache* cache = vm->blocks;
+
+    for (int i = 0; i < 1 << 16; ++i) {
+        free(cache->map[i]);
+    }
+    release_retired(cache);
+    free(cache);
+    vm->blocks = NULL;
+}
+
+/* instructions of blk at or after pc, which an early exit skips */
+static int insts_from(struct sigma16_block* blk, uint16_t pc) {
+    int n = 0;
+
+    for (int i = 0; i < blk->n_ops; ++i) {
+        if (blk->ops[i].kind < BOP_FALLTHROUGH && blk->ops[i].pc >= pc) {
+            n++;
+        }
+    }
+    return n;
+}
+
+static uint16_t compute_op_eaddr(sigma16_vm_t* vm, struct block_op* op) {
+    vm->cpu.adr = vm->cpu.regs[op->sa] + op->disp;
+    return vm->cpu.adr;
+}
+
+#ifdef ENABLE_FLIGHT_RECORDER
+#define RECORD_OP(vm, op) \
+    flight_record(vm, op->pc, op->d, op->sa, op->sb, op->disp)
+#else
+#define RECORD_OP(vm, op)
+#endif
+
+#define APPLY_OP_RRR(vm, op, operator)                                   \
+    RECORD_OP(vm, op);                                                   \
+    SAFE_UPDATE(vm, op->d,                                               \
+                vm->cpu.regs[op->sa] operator vm->cpu.regs[op->sb]);
+
+#define NEXT() goto*(++op)->handler
+
+/* leave the block along edge, chaining it to its successor */
+#define BRANCH(target, taken) \
+    next = target;            \
+    edge = taken;             \
+    goto chain
+
+int sigma16_block_exec(sigma16_vm_t* vm) {
+    static const void* op_table[N_BOPS] = {
+        [BOP_ADD] = &&op_add,       [BOP_SUB] = &&op_sub,
+        [BOP_MUL] = &&op_mul,       [BOP_DIV] = &&op_div,
+        [BOP_CMP] = &&op_cmp,       [BOP_CMPLT] = &&op_cmplt,
+        [BOP_CMPEQ] = &&op_cmpeq,   [BOP_CMPGT] = &&op_cmpgt,
+        [BOP_INV] = &&op_inv,       [BOP_AND] = &&op_and,
+        [BOP_OR] = &&op_or,         [BOP_XOR] = &&op_xor,
+        [BOP_NOP] = &&op_nop,       [BOP_TRAP] = &&op_trap,
+        [BOP_RFI] = &&op_rfi,       [BOP_GETCTL] = &&op_getctl,
+        [BOP_PUTCTL] = &&op_putctl, [BOP_SHIFTL] = &&op_shiftl,
+        [BOP_SHIFTR] = &&op_shiftr, [BOP_LEA] = &&op_lea,
+        [BOP_LOAD] = &&op_load,     [BOP_STORE] = &&op_store,
+        [BOP_JUMP] = &&op_jump,     [BOP_JUMPC0] = &&op_jumpc0,
+        [BOP_JUMPC1] = &&op_jumpc1, [BOP_JUMPF] = &&op_jumpf,
+        [BOP_JUMPT] = &&op_jumpt,   [BOP_JAL] = &&op_jal,
+        [BOP_BAD] = &&op_bad,       [BOP_FALLTHROUGH] = &&op_fallthrough,
+        [BOP_COUNT] = &&op_count,   [BOP_NATIVE] = &&op_native,
+        [BOP_PASS] = &&op_pass};
+    struct sigma16_block_cache* cache;
+    struct sigma16_block* blk;
+    struct sigma16_block* prev;
+    struct block_op* op;
+    uint16_t next;
+    uint32_t ret;
+    int edge;
+
+    if (!vm->blocks && !(vm->blocks = cache_create())) {
+        return -1;
+    }
+    cache = vm->blocks;
+
+    if (!(blk = lookup_block(vm, vm->cpu.pc, op_table))) {
+        return -1;
+    }
+    vm->icount += blk->n_insts;
+    op = blk->ops;
+    goto* op->handler;
+
+op_add:
+    APPLY_OP_RRR(vm, op, +);
+    op_add_flags(vm, op->d);
+    NEXT();
+op_sub:
+    APPLY_OP_RRR(vm, op, -);
+    NEXT();
+op_mul:
+    APPLY_OP_RRR(vm, op, *);
+    NEXT();
+op_div:
+    RECORD_OP(vm, op);
+    op_div(vm, op->d, op->sa, op->sb);
+    NEXT();
+op_cmp:
+    RECORD_OP(vm, op);
+    op_cmp(vm, vm->cpu.regs[op->sa], vm->cpu.regs[op->sb]);
+    NEXT();
+op_cmplt:
+    APPLY_OP_RRR(vm, op, <);
+    CLEARFLAGS(vm->cpu.regs[15]);
+    NEXT();
+op_cmpeq:
+    APPLY_OP_RRR(vm, op, ==);
+    CLEARFLAGS(vm->cpu.regs[15]);
+    NEXT();
+op_cmpgt:
+    APPLY_OP_RRR(vm, op, >);
+    CLEARFLAGS(vm->cpu.regs[15]);
+    NEXT();
+op_inv:
+    RECORD_OP(vm, op);
+    SAFE_UPDATE(vm, op->d, ~vm->cpu.regs[op->sa]);
+    CLEARFLAGS(vm->cpu.regs[15]);
+    NEXT();
+op_and:
+    APPLY_OP_RRR(vm, op, &);
+    CLEARFLAGS(vm->cpu.regs[15]);
+    NEXT();
+op_or:
+    APPLY_OP_RRR(vm, op, |);
+    CLEARFLAGS(vm->cpu.regs[15]);
+    NEXT();
+op_xor:
+    APPLY_OP_RRR(vm, op, ^);
+    CLEARFLAGS(vm->cpu.regs[15]);
+    NEXT();
+op_nop:
+    RECORD_OP(vm, op);
+    CLEARFLAGS(vm->cpu.regs[15]);
+    NEXT();
+op_trap:
+    RECORD_OP(vm, op);
+    vm->cpu.pc = op->pc;
+    switch (vm->cpu.regs[op->d]) {
+        case 0:
+            goto end_hotloop;
+        case 1:
+            trap_read(vm, op->sa, op->sb);
+            break;
+        case 2:
+            trap_write(vm, op->sa, op->sb);
+            break;
+    }
+    CLEARFLAGS(vm->cpu.regs[15]);
+    BRANCH(op->pc + (sizeof vm->cpu.ir.rrr >> 1), 0);
+op_rfi:
+    RECORD_OP(vm, op);
+    sigma16_vm_rfi(vm);
+    BRANCH(vm->cpu.pc, 1);
+op_getctl:
+    RECORD_OP(vm, op);
+    SAFE_UPDATE(vm, op->d, sigma16_vm_getctl(vm, op->disp >> 12));
+    BRANCH(op->pc + (sizeof vm->cpu.ir.exp0 >> 1), 0);
+op_putctl:
+    RECORD_OP(vm, op);
+    sigma16_vm_putctl(vm, op->disp >> 12, vm->cpu.regs[op->d]);
+    BRANCH(op->pc + (sizeof vm->cpu.ir.exp0 >> 1), 0);
+op_shiftl:
+    RECORD_OP(vm, op);
+    SAFE_UPDATE(vm, op->d, vm->cpu.regs[op->disp >> 12] << (op->disp & 0xf));
+    NEXT();
+op_shiftr:
+    RECORD_OP(vm, op);
+    SAFE_UPDATE(vm, op->d, vm->cpu.regs[op->disp >> 12] >> (op->disp & 0xf));
+    NEXT();
+op_lea:
+    RECORD_OP(vm, op);
+    SAFE_UPDATE(vm, op->d, compute_op_eaddr(vm, op));
+    NEXT();
+op_load:
+    RECORD_OP(vm, op);
+    SAFE_UPDATE(vm, op->d, read_mem(vm, compute_op_eaddr(vm, op)));
+    NEXT();
+op_store:
+    RECORD_OP(vm, op);
+    write_mem(vm, compute_op_eaddr(vm, op), vm->cpu.regs[op->d]);
+    if (!blk->valid) {
+        /* the store rewrote this block, the remaining ops are stale */
+        vm->icount -= insts_from(blk, op->pc + (sizeof vm->cpu.ir.rx >> 1));
+        BRANCH(op->pc + (sizeof vm->cpu.ir.rx >> 1), 0);
+    }
+    NEXT();
+op_jump:
+    RECORD_OP(vm, op);
+    BRANCH(compute_op_eaddr(vm, op), 1);
+op_jumpc0:
+    RECORD_OP(vm, op);
+    if (!select_bit(vm->cpu.regs[15], op->d)) {
+        BRANCH(compute_op_eaddr(vm, op), 1);
+    }
+    BRANCH(op->pc + (sizeof vm->cpu.ir.rx >> 1), 0);
+op_jumpc1:
+    RECORD_OP(vm, op);
+    if (select_bit(vm->cpu.regs[15], op->d)) {
+        BRANCH(compute_op_eaddr(vm, op), 1);
+    }
+    BRANCH(op->pc + (sizeof vm->cpu.ir.rx >> 1), 0);
+op_jumpf:
+    RECORD_OP(vm, op);
+    if (!vm->cpu.regs[op->d]) {
+        BRANCH(compute_op_eaddr(vm, op), 1);
+    }
+    BRANCH(op->pc + (sizeof vm->cpu.ir.rx >> 1), 0);
+op_jumpt:
+    RECORD_OP(vm, op);
+    if (vm->cpu.regs[op->d]) {
+        BRANCH(compute_op_eaddr(vm, op), 1);
+    }
+    BRANCH(op->pc + (sizeof vm->cpu.ir.rx >> 1), 0);
+op_jal:
+    RECORD_OP(vm, op);
+    SAFE_UPDATE(vm, op->d, op->pc + (sizeof vm->cpu.ir.rx >> 1));
+    BRANCH(compute_op_eaddr(vm, op), 1);
+op_fallthrough:
+    BRANCH(op->pc, 0);
+op_count:
+    if (++blk->count < JIT_THRESHOLD) {
+        NEXT();
+    }
+    if (!(blk->native = sigma16_jit_compile(vm, op + 1, blk->n_ops - 1,
+                                            cache->code))) {
+        /* not compilable, stop counting */
+        op->handler = &&op_pass;
+        NEXT();
+    }
+    op->kind = BOP_NATIVE;
+    op->handler = &&op_native;
+op_native:
+    ret = blk->native(vm);
+    if (ret & JIT_EXIT_SMC) {
+        /* the native store bypassed write_mem, redo it to drop stale code */
+        write_mem(vm, vm->cpu.adr, read_mem(vm, vm->cpu.adr));
+        vm->icount -= insts_from(blk, ret & 0xffff);
+    }
+    BRANCH(ret & 0xffff, (ret & JIT_EXIT_TAKEN) != 0);
+op_pass:
+    NEXT();
+op_bad:
+    vm->cpu.pc = op->pc;
+    fprintf(stderr, "invalid opcode: pc=%04x\n", vm->cpu.pc);
+#ifdef ENABLE_FLIGHT_RECORDER
+    RECORD_OP(vm, op);
+    dump_flight_recorder(stderr, vm);
+#endif
+    goto error;
+
+chain:
+    vm->cpu.pc = next;
+    if (__builtin_expect(vm->icount >= vm->next_check, 0)) {
+        if (sigma16_vm_budget_check(vm)) {
+            return SIGMA16_EXEC_BUDGET;
+        }
+        /* the check may have taken an interrupt */
+        next = vm->cpu.pc;
+    }
+    if (blk->succ_epoch[edge] == cache->epoch &&
+        blk->succ[edge]->start == next) {
+        blk = blk->succ[edge];
+    } else {
+        prev = blk;
+        if (!(blk = lookup_block(vm, next, op_table))) {
+            goto error;
+        }
+        if (cache->retired) {
+            /* prev may be among them, so it is not linked this time */
+            release_retired(cache);
+        } else {
+            prev->succ[edge] = blk;
+            prev->succ_epoch[edge] = cache->epoch;
+        }
+    }
+    vm->icount += blk->n_insts;
+    op = blk->ops;
+    goto* op->handler;
+
+end_hotloop:
+    return 0;
+error:
+    return -1;
+}
@@ -0,0 +1,54 @@
+#pragma once
+#include "vm.h"
+
+enum block_op_kind {
+    BOP_ADD,
+    BOP_SUB,
+    BOP_MUL,
+    BOP_DIV,
+    BOP_CMP,
+    BOP_CMPLT,
+    BOP_CMPEQ,
+    BOP_CMPGT,
+    BOP_INV,
+    BOP_AND,
+    BOP_OR,
+    BOP_XOR,
+    BOP_NOP,
+    BOP_TRAP,
+    BOP_RFI,
+    BOP_GETCTL,
+    BOP_PUTCTL,
+    BOP_SHIFTL,
+    BOP_SHIFTR,
+    BOP_LEA,
+    BOP_LOAD,
+    BOP_STORE,
+    BOP_JUMP,
+    BOP_JUMPC0,
+    BOP_JUMPC1,
+    BOP_JUMPF,
+    BOP_JUMPT,
+    BOP_JAL,
+    BOP_BAD,
+    BOP_FALLTHROUGH,
+    BOP_COUNT,
+    BOP_NATIVE,
+    BOP_PASS,
+    N_BOPS
+};
+
+/* an instruction with its handler and operands bound at translation time */
+struct block_op {
+    const void* handler;
+    uint16_t pc;
+    uint8_t kind;
+    uint8_t d;
+    uint8_t sa;
+    uint8_t sb;
+    uint16_t disp;
+};
+
+int sigma16_block_exec(sigma16_vm_t*);
+void sigma16_block_invalidate(sigma16_vm_t*, uint16_t);
+void sigma16_block_del(sigma16_vm_t*);
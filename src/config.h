@@ -1,9 +1,42 @@
 /* Enable interactive debugger */
 #define ENABLE_DEBUGGER
 
-/* Enable live emulator tracing*/
+/* Trace by default, see --trace and --no-trace */
 #define ENABLE_TRACE
 
+/* Engine used without --engine, e.g. ENGINE_TAILCALL, see vm.h */
+#define DEFAULT_ENGINE ENGINE_INTERP
+
+/* Keep VM memory in host byte order, swapping only on load and export */
+#define ENABLE_HOST_ENDIAN_MEM
+
+/* Record recent instructions for post-mortem dumps (no JIT) */
+/*
+ *#define ENABLE_FLIGHT_RECORDER
+ */
+/* Instructions kept by the flight recorder, a power of two */
+#define FLIGHT_RECORDER_SIZE 1024
+
+/* Instructions between clock reads while a deadline is set */
+#define BUDGET_CLOCK_INTERVAL (1 << 20)
+
+/* Bytes of trap output buffered per vm between writes */
+#define IO_BUFFER_SIZE 8192
+
+/* Hot spots listed by the --profile report */
+#define PROFILE_TOP 20
+
+/* Default records passed to a Python batch_handler per call */
+#define TRACE_BATCH_SIZE 4096
+
+/* Instructions between the debugger's snapshots, see history.h */
+#define HISTORY_INTERVAL (1 << 14)
+/* Bytes of debugger history kept before the oldest is dropped */
+#define HISTORY_LIMIT ((size_t)64 << 20)
+
+/* Instructions between polls for an interrupt from GDB, see gdb.h */
+#define GDB_POLL_INTERVAL (1 << 16)
+
 /* Enable post execution CPU dump*/
 /*
  *#define ENABLE_CPU_DUMP
@@ -19,10 +52,6 @@
  */
 
 /* Constraints */
-#if defined(ENABLE_DEBUGGER) && !defined(ENABLE_TRACE)
-#error Debugger support requires tracing
-#endif
-
 #if defined(PYTHON_COMPAT) && defined(ENABLE_DEBUGGER)
 #error Cannot have native debugger and Python bindings simultaneously.
 #endif
@@ -27,6 +27,36 @@ typedef struct _sigma16_mask_flags {
     uint8_t output : 1;
 } sigma16_mask_flags;
 
+/* bit of each interrupt in mask and req, as laid out in sigma16_mask_flags */
+enum sigma16_interrupt {
+    INT_TRAP,
+    INT_OVERFLOW,
+    INT_DIV0,
+    INT_STACKFAULT,
+    INT_SEGFAULT,
+    INT_PRIVILEGE,
+    INT_TIMER,
+    INT_INPUT,
+    INT_OUTPUT
+};
+
+/* control registers, numbered as getctl and putctl address them */
+enum sigma16_ctl {
+    CTL_STATUS,
+    CTL_MASK,
+    CTL_REQ,
+    CTL_ISTAT,
+    CTL_IPC,
+    CTL_VECT,
+    /* instructions left until the timer interrupt, 0 while it is off */
+    CTL_TIMER,
+    N_CTLS
+};
+
+/* bits of the status control register */
+#define STATUS_SYS 1
+#define STATUS_IE 2
+
 typedef struct _sigma16_reg_status {
     uint8_t _padding;
     uint8_t C : 1;
@@ -50,7 +80,10 @@ typedef struct _sigma16_cpu {
     _Bool ie;
     sigma16_reg_t mask;
     sigma16_reg_t req;
-    sigma16_reg_status_t istat;
+    /* status when the last interrupt was taken, restored by rfi */
+    sigma16_reg_t istat;
     sigma16_reg_t ipc;
     sigma16_reg_t vect;
+    /* icount at which the timer requests its interrupt, 0 while it is off */
+    uint64_t timer_at;
 } sigma16_cpu_t;
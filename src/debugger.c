@@ -6,6 +6,8 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "expr.h"
+#include "history.h"
 #include "tracing.h"
 #include "vm.h"
 
@@ -31,8 +33,10 @@ static int parse_int_default(char* buf, int def) {
 
 static void destroy_cmd(struct debugger_cmd* cmd) {
     switch (cmd->cmd) {
-        case RESTART:
-            free(cmd->args->s);
+        case SET_BREAKPOINT:
+            free(cmd->args[1].s);
+            break;
+        default:
             break;
     }
 
@@ -50,7 +54,19 @@ static union debugger_arg* create_arg(int n) {
     return malloc(sizeof(union debugger_arg) * n);
 }
 
-static struct debugger_cmd* create_cmd_restart(char* fname) {
+static struct debugger_cmd* create_cmd_restart(void) {
+    struct debugger_cmd* cmd;
+
+    if (!(cmd = create_cmd())) {
+        return NULL;
+    }
+
+    cmd->cmd = RESTART;
+    cmd->args = NULL;
+    return cmd;
+}
+
+static struct debugger_cmd* create_cmd_reverse_step(int steps) {
     struct debugger_cmd* cmd;
     union debugger_arg* arg;
 
@@ -59,13 +75,25 @@ static struct debugger_cmd* create_cmd_restart(char* fname) {
     }
 
     arg = create_arg(1);
-    arg->s = strdup(fname);
+    arg->i = steps;
 
-    cmd->cmd = RESTART;
+    cmd->cmd = REVERSE_STEP;
     cmd->args = arg;
     return cmd;
 }
 
+static struct debugger_cmd* create_cmd_reverse_continue(void) {
+    struct debugger_cmd* cmd;
+
+    if (!(cmd = create_cmd())) {
+        return NULL;
+    }
+
+    cmd->cmd = REVERSE_CONTINUE;
+    cmd->args = NULL;
+    return cmd;
+}
+
 static struct debugger_cmd* create_cmd_step(int steps) {
     struct debugger_cmd* cmd;
     union debugger_arg* arg;
@@ -118,6 +146,20 @@ static struct debugger_cmd* create_cmd_dump_cpu(void) {
     return cmd;
 }
 
+#ifdef ENABLE_FLIGHT_RECORDER
+static struct debugger_cmd* create_cmd_dump_flight(void) {
+    struct debugger_cmd* cmd;
+
+    if (!(cmd = create_cmd())) {
+        return NULL;
+    }
+
+    cmd->cmd = DUMP_FLIGHT;
+    cmd->args = NULL;
+    return cmd;
+}
+#endif
+
 static struct debugger_cmd* create_cmd_write_reg(int reg, int val) {
     struct debugger_cmd* cmd;
     union debugger_arg* arg;
@@ -135,7 +177,7 @@ static struct debugger_cmd* create_cmd_write_reg(int reg, int val) {
     return cmd;
 }
 
-static struct debugger_cmd* create_cmd_set_breakpoint(int addr) {
+static struct debugger_cmd* create_cmd_set_breakpoint(int addr, char* cond) {
     struct debugger_cmd* cmd;
     union debugger_arg* arg;
 
@@ -143,14 +185,34 @@ static struct debugger_cmd* create_cmd_set_breakpoint(int addr) {
         return NULL;
     }
 
-    arg = create_arg(1);
+    arg = create_arg(2);
     arg[0].i = addr;
+    arg[1].s = cond ? strdup(cond) : NULL;
 
     cmd->cmd = SET_BREAKPOINT;
     cmd->args = arg;
     return cmd;
 }
 
+static struct debugger_cmd* create_cmd_set_watchpoint(int start, int end,
+                                                      int kind) {
+    struct debugger_cmd* cmd;
+    union debugger_arg* arg;
+
+    if (!(cmd = create_cmd())) {
+        return NULL;
+    }
+
+    arg = create_arg(3);
+    arg[0].i = start;
+    arg[1].i = end;
+    arg[2].i = kind;
+
+    cmd->cmd = SET_WATCHPOINT;
+    cmd->args = arg;
+    return cmd;
+}
+
 static struct debugger_cmd* create_cmd_read_reg(int reg) {
     struct debugger_cmd* cmd;
     union debugger_arg* arg;
@@ -184,6 +246,23 @@ static struct debugger_cmd* create_cmd_dump_mem(int start, int end) {
     return cmd;
 }
 
+static struct debugger_cmd* create_cmd_disasm(int addr, int n) {
+    struct debugger_cmd* cmd;
+    union debugger_arg* arg;
+
+    if (!(cmd = create_cmd())) {
+        return NULL;
+    }
+
+    arg = create_arg(2);
+    arg[0].i = addr;
+    arg[1].i = n;
+
+    cmd->cmd = DISASSEMBLE;
+    cmd->args = arg;
+    return cmd;
+}
+
 static struct debugger_cmd* create_cmd_exit(void) {
     struct debugger_cmd* cmd;
 
@@ -276,26 +355,85 @@ static struct debugger_cmd* parse_cmd_dump_mem(struct debugger_ctx* ctx,
     return create_cmd_dump_mem(end, start);
 }
 
+static struct debugger_cmd* parse_cmd_disasm(struct debugger_ctx* ctx,
+                                             char* buf) {
+    int addr;
+    int n;
+
+    /* from pc by default */
+    addr = parse_int_default(strtok(NULL, " "), ctx->vm->cpu.pc);
+    n = parse_int_default(strtok(NULL, " "), 10);
+    return create_cmd_disasm(addr, n);
+}
+
+#ifdef ENABLE_FLIGHT_RECORDER
+static struct debugger_cmd* parse_cmd_dump_flight(struct debugger_ctx* ctx,
+                                                  char* buf) {
+    return create_cmd_dump_flight();
+}
+#endif
+
 static struct debugger_cmd* parse_cmd_set_breakpoint(struct debugger_ctx* ctx,
                                                      char* buf) {
     int addr;
+    char* cond = NULL;
     char* token = strtok(NULL, " ");
 
     if (!token) {
         fprintf(stderr, "invalid breakpoint\n");
+        return NULL;
     }
     addr = parse_int(token);
-    return create_cmd_set_breakpoint(addr);
+    /* b addr if cond, where cond is the rest of the line */
+    if ((token = strtok(NULL, " "))) {
+        if (strcmp(token, "if") || !(cond = strtok(NULL, ""))) {
+            fprintf(stderr, "invalid breakpoint condition\n");
+            return NULL;
+        }
+    }
+    return create_cmd_set_breakpoint(addr, cond);
+}
+
+static struct debugger_cmd* parse_cmd_set_watchpoint(struct debugger_ctx* ctx,
+                                                     char* buf) {
+    int start;
+    int end;
+    int kind = WATCH_WRITE;
+    char* token = strtok(NULL, " ");
+
+    if (!token) {
+        fprintf(stderr, "invalid watchpoint\n");
+        return NULL;
+    }
+    start = end = parse_int(token);
+    /* w start [end] [r|w|rw] */
+    while ((token = strtok(NULL, " "))) {
+        if (!strcmp(token, "r")) {
+            kind = WATCH_READ;
+        } else if (!strcmp(token, "w")) {
+            kind = WATCH_WRITE;
+        } else if (!strcmp(token, "rw")) {
+            kind = WATCH_READ | WATCH_WRITE;
+        } else {
+            end = parse_int(token);
+        }
+    }
+    return create_cmd_set_watchpoint(start, end, kind);
 }
 
 static struct debugger_cmd* parse_cmd_restart(struct debugger_ctx* ctx,
                                               char* buf) {
-    char* fname;
-    fname = strtok(NULL, " ");
-    if (!fname) {
-        fname = ctx->source;
-    }
-    return create_cmd_restart(fname);
+    return create_cmd_restart();
+}
+
+static struct debugger_cmd* parse_cmd_reverse_step(struct debugger_ctx* ctx,
+                                                   char* buf) {
+    return create_cmd_reverse_step(parse_int_default(strtok(NULL, " "), 1));
+}
+
+static struct debugger_cmd* parse_cmd_reverse_continue(
+    struct debugger_ctx* ctx, char* buf) {
+    return create_cmd_reverse_continue();
 }
 
 static struct debugger_cmd* parse_cmd_exit(struct debugger_ctx* ctx,
@@ -322,6 +460,11 @@ static struct debugger_cmd* parse_cmd(struct debugger_ctx* ctx) {
         if (strlen(buf)) {
             break;
         }
+        free(buf);
+    }
+    /* end of input */
+    if (!buf) {
+        return create_cmd_exit();
     }
 
     add_history(buf);
@@ -331,17 +474,24 @@ static struct debugger_cmd* parse_cmd(struct debugger_ctx* ctx) {
         free(buf);
         return NULL;
     }
-    /*
-     *if (!strcmp(token, "r")) {
-     *    return parse_cmd_restart(ctx, buf);
-     *}
-     */
+    if (!strcmp(token, "r")) {
+        cmd = parse_cmd_restart(ctx, buf);
+    }
+    if (!strcmp(token, "rn")) {
+        cmd = parse_cmd_reverse_step(ctx, buf);
+    }
+    if (!strcmp(token, "rc")) {
+        cmd = parse_cmd_reverse_continue(ctx, buf);
+    }
     if (!strcmp(token, "n")) {
         cmd = parse_cmd_step(ctx, buf);
     }
     if (!strcmp(token, "b")) {
         cmd = parse_cmd_set_breakpoint(ctx, buf);
     }
+    if (!strcmp(token, "w")) {
+        cmd = parse_cmd_set_watchpoint(ctx, buf);
+    }
     if (!strcmp(token, "i")) {
         cmd = parse_cmd_write_reg(ctx, buf);
     }
@@ -363,9 +513,17 @@ static struct debugger_cmd* parse_cmd(struct debugger_ctx* ctx) {
     if (!strcmp(token, "m")) {
         cmd = parse_cmd_dump_mem(ctx, buf);
     }
+    if (!strcmp(token, "disasm")) {
+        cmd = parse_cmd_disasm(ctx, buf);
+    }
     if (!strcmp(token, "e")) {
         cmd = parse_cmd_exit(ctx, buf);
     }
+#ifdef ENABLE_FLIGHT_RECORDER
+    if (!strcmp(token, "f")) {
+        cmd = parse_cmd_dump_flight(ctx, buf);
+    }
+#endif
 
     free(buf);
     return cmd;
@@ -379,9 +537,47 @@ static enum debugger_cmd_action debugger_dump_mem(struct debugger_ctx* ctx,
 
 static enum debugger_cmd_action debugger_dump_cpu(struct debugger_ctx* ctx,
                                                   struct debugger_cmd* cmd) {
-    dump_cpu(&ctx->vm->cpu);
+    dump_cpu(ctx->vm->out, &ctx->vm->cpu);
+    return PROMPT;
+}
+
+/* n instructions from an address, decoded whether or not they are code */
+static enum debugger_cmd_action debugger_disasm(struct debugger_ctx* ctx,
+                                                struct debugger_cmd* cmd) {
+    struct sigma16_disasm_rec* recs;
+    uint16_t* words;
+    int n = cmd->args[1].i;
+    ssize_t n_recs;
+
+    if (n < 1 || n > 1 << 15) {
+        fprintf(stderr, "invalid instruction count\n");
+        return PROMPT;
+    }
+    /* two words for every instruction at most, wrapping like the vm */
+    if (!(words = malloc(2 * n * sizeof *words)) ||
+        !(recs = malloc(2 * n * sizeof *recs))) {
+        free(words);
+        return ERROR;
+    }
+    for (int i = 0; i < 2 * n; ++i) {
+        words[i] = read_mem(ctx->vm, cmd->args[0].i + i);
+    }
+    if ((n_recs = sigma16_disasm(words, 2 * n, 0, DISASM_LINEAR, recs)) >= 0) {
+        dump_disasm(ctx->vm->out, recs, n_recs < n ? n_recs : n,
+                    cmd->args[0].i, ctx->vm->cpu.pc);
+    }
+    free(words);
+    free(recs);
+    return n_recs < 0 ? ERROR : PROMPT;
+}
+
+#ifdef ENABLE_FLIGHT_RECORDER
+static enum debugger_cmd_action debugger_dump_flight(
+    struct debugger_ctx* ctx, struct debugger_cmd* cmd) {
+    dump_flight_recorder(ctx->vm->out, ctx->vm);
     return PROMPT;
 }
+#endif
 
 static enum debugger_cmd_action debugger_help(struct debugger_ctx* ctx,
                                               struct debugger_cmd* cmd) {
@@ -394,38 +590,83 @@ static enum debugger_cmd_action debugger_help(struct debugger_ctx* ctx,
         " o (int)       : display value of specified register\n"
         " t             : toggle tracing\n"
         " c             : continue execution\n"
+        " rn (int)      : go back n steps\n"
+        " rc            : go back to the previous breakpoint or watchpoint\n"
+        " r             : restart the program, keeping breakpoints\n"
         " d             : dump processor state\n"
         " m (int) ?(int): inspect memory from end to start\n"
+        " disasm ?(int) ?(int)\n"
+        "               : disassemble n instructions from an address (pc)\n"
         " b (int)       : set breakpoint at specified address\n"
+        " b (int) if .. : break there only if e.g. R3 == 10 && m[R1] != 0\n"
+        " w (int) ?(int) ?(r|w|rw)\n"
+        "               : stop after writes (or reads) of an address range\n"
+#ifdef ENABLE_FLIGHT_RECORDER
+        " f             : dump recently executed instructions\n"
+#endif
         " e             : exit");
     return PROMPT;
 }
 
-/*
- *static enum debugger_cmd_action debugger_restart(struct debugger_ctx* ctx,
- *                                                 struct debugger_cmd* cmd) {
- *    char* fname = cmd->args->s;
- *
- *    puts("debugger restart");
- *    sigma16_vm_del(ctx->vm);
- *
- *    if (sigma16_vm_init(&(ctx->vm), fname) < 0) {
- *        fprintf(stderr, "unable to re-init VM\n");
- *        return -1;
- *    }
- *
- *    ctx->source = fname;
- *    printf("fname: %s\n", ctx->source);
- *
- *    return RESUME;
- *}
- */
+static enum debugger_cmd_action debugger_restart(struct debugger_ctx* ctx,
+                                                 struct debugger_cmd* cmd) {
+    sigma16_history_restart(ctx->vm);
+    ctx->halted = 0;
+    printf("Restarted %s.\n", ctx->source);
+    return PROMPT;
+}
+
+static void report_position(struct debugger_ctx* ctx) {
+    printf("instruction %llu, pc=%04x\n",
+           (unsigned long long)ctx->vm->icount, ctx->vm->cpu.pc);
+}
+
+static enum debugger_cmd_action debugger_reverse_step(
+    struct debugger_ctx* ctx, struct debugger_cmd* cmd) {
+    uint64_t n = cmd->args->i > 0 ? cmd->args->i : 1;
+    uint64_t target = ctx->vm->icount > n ? ctx->vm->icount - n : 0;
+
+    if (sigma16_history_rewind(ctx->vm, target) < 0) {
+        fprintf(stderr, "no history\n");
+        return PROMPT;
+    }
+    if (ctx->vm->icount > target) {
+        puts("History does not go back further.");
+    }
+    ctx->halted = 0;
+    report_position(ctx);
+    return PROMPT;
+}
+
+static void report_breakpoint(struct debugger_ctx* ctx);
+static void report_watchpoint(struct debugger_ctx* ctx);
+
+static enum debugger_cmd_action debugger_reverse_continue(
+    struct debugger_ctx* ctx, struct debugger_cmd* cmd) {
+    switch (sigma16_history_reverse_continue(ctx->vm)) {
+        case SIGMA16_EXEC_BREAK:
+            report_breakpoint(ctx);
+            break;
+        case SIGMA16_EXEC_WATCH:
+            report_watchpoint(ctx);
+            break;
+        case SIGMA16_EXEC_BUDGET:
+            puts("Reached the start of history.");
+            break;
+        default:
+            fprintf(stderr, "no history\n");
+            return PROMPT;
+    }
+    ctx->halted = 0;
+    report_position(ctx);
+    return PROMPT;
+}
 
 static enum debugger_cmd_action debugger_write_reg(struct debugger_ctx* ctx,
                                                    struct debugger_cmd* cmd) {
     int idx = cmd->args[0].i;
 
-    if (0 < idx && idx < 15) {
+    if (idx < 0 || idx > 15) {
         fprintf(stderr, "invalid register\n");
         return PROMPT;
     }
@@ -438,26 +679,48 @@ static enum debugger_cmd_action debugger_set_breakpoint(
     struct debugger_ctx* ctx, struct debugger_cmd* cmd) {
     static int id;
     struct debugger_bp* bp;
+    struct sigma16_expr* cond = NULL;
+    const char* error;
 
+    if (cmd->args[1].s &&
+        !(cond = sigma16_expr_compile(cmd->args[1].s, &error))) {
+        fprintf(stderr, "invalid condition: %s\n", error);
+        return PROMPT;
+    }
     if (!(bp = malloc(sizeof(*bp)))) {
         fprintf(stderr, "unable to create breakpoint\n");
+        free(cond);
         return ERROR;
     }
 
     bp->id = id++;
     bp->addr = cmd->args[0].i;
+    if (sigma16_vm_add_breakpoint(ctx->vm, bp->addr, cond) < 0) {
+        free(cond);
+        free(bp);
+        return ERROR;
+    }
     bp->next = ctx->breakpoints;
     ctx->breakpoints = bp;
 
     return PROMPT;
 }
 
+static enum debugger_cmd_action debugger_set_watchpoint(
+    struct debugger_ctx* ctx, struct debugger_cmd* cmd) {
+    if (sigma16_vm_add_watchpoint(ctx->vm, cmd->args[0].i, cmd->args[1].i,
+                                  cmd->args[2].i) < 0) {
+        return ERROR;
+    }
+    return PROMPT;
+}
+
 static enum debugger_cmd_action debugger_read_reg(struct debugger_ctx* ctx,
                                                   struct debugger_cmd* cmd) {
     int val;
     int idx = cmd->args[0].i;
 
-    if (0 < idx && idx < 15) {
+    if (idx < 0 || idx > 15) {
         fprintf(stderr, "invalid register\n");
         return PROMPT;
     }
@@ -469,13 +732,14 @@ static enum debugger_cmd_action debugger_read_reg(struct debugger_ctx* ctx,
 
 static enum debugger_cmd_action debugger_step(struct debugger_ctx* ctx,
                                               struct debugger_cmd* cmd) {
-    ctx->n_steps = cmd->args->i;
+    ctx->n_steps = cmd->args->i > 0 ? cmd->args->i : 1;
     return RESUME;
 }
 
 static enum debugger_cmd_action debugger_continue(struct debugger_ctx* ctx,
                                                   struct debugger_cmd* cmd) {
     puts("Continuing.");
+    ctx->n_steps = 0;
     return RESUME;
 }
 
@@ -521,11 +785,18 @@ static void debugger_interactive(struct debugger_ctx* ctx) {
             case SET_BREAKPOINT:
                 action = debugger_set_breakpoint(ctx, cmd);
                 break;
-            /*
-             *case RESTART:
-             *    action = debugger_restart(ctx, cmd);
-             *    break;
-             */
+            case SET_WATCHPOINT:
+                action = debugger_set_watchpoint(ctx, cmd);
+                break;
+            case RESTART:
+                action = debugger_restart(ctx, cmd);
+                break;
+            case REVERSE_STEP:
+                action = debugger_reverse_step(ctx, cmd);
+                break;
+            case REVERSE_CONTINUE:
+                action = debugger_reverse_continue(ctx, cmd);
+                break;
             case HELP:
                 action = debugger_help(ctx, cmd);
                 break;
@@ -538,6 +809,14 @@ static void debugger_interactive(struct debugger_ctx* ctx) {
             case DUMP_MEM:
                 action = debugger_dump_mem(ctx, cmd);
                 break;
+            case DISASSEMBLE:
+                action = debugger_disasm(ctx, cmd);
+                break;
+#ifdef ENABLE_FLIGHT_RECORDER
+            case DUMP_FLIGHT:
+                action = debugger_dump_flight(ctx, cmd);
+                break;
+#endif
         }
 
         destroy_cmd(cmd);
@@ -557,32 +836,85 @@ error:
     abort();
 }
 
-void yield_debugger(sigma16_vm_t* vm, enum sigma16_trace_event event) {
-    struct debugger_ctx* ctx = vm->vm_refl;
-
-    ctx->n_events++;
+/* back to the budget of the whole session after a step */
+static void restore_budget(struct debugger_ctx* ctx) {
+    ctx->vm->icount_limit = ctx->icount_limit;
+    ctx->vm->deadline = ctx->deadline;
+    ctx->vm->next_check = 0;
+}
 
-    if (ctx->trace) {
-        sigma16_trace(vm, event);
+static void report_breakpoint(struct debugger_ctx* ctx) {
+    for (struct debugger_bp* bp = ctx->breakpoints; bp; bp = bp->next) {
+        if (ctx->vm->cpu.pc == bp->addr) {
+            printf("breakpoint %d hit\n", bp->id);
+            return;
+        }
     }
+}
 
-    if (!--ctx->n_steps) {
-        debugger_interactive(ctx);
-    }
+static void report_watchpoint(struct debugger_ctx* ctx) {
+    printf("watchpoint hit: %s 0x%04x\n",
+           ctx->vm->watch_kind == WATCH_READ ? "read of" : "write to",
+           ctx->vm->watch_hit);
+}
 
-    if (event == EXEC_START) {
-        debugger_interactive(vm->vm_refl);
-    } else if (event == EXEC_END) {
-        puts("Post execution (limited commands).");
-        debugger_interactive(vm->vm_refl);
-    }
+/*
+ * Run the program under the debugger, prompting before the first
+ * instruction. Steps run on the traced interpreter; continue runs on the
+ * untraced one until a breakpoint stops it, unless tracing is on. Both
+ * keep history, see history.h. Returns like sigma16_vm_exec.
+ */
+int debugger_exec(sigma16_vm_t* vm) {
+    struct debugger_ctx* ctx = vm->vm_refl;
+    uint64_t left;
+    int ret;
 
-    for (struct debugger_bp* bp = ctx->breakpoints; bp; bp = bp->next) {
-        if (vm->cpu.pc == bp->addr) {
-            printf("breakpoint %d hit\n", bp->id);
-            debugger_interactive(ctx);
-            break;
+    ctx->icount_limit = vm->icount_limit;
+    ctx->deadline = vm->deadline;
+    debugger_interactive(ctx);
+    while (1) {
+        vm->trace_handler = ctx->trace ? sigma16_trace : NULL;
+        if (ctx->n_steps) {
+            left = ctx->icount_limit - vm->icount;
+            ret = sigma16_vm_step(vm, left < (uint64_t)ctx->n_steps
+                                          ? left
+                                          : (uint64_t)ctx->n_steps);
+            restore_budget(ctx);
+        } else {
+            restore_budget(ctx);
+            ret = sigma16_vm_exec(vm);
         }
+
+        switch (ret) {
+            case 0:
+                /* the post execution prompt may exit straight away */
+                if (vm->profile) {
+                    dump_profile(stderr, vm);
+                }
+                puts("Post execution (limited commands).");
+                ctx->halted = 1;
+                debugger_interactive(ctx);
+                /* going back in history carries on from there */
+                if (ctx->halted) {
+                    return 0;
+                }
+                continue;
+            case SIGMA16_EXEC_BREAK:
+                report_breakpoint(ctx);
+                break;
+            case SIGMA16_EXEC_WATCH:
+                report_watchpoint(ctx);
+                break;
+            case SIGMA16_EXEC_BUDGET:
+                /* or just the end of a step */
+                if (sigma16_vm_budget_exhausted(vm)) {
+                    return ret;
+                }
+                break;
+            default:
+                return ret;
+        }
+        debugger_interactive(ctx);
     }
 }
 
@@ -594,24 +926,29 @@ sigma16_vm_t* debugger_init(char* fname) {
         return NULL;
     }
 
-    vm = ctx->vm;
-
     if (sigma16_vm_init(&vm, fname) < 0) {
         fprintf(stderr, "unable to initialise VM\n");
-        goto error;
+        free(ctx);
+        return NULL;
     }
 
     ctx->source = fname;
-    ctx->n_steps = -1;
+    ctx->n_steps = 0;
+    ctx->halted = 0;
     ctx->breakpoints = NULL;
     ctx->vm = vm;
     ctx->trace = 1;
 
+    /* the initial snapshot restarts go back to */
+    if (sigma16_history_init(vm) < 0) {
+        goto error;
+    }
+
     vm->vm_refl = ctx;
-    vm->trace_handler = yield_debugger;
     return vm;
 error:
     debugger_teardown(ctx);
+    free(ctx);
     return NULL;
 }
 #endif
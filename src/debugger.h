@@ -1,6 +1,7 @@
 #pragma once
 #include "vm.h"
 
+/* numbered for display, the vm checks its breakpoints and their conditions */
 struct debugger_bp {
     int id;
     uint16_t addr;
@@ -8,8 +9,13 @@ struct debugger_bp {
 };
 
 struct debugger_ctx {
+    /* instructions to run before prompting again, 0 to continue */
     int n_steps;
-    int n_events;
+    /* budget given on the command line, see debugger_exec */
+    uint64_t icount_limit;
+    uint64_t deadline;
+    /* the program halted, unless the history moved it back since */
+    _Bool halted;
     _Bool trace;
     char* source;
     sigma16_vm_t* vm;
@@ -20,10 +26,17 @@ enum debugger_cmd_type {
     RESTART,
     STEP,
     CONTINUE,
+    REVERSE_STEP,
+    REVERSE_CONTINUE,
     TRACE,
     SET_BREAKPOINT,
+    SET_WATCHPOINT,
     DUMP_CPU,
     DUMP_MEM,
+#ifdef ENABLE_FLIGHT_RECORDER
+    DUMP_FLIGHT,
+#endif
+    DISASSEMBLE,
     WRITE_REG,
     READ_REG,
     HELP,
@@ -41,3 +54,4 @@ struct debugger_cmd {
 };
 
 sigma16_vm_t* debugger_init(char*);
+int debugger_exec(sigma16_vm_t*);
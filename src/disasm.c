@@ -0,0 +1,232 @@
+#include "disasm.h"
+
+#include <byteswap.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "instructions.h"
+
+static const char* RRR_INST_MNEMONICS[] = {
+    "add",   "sub", "mul", "div", "cmp", "cmplt", "cmpeq",
+    "cmpgt", "inv", "and", "or",  "xor", "nop",   "trap"};
+
+static const char* RX_INST_MNEMONICS[] = {"lea",   "load",   "store",
+                                          "jump",  "jumpc0", "jumpc1",
+                                          "jumpf", "jumpt",  "jal"};
+
+static const char* EXP_INST_MNEMONICS[] = {"rfi", "getctl", "putctl",
+                                           "shiftl", "shiftr"};
+
+static const char* CTL_NAMES[] = {"status", "mask", "req",  "istat",
+                                  "ipc",    "vect", "timer"};
+
+#define N_MNEMONICS(table) (sizeof table / sizeof *table)
+
+/* RX secondary opcodes which jump, see discover */
+#define RX_JUMP 3
+#define RX_JAL 8
+#define RRR_TRAP 13
+
+static inline uint16_t fetch(const uint16_t* words, size_t i, int flags) {
+    return flags & DISASM_BIG_ENDIAN ? bswap_16(words[i]) : words[i];
+}
+
+/* built whole, so that the compiler can store it in a few moves */
+static inline struct sigma16_disasm_rec decode(uint16_t word, uint16_t next) {
+    int op = word >> 12;
+
+    return (struct sigma16_disasm_rec){
+        .word = word,
+        .disp = op >= 0xe ? next : 0,
+        .kind = op == 0xf ? DISASM_RX : op == 0xe ? DISASM_EXP : DISASM_RRR,
+        .op = op == 0xf ? word & 0xf : op == 0xe ? word & 0xff : op,
+        .d = (word >> 8) & 0xf,
+        .sa = (word >> 4) & 0xf,
+        .sb = word & 0xf};
+}
+
+/* word is the instruction's first, next the word after it; addr is 0 */
+void sigma16_disasm_decode(uint16_t word, uint16_t next,
+                           struct sigma16_disasm_rec* rec) {
+    *rec = decode(word, next);
+}
+
+/* "???" for opcodes no instruction has */
+const char* sigma16_disasm_mnemonic(const struct sigma16_disasm_rec* rec) {
+    switch (rec->kind) {
+        case DISASM_RRR:
+            return rec->op < N_MNEMONICS(RRR_INST_MNEMONICS)
+                       ? RRR_INST_MNEMONICS[rec->op]
+                       : "???";
+        case DISASM_RX:
+            return rec->op < N_MNEMONICS(RX_INST_MNEMONICS)
+                       ? RX_INST_MNEMONICS[rec->op]
+                       : "???";
+        case DISASM_EXP:
+            return rec->op < N_MNEMONICS(EXP_INST_MNEMONICS)
+                       ? EXP_INST_MNEMONICS[rec->op]
+                       : "???";
+        default:
+            return "data";
+    }
+}
+
+/* name of control register ctl, NULL for numbers without one */
+const char* sigma16_disasm_ctl(int ctl) {
+    return ctl < N_MNEMONICS(CTL_NAMES) ? CTL_NAMES[ctl] : NULL;
+}
+
+/* plain text in assembler syntax, returns like snprintf */
+int sigma16_disasm_format(char* buf, size_t size,
+                          const struct sigma16_disasm_rec* rec) {
+    const char* name = sigma16_disasm_mnemonic(rec);
+
+    switch (rec->kind) {
+        case DISASM_DATA:
+            return snprintf(buf, size, "%-6s %04x", name, rec->word);
+        case DISASM_EXP:
+            switch (rec->op) {
+                case EXP_RFI:
+                    return snprintf(buf, size, "%s", name);
+                case EXP_GETCTL:
+                case EXP_PUTCTL:
+                    if (sigma16_disasm_ctl(rec->disp >> 12)) {
+                        return snprintf(buf, size, "%-6s R%d, %s", name,
+                                        rec->d,
+                                        sigma16_disasm_ctl(rec->disp >> 12));
+                    }
+                    return snprintf(buf, size, "%-6s R%d, %d", name, rec->d,
+                                    rec->disp >> 12);
+                case EXP_SHIFTL:
+                case EXP_SHIFTR:
+                    return snprintf(buf, size, "%-6s R%d, R%d, %d", name,
+                                    rec->d, rec->disp >> 12, rec->disp & 0xf);
+            }
+            return snprintf(buf, size, "%-6s R%d, %04x", name, rec->d,
+                            rec->disp);
+        case DISASM_RX:
+            /* jump has no use for d */
+            if (rec->op == RX_JUMP) {
+                return snprintf(buf, size, "%-6s %04x[R%d]", name, rec->disp,
+                                rec->sa);
+            }
+            return snprintf(buf, size, "%-6s R%d, %04x[R%d]", name, rec->d,
+                            rec->disp, rec->sa);
+    }
+    switch (rec->op) {
+        case 4:
+            return snprintf(buf, size, "%-6s R%d, R%d", name, rec->sa,
+                            rec->sb);
+        case 8:
+            return snprintf(buf, size, "%-6s R%d, R%d", name, rec->d,
+                            rec->sa);
+        case 12:
+            return snprintf(buf, size, "%s", name);
+        default:
+            return snprintf(buf, size, "%-6s R%d, R%d, R%d", name, rec->d,
+                            rec->sa, rec->sb);
+    }
+}
+
+static inline size_t inst_size(uint16_t word) {
+    return word >> 12 >= 0xe ? 2 : 1;
+}
+
+/*
+ * Mark the first word of every instruction reachable from entry with
+ * DISASM_CODE and jump targets with DISASM_TARGET. work has room for a path
+ * per instruction, each visited instruction pushes at most one.
+ */
+static void discover(const uint16_t* words, size_t n, uint16_t entry,
+                     int flags, uint8_t* marks, uint32_t* work) {
+    size_t n_work = 0;
+    size_t addr;
+    uint16_t word;
+    uint16_t disp;
+    int op, sa;
+
+    if (entry >= n) {
+        return;
+    }
+    marks[entry] |= DISASM_TARGET;
+    work[n_work++] = entry;
+    while (n_work) {
+        for (addr = work[--n_work]; addr < n && !(marks[addr] & DISASM_CODE);
+             addr += inst_size(word)) {
+            word = fetch(words, addr, flags);
+            if (addr + inst_size(word) > n) {
+                break;
+            }
+            op = word >> 12;
+            sa = (word >> 4) & 0xf;
+            if ((op == 0xe && (word & 0xff) >= N_MNEMONICS(EXP_INST_MNEMONICS))
+                || (op == 0xf &&
+                    (word & 0xf) >= N_MNEMONICS(RX_INST_MNEMONICS))) {
+                /* executing it is an error, so whatever follows is not */
+                break;
+            }
+            marks[addr] |= DISASM_CODE;
+            if (op == 0xe && (word & 0xff) == EXP_RFI) {
+                /* rfi goes back to where an interrupt came from */
+                break;
+            }
+            if (op == RRR_TRAP && !((word >> 8) & 0xf)) {
+                /* trap R0 halts */
+                break;
+            }
+            if (op != 0xf || (word & 0xf) < RX_JUMP) {
+                continue;
+            }
+            /* jumps indexed by R0 go to disp, the rest cannot be followed */
+            disp = fetch(words, addr + 1, flags);
+            if (!sa && disp < n && !(marks[disp] & DISASM_TARGET)) {
+                marks[disp] |= DISASM_TARGET;
+                work[n_work++] = disp;
+            }
+            if ((word & 0xf) == RX_JUMP) {
+                break;
+            }
+        }
+    }
+}
+
+/*
+ * Decode n words into out, which has room for n records, starting at entry
+ * unless flags has DISASM_LINEAR. Returns the number of records, or -1 if
+ * out of memory.
+ */
+ssize_t sigma16_disasm(const uint16_t* words, size_t n, uint16_t entry,
+                       int flags, struct sigma16_disasm_rec* out) {
+    struct sigma16_disasm_rec* rec = out;
+    uint8_t* marks = NULL;
+    uint32_t* work;
+    uint16_t word;
+    size_t size;
+
+    if (!(flags & DISASM_LINEAR)) {
+        if (!(marks = calloc(n ? n : 1, 1)) ||
+            !(work = malloc(n ? n * sizeof *work : 1))) {
+            free(marks);
+            return -1;
+        }
+        discover(words, n, entry, flags, marks, work);
+        free(work);
+    }
+    for (size_t addr = 0; addr < n; addr += size, ++rec) {
+        word = fetch(words, addr, flags);
+        size = inst_size(word);
+        if (addr + size <= n && (!marks || (marks[addr] & DISASM_CODE))) {
+            *rec = decode(word, size > 1 ? fetch(words, addr + 1, flags) : 0);
+            rec->flags = marks ? marks[addr] : DISASM_CODE;
+        } else {
+            *rec = decode(word, 0);
+            rec->kind = DISASM_DATA;
+            rec->disp = 0;
+            rec->flags = marks ? marks[addr] : 0;
+            size = 1;
+        }
+        rec->addr = addr;
+    }
+    free(marks);
+    return rec - out;
+}
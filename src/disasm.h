@@ -0,0 +1,58 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/*
+ * Disassembler shared by tracing, the profile and flight recorder reports,
+ * the debugger's disasm command, --disasm and the Python bindings.
+ *
+ * sigma16_disasm decodes a buffer of words into a flat array of records,
+ * one per instruction or data word. Code is told from data by following
+ * control flow from an entry point: fall through, jump targets with R0 as
+ * the index register and the return address of jal. Computed jumps end a
+ * path, so code only reached through one is listed as data. With
+ * DISASM_LINEAR every word is decoded as an instruction instead.
+ */
+
+enum sigma16_disasm_kind { DISASM_DATA, DISASM_RRR, DISASM_RX, DISASM_EXP };
+
+/* record flags */
+/* reached from the entry point, or decoded with DISASM_LINEAR */
+#define DISASM_CODE 1
+/* the entry point or the target of a jump */
+#define DISASM_TARGET 2
+
+/* sigma16_disasm flags */
+/* the buffer holds big-endian words, as executables do */
+#define DISASM_BIG_ENDIAN 1
+/* decode every word from the start as code, without following jumps */
+#define DISASM_LINEAR 2
+
+struct sigma16_disasm_rec {
+    /* index of the first word in the buffer */
+    uint32_t addr;
+    uint16_t word;
+    /* second word of RX and EXP instructions, else 0 */
+    uint16_t disp;
+    /* enum sigma16_disasm_kind */
+    uint8_t kind;
+    /* opcode, the secondary one for RX and EXP instructions */
+    uint8_t op;
+    uint8_t d;
+    uint8_t sa;
+    uint8_t sb;
+    uint8_t flags;
+    uint8_t _pad[2];
+};
+
+/* PEP 3118 structure of a record, NumPy turns it into named fields */
+#define DISASM_REC_FORMAT \
+    "T{I:addr:H:word:H:disp:B:kind:B:op:B:d:B:sa:B:sb:B:flags:2x}"
+
+void sigma16_disasm_decode(uint16_t, uint16_t, struct sigma16_disasm_rec*);
+const char* sigma16_disasm_mnemonic(const struct sigma16_disasm_rec*);
+const char* sigma16_disasm_ctl(int);
+int sigma16_disasm_format(char*, size_t, const struct sigma16_disasm_rec*);
+ssize_t sigma16_disasm(const uint16_t*, size_t, uint16_t, int,
+                       struct sigma16_disasm_rec*);
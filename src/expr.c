@@ -0,0 +1,301 @@
+#include "expr.h"
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* limits on a single condition */
+#define EXPR_MAX_CODE 256
+#define EXPR_MAX_STACK 32
+/* unary operators, brackets and memory words within each other */
+#define EXPR_MAX_NESTING 64
+
+/* stack machine instructions, operands follow them (immediates low first) */
+enum expr_op {
+    /* push the next two bytes */
+    EXPR_IMM,
+    /* push the register numbered by the next byte */
+    EXPR_REG,
+    /* replace an address with the memory word there */
+    EXPR_LOAD,
+    EXPR_NOT,
+    EXPR_NEG,
+    EXPR_ADD,
+    EXPR_SUB,
+    EXPR_AND,
+    EXPR_OR,
+    EXPR_XOR,
+    EXPR_EQ,
+    EXPR_NE,
+    EXPR_LT,
+    EXPR_LE,
+    EXPR_GT,
+    EXPR_GE,
+    EXPR_LAND,
+    EXPR_LOR
+};
+
+/*
+ * Recursive descent, lowest precedence first:
+ *
+ * or      := and ("||" and)*
+ * and     := compare ("&&" compare)*
+ * compare := sum (("==" | "!=" | "<" | "<=" | ">" | ">=") sum)?
+ * sum     := unary (("+" | "-" | "&" | "|" | "^") unary)*
+ * unary   := ("!" | "-") unary | primary
+ * primary := number | "R" register | "m[" or "]" | "(" or ")"
+ */
+struct parser {
+    const char* s;
+    uint8_t code[EXPR_MAX_CODE];
+    int len;
+    /* words on the stack at this point of the code, and at most */
+    int depth;
+    int max_depth;
+    /* parse_unary calls in progress, bounded before any code is emitted */
+    int nesting;
+    /* the first error, parsing carries on harmlessly after it */
+    const char* error;
+};
+
+static void fail(struct parser* p, const char* error) {
+    if (!p->error) {
+        p->error = error;
+    }
+}
+
+static void emit_byte(struct parser* p, uint8_t byte) {
+    if (p->len == EXPR_MAX_CODE) {
+        fail(p, "condition is too long");
+        return;
+    }
+    p->code[p->len++] = byte;
+}
+
+/* effect is the change in stack depth */
+static void emit(struct parser* p, enum expr_op op, int effect) {
+    emit_byte(p, op);
+    p->depth += effect;
+    if (p->depth > p->max_depth) {
+        p->max_depth = p->depth;
+    }
+    if (p->max_depth > EXPR_MAX_STACK) {
+        fail(p, "condition is nested too deeply");
+    }
+}
+
+static void skip_space(struct parser* p) {
+    while (isspace((unsigned char)*p->s)) {
+        p->s++;
+    }
+}
+
+/* op, but not the start of a longer operator such as "&&" for "&" */
+static int accept(struct parser* p, const char* op, const char* not_before) {
+    size_t n = strlen(op);
+
+    skip_space(p);
+    if (strncmp(p->s, op, n) ||
+        (not_before && p->s[n] && strchr(not_before, p->s[n]))) {
+        return 0;
+    }
+    p->s += n;
+    return 1;
+}
+
+static void expect(struct parser* p, const char* op) {
+    if (!accept(p, op, NULL)) {
+        fail(p, *op == ')' ? "missing )" : "missing ]");
+    }
+}
+
+static void parse_or(struct parser*);
+
+static void parse_primary(struct parser* p) {
+    unsigned long val;
+    char* end;
+
+    skip_space(p);
+    if (accept(p, "(", NULL)) {
+        parse_or(p);
+        expect(p, ")");
+    } else if (tolower((unsigned char)p->s[0]) == 'm' && p->s[1] == '[') {
+        p->s += 2;
+        parse_or(p);
+        expect(p, "]");
+        emit(p, EXPR_LOAD, 0);
+    } else if (tolower((unsigned char)p->s[0]) == 'r' &&
+               isdigit((unsigned char)p->s[1])) {
+        if ((val = strtoul(p->s + 1, &end, 10)) > 15) {
+            fail(p, "no such register");
+        }
+        p->s = end;
+        emit(p, EXPR_REG, 1);
+        emit_byte(p, val);
+    } else if (isdigit((unsigned char)p->s[0])) {
+        if ((val = strtoul(p->s, &end, 0)) > 0xffff) {
+            fail(p, "number does not fit in a word");
+        }
+        p->s = end;
+        emit(p, EXPR_IMM, 1);
+        emit_byte(p, val & 0xff);
+        emit_byte(p, val >> 8);
+    } else {
+        fail(p, "expected a register, memory word or number");
+    }
+}
+
+static void parse_unary(struct parser* p) {
+    if (p->nesting == EXPR_MAX_NESTING) {
+        fail(p, "condition is nested too deeply");
+    }
+    if (p->error) {
+        return;
+    }
+    p->nesting++;
+    if (accept(p, "!", "=")) {
+        parse_unary(p);
+        emit(p, EXPR_NOT, 0);
+    } else if (accept(p, "-", NULL)) {
+        parse_unary(p);
+        emit(p, EXPR_NEG, 0);
+    } else {
+        parse_primary(p);
+    }
+    p->nesting--;
+}
+
+static void parse_sum(struct parser* p) {
+    enum expr_op op;
+
+    parse_unary(p);
+    while (!p->error) {
+        if (accept(p, "+", NULL)) {
+            op = EXPR_ADD;
+        } else if (accept(p, "-", NULL)) {
+            op = EXPR_SUB;
+        } else if (accept(p, "&", "&")) {
+            op = EXPR_AND;
+        } else if (accept(p, "|", "|")) {
+            op = EXPR_OR;
+        } else if (accept(p, "^", NULL)) {
+            op = EXPR_XOR;
+        } else {
+            return;
+        }
+        parse_unary(p);
+        emit(p, op, -1);
+    }
+}
+
+static void parse_compare(struct parser* p) {
+    enum expr_op op;
+
+    parse_sum(p);
+    if (accept(p, "==", NULL)) {
+        op = EXPR_EQ;
+    } else if (accept(p, "!=", NULL)) {
+        op = EXPR_NE;
+    } else if (accept(p, "<=", NULL)) {
+        op = EXPR_LE;
+    } else if (accept(p, "<", NULL)) {
+        op = EXPR_LT;
+    } else if (accept(p, ">=", NULL)) {
+        op = EXPR_GE;
+    } else if (accept(p, ">", NULL)) {
+        op = EXPR_GT;
+    } else {
+        return;
+    }
+    parse_sum(p);
+    emit(p, op, -1);
+}
+
+static void parse_and(struct parser* p) {
+    parse_compare(p);
+    while (!p->error && accept(p, "&&", NULL)) {
+        parse_compare(p);
+        emit(p, EXPR_LAND, -1);
+    }
+}
+
+static void parse_or(struct parser* p) {
+    parse_and(p);
+    while (!p->error && accept(p, "||", NULL)) {
+        parse_and(p);
+        emit(p, EXPR_LOR, -1);
+    }
+}
+
+/* NULL with *error describing the problem if src is not a condition */
+struct sigma16_expr* sigma16_expr_compile(const char* src,
+                                          const char** error) {
+    struct parser p = {.s = src};
+    struct sigma16_expr* expr;
+
+    parse_or(&p);
+    skip_space(&p);
+    if (*p.s) {
+        fail(&p, "unexpected text after the condition");
+    }
+    if (p.error) {
+        *error = p.error;
+        return NULL;
+    }
+    if (!(expr = malloc(sizeof *expr + p.len))) {
+        *error = "out of memory";
+        return NULL;
+    }
+    expr->len = p.len;
+    memcpy(expr->code, p.code, p.len);
+    return expr;
+}
+
+#define BINARY(op, result)   \
+    case op:                 \
+        b = stack[top--];    \
+        a = stack[top];      \
+        stack[top] = result; \
+        break
+
+uint16_t sigma16_expr_eval(const struct sigma16_expr* expr,
+                           sigma16_vm_t* vm) {
+    uint16_t stack[EXPR_MAX_STACK];
+    uint16_t a, b;
+    int top = -1;
+
+    for (int pc = 0; pc < expr->len;) {
+        switch (expr->code[pc++]) {
+            case EXPR_IMM:
+                stack[++top] = expr->code[pc] | expr->code[pc + 1] << 8;
+                pc += 2;
+                break;
+            case EXPR_REG:
+                stack[++top] = vm->cpu.regs[expr->code[pc++]];
+                break;
+            case EXPR_LOAD:
+                stack[top] = read_mem(vm, stack[top]);
+                break;
+            case EXPR_NOT:
+                stack[top] = !stack[top];
+                break;
+            case EXPR_NEG:
+                stack[top] = -stack[top];
+                break;
+            BINARY(EXPR_ADD, a + b);
+            BINARY(EXPR_SUB, a - b);
+            BINARY(EXPR_AND, a & b);
+            BINARY(EXPR_OR, a | b);
+            BINARY(EXPR_XOR, a ^ b);
+            BINARY(EXPR_EQ, a == b);
+            BINARY(EXPR_NE, a != b);
+            BINARY(EXPR_LT, a < b);
+            BINARY(EXPR_LE, a <= b);
+            BINARY(EXPR_GT, a > b);
+            BINARY(EXPR_GE, a >= b);
+            BINARY(EXPR_LAND, a && b);
+            BINARY(EXPR_LOR, a || b);
+        }
+    }
+    return stack[0];
+}
@@ -0,0 +1,17 @@
+#pragma once
+#include <stdint.h>
+
+#include "vm.h"
+
+/*
+ * Conditions of breakpoints, e.g. "R3 == 10 && m[R1 + 2] != 0", compiled
+ * to code for a small stack machine. Values are unsigned 16-bit words,
+ * comparisons and logical operators yield 0 or 1.
+ */
+struct sigma16_expr {
+    int len;
+    uint8_t code[];
+};
+
+struct sigma16_expr* sigma16_expr_compile(const char*, const char**);
+uint16_t sigma16_expr_eval(const struct sigma16_expr*, sigma16_vm_t*);
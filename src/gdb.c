@@ -0,0 +1,728 @@
+#include "gdb.h"
+
+#include <arpa/inet.h>
+#include <ctype.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "vm.h"
+
+/* largest packet either way, as advertised in qSupported */
+#define GDB_PACKET_SIZE 4096
+
+/* GDB addresses bytes, two per word */
+#define GDB_ADDR_MASK 0x1ffff
+
+/* GDB's signal numbers, for stop replies */
+#define GDB_SIGINT 2
+#define GDB_SIGILL 4
+#define GDB_SIGTRAP 5
+#define GDB_SIGXCPU 24
+
+static const char target_xml[] =
+    "<?xml version=\"1.0\"?>"
+    "<!DOCTYPE target SYSTEM \"gdb-target.dtd\">"
+    "<target version=\"1.0\">"
+    "<feature name=\"org.sigma16.core\">"
+    "<reg name=\"r0\" bitsize=\"16\" type=\"uint16\" regnum=\"0\"/>"
+    "<reg name=\"r1\" bitsize=\"16\" type=\"uint16\"/>"
+    "<reg name=\"r2\" bitsize=\"16\" type=\"uint16\"/>"
+    "<reg name=\"r3\" bitsize=\"16\" type=\"uint16\"/>"
+    "<reg name=\"r4\" bitsize=\"16\" type=\"uint16\"/>"
+    "<reg name=\"r5\" bitsize=\"16\" type=\"uint16\"/>"
+    "<reg name=\"r6\" bitsize=\"16\" type=\"uint16\"/>"
+    "<reg name=\"r7\" bitsize=\"16\" type=\"uint16\"/>"
+    "<reg name=\"r8\" bitsize=\"16\" type=\"uint16\"/>"
+    "<reg name=\"r9\" bitsize=\"16\" type=\"uint16\"/>"
+    "<reg name=\"r10\" bitsize=\"16\" type=\"uint16\"/>"
+    "<reg name=\"r11\" bitsize=\"16\" type=\"uint16\"/>"
+    "<reg name=\"r12\" bitsize=\"16\" type=\"uint16\"/>"
+    "<reg name=\"r13\" bitsize=\"16\" type=\"uint16\"/>"
+    "<reg name=\"r14\" bitsize=\"16\" type=\"uint16\"/>"
+    "<reg name=\"r15\" bitsize=\"16\" type=\"uint16\"/>"
+    "<reg name=\"pc\" bitsize=\"32\" type=\"code_ptr\"/>"
+    "</feature>"
+    "</target>";
+
+/* a breakpoint GDB set, remembered to tell it which kind stopped */
+struct gdb_bp {
+    uint16_t addr;
+    _Bool hardware;
+};
+
+struct gdb {
+    int fd;
+    sigma16_vm_t* vm;
+    /* budget of the whole session, runs are sliced to poll for interrupts */
+    uint64_t icount_limit;
+    uint64_t deadline;
+    _Bool no_ack;
+    _Bool interrupted;
+    /* the program halted, GDB was told it exited */
+    _Bool exited;
+    struct gdb_bp* bps;
+    int n_bps;
+    /* received bytes not yet parsed are in[in_pos, in_len) */
+    unsigned char in[GDB_PACKET_SIZE];
+    size_t in_pos;
+    size_t in_len;
+    /* the packet being handled, unescaped, and its length */
+    char packet[GDB_PACKET_SIZE + 1];
+    size_t len;
+    char reply[GDB_PACKET_SIZE + 1];
+};
+
+static int hex_digit(int c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    c = tolower(c);
+    return c >= 'a' && c <= 'f' ? c - 'a' + 10 : -1;
+}
+
+/* the hex number at *s, leaving *s after it */
+static unsigned long parse_hex(const char** s) {
+    unsigned long val = 0;
+
+    while (hex_digit(**s) >= 0) {
+        val = val << 4 | hex_digit(*(*s)++);
+    }
+    return val;
+}
+
+/* the next received byte, -1 once GDB is gone */
+static int next_byte(struct gdb* g) {
+    ssize_t n;
+
+    if (g->in_pos == g->in_len) {
+        while ((n = recv(g->fd, g->in, sizeof g->in, 0)) < 0 &&
+               errno == EINTR) {
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        g->in_pos = 0;
+        g->in_len = n;
+    }
+    return g->in[g->in_pos++];
+}
+
+static int send_all(struct gdb* g, const void* buf, size_t len) {
+    ssize_t n;
+
+    while (len) {
+        if ((n = send(g->fd, buf, len, MSG_NOSIGNAL)) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        buf = (const char*)buf + n;
+        len -= n;
+    }
+    return 0;
+}
+
+static int send_packet(struct gdb* g, const char* data) {
+    char trailer[4];
+    unsigned char sum = 0;
+
+    for (const char* c = data; *c; ++c) {
+        sum += *c;
+    }
+    snprintf(trailer, sizeof trailer, "#%02x", sum);
+    if (send_all(g, "$", 1) < 0 || send_all(g, data, strlen(data)) < 0) {
+        return -1;
+    }
+    return send_all(g, trailer, 3);
+}
+
+/* into g->packet, acknowledging it; -1 once GDB is gone */
+static int read_packet(struct gdb* g) {
+    unsigned char sum;
+    int c, check;
+
+    while (1) {
+        /* acks, and interrupts which came too late to matter */
+        while ((c = next_byte(g)) != '$') {
+            if (c < 0) {
+                return -1;
+            }
+        }
+        g->len = 0;
+        sum = 0;
+        while ((c = next_byte(g)) != '#') {
+            if (c < 0) {
+                return -1;
+            }
+            sum += c;
+            /* binary data escapes $, #, } and * */
+            if (c == '}') {
+                if ((c = next_byte(g)) < 0) {
+                    return -1;
+                }
+                sum += c;
+                c ^= 0x20;
+            }
+            if (g->len < GDB_PACKET_SIZE) {
+                g->packet[g->len++] = c;
+            }
+        }
+        g->packet[g->len] = '\0';
+        if ((c = next_byte(g)) < 0 || (check = next_byte(g)) < 0) {
+            return -1;
+        }
+        if (g->no_ack) {
+            return 0;
+        }
+        if (hex_digit(c) << 4 == (sum & 0xf0) && hex_digit(check) == (sum & 0xf)) {
+            return send_all(g, "+", 1);
+        }
+        if (send_all(g, "-", 1) < 0) {
+            return -1;
+        }
+    }
+}
+
+/* nonzero if GDB sent an interrupt, keeping anything else it sent */
+static int poll_interrupt(struct gdb* g) {
+    struct pollfd pfd = {.fd = g->fd, .events = POLLIN};
+    size_t kept;
+    ssize_t n;
+
+    if (g->in_pos == g->in_len) {
+        g->in_pos = g->in_len = 0;
+    }
+    if (poll(&pfd, 1, 0) <= 0 || g->in_len == sizeof g->in) {
+        return 0;
+    }
+    if ((n = recv(g->fd, g->in + g->in_len, sizeof g->in - g->in_len, 0)) <=
+        0) {
+        /* gone, the next read notices */
+        return 1;
+    }
+    kept = g->in_len;
+    for (size_t i = g->in_len; i < g->in_len + n; ++i) {
+        if (g->in[i] == 0x03) {
+            g->interrupted = 1;
+        } else {
+            g->in[kept++] = g->in[i];
+        }
+    }
+    g->in_len = kept;
+    return g->interrupted;
+}
+
+static void restore_budget(struct gdb* g) {
+    g->vm->icount_limit = g->icount_limit;
+    g->vm->deadline = g->deadline;
+    g->vm->next_check = 0;
+}
+
+/* continue, in slices so that GDB can interrupt */
+static int resume(struct gdb* g) {
+    sigma16_vm_t* vm = g->vm;
+    uint64_t slice;
+    _Bool first = 1;
+    int ret;
+
+    g->interrupted = 0;
+    do {
+        /* every run lets a breakpoint at pc pass, only the first may */
+        if (!first && vm->n_breakpoints && sigma16_vm_should_break(vm)) {
+            return SIGMA16_EXEC_BREAK;
+        }
+        slice = vm->icount + GDB_POLL_INTERVAL;
+        vm->icount_limit = slice < g->icount_limit ? slice : g->icount_limit;
+        vm->deadline = g->deadline;
+        vm->next_check = 0;
+        ret = sigma16_vm_exec(vm);
+        restore_budget(g);
+        first = 0;
+    } while (ret == SIGMA16_EXEC_BUDGET &&
+             !sigma16_vm_budget_exhausted(vm) && !poll_interrupt(g));
+    return ret;
+}
+
+static int step(struct gdb* g) {
+    int ret;
+
+    g->interrupted = 0;
+    if (sigma16_vm_budget_exhausted(g->vm)) {
+        return SIGMA16_EXEC_BUDGET;
+    }
+    ret = sigma16_vm_step(g->vm, 1);
+    restore_budget(g);
+    return ret;
+}
+
+static const char* stop_reason(struct gdb* g) {
+    sigma16_vm_t* vm = g->vm;
+
+    for (int i = 0; i < g->n_bps; ++i) {
+        if (g->bps[i].addr == vm->cpu.pc) {
+            return g->bps[i].hardware ? "hwbreak:;" : "swbreak:;";
+        }
+    }
+    return "";
+}
+
+/* the stop reply for a run which returned ret */
+static void stop_reply(struct gdb* g, int ret) {
+    sigma16_vm_t* vm = g->vm;
+
+    switch (ret) {
+        case 0:
+            g->exited = 1;
+            snprintf(g->reply, sizeof g->reply, "W00");
+            break;
+        case SIGMA16_EXEC_BREAK:
+            snprintf(g->reply, sizeof g->reply, "T%02x%s", GDB_SIGTRAP,
+                     stop_reason(g));
+            break;
+        case SIGMA16_EXEC_WATCH:
+            snprintf(g->reply, sizeof g->reply, "T%02x%s:%x;", GDB_SIGTRAP,
+                     vm->watch_kind == WATCH_READ ? "rwatch" : "watch",
+                     vm->watch_hit << 1);
+            break;
+        case SIGMA16_EXEC_BUDGET:
+            /* also the end of a step */
+            snprintf(g->reply, sizeof g->reply, "S%02x",
+                     g->interrupted                    ? GDB_SIGINT
+                     : sigma16_vm_budget_exhausted(vm) ? GDB_SIGXCPU
+                                                       : GDB_SIGTRAP);
+            break;
+        default:
+            snprintf(g->reply, sizeof g->reply, "S%02x", GDB_SIGILL);
+    }
+}
+
+/* the byte of memory at a GDB address */
+static uint8_t read_byte(sigma16_vm_t* vm, uint32_t addr) {
+    uint16_t word = read_mem(vm, addr >> 1);
+
+    return addr & 1 ? word & 0xff : word >> 8;
+}
+
+static void write_byte(sigma16_vm_t* vm, uint32_t addr, uint8_t byte) {
+    uint16_t word = read_mem(vm, addr >> 1);
+
+    word = addr & 1 ? (word & 0xff00) | byte : (word & 0xff) | byte << 8;
+    write_mem(vm, addr >> 1, word);
+}
+
+static void read_registers(struct gdb* g) {
+    char* out = g->reply;
+
+    for (int i = 0; i < 16; ++i) {
+        out += sprintf(out, "%04x", g->vm->cpu.regs[i]);
+    }
+    sprintf(out, "%08x", g->vm->cpu.pc << 1);
+}
+
+/* registers are numbered as in the target description, pc is 16 */
+static int write_register(sigma16_vm_t* vm, unsigned long reg,
+                          unsigned long val) {
+    if (reg < 16) {
+        vm->cpu.regs[reg] = val;
+    } else if (reg == 16) {
+        vm->cpu.pc = val >> 1;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+static void write_registers(struct gdb* g) {
+    const char* in = g->packet + 1;
+    unsigned long val;
+
+    for (int reg = 0; reg <= 16 && *in; ++reg) {
+        val = 0;
+        for (int i = 0; i < (reg < 16 ? 4 : 8) && hex_digit(*in) >= 0; ++i) {
+            val = val << 4 | hex_digit(*in++);
+        }
+        write_register(g->vm, reg, val);
+    }
+    strcpy(g->reply, "OK");
+}
+
+static void read_register(struct gdb* g) {
+    const char* in = g->packet + 1;
+    unsigned long reg = parse_hex(&in);
+
+    if (reg < 16) {
+        sprintf(g->reply, "%04x", g->vm->cpu.regs[reg]);
+    } else if (reg == 16) {
+        sprintf(g->reply, "%08x", g->vm->cpu.pc << 1);
+    } else {
+        strcpy(g->reply, "E01");
+    }
+}
+
+static void write_register_packet(struct gdb* g) {
+    const char* in = g->packet + 1;
+    unsigned long reg = parse_hex(&in);
+    unsigned long val;
+
+    if (*in++ != '=') {
+        strcpy(g->reply, "E01");
+        return;
+    }
+    val = parse_hex(&in);
+    strcpy(g->reply, write_register(g->vm, reg, val) < 0 ? "E01" : "OK");
+}
+
+static void read_memory(struct gdb* g) {
+    const char* in = g->packet + 1;
+    unsigned long addr = parse_hex(&in);
+    unsigned long len = *in == ',' ? (in++, parse_hex(&in)) : 0;
+    char* out = g->reply;
+
+    if (len > GDB_PACKET_SIZE / 2) {
+        len = GDB_PACKET_SIZE / 2;
+    }
+    /* memory wraps around like the vm's */
+    for (unsigned long i = 0; i < len; ++i) {
+        out += sprintf(out, "%02x",
+                       read_byte(g->vm, (addr + i) & GDB_ADDR_MASK));
+    }
+    *out = '\0';
+}
+
+/* M addr,len:hex and X addr,len:binary */
+static void write_memory(struct gdb* g) {
+    const char* in = g->packet + 1;
+    unsigned long addr = parse_hex(&in);
+    unsigned long len = *in == ',' ? (in++, parse_hex(&in)) : 0;
+    const char* data;
+    int byte;
+
+    if (*in++ != ':') {
+        strcpy(g->reply, "E01");
+        return;
+    }
+    data = in;
+    for (unsigned long i = 0; i < len; ++i) {
+        if (g->packet[0] == 'X') {
+            if (data + i >= g->packet + g->len) {
+                break;
+            }
+            byte = (uint8_t)data[i];
+        } else {
+            if (hex_digit(data[2 * i]) < 0 || hex_digit(data[2 * i + 1]) < 0) {
+                break;
+            }
+            byte = hex_digit(data[2 * i]) << 4 | hex_digit(data[2 * i + 1]);
+        }
+        write_byte(g->vm, (addr + i) & GDB_ADDR_MASK, byte);
+    }
+    strcpy(g->reply, "OK");
+}
+
+static int add_bp(struct gdb* g, uint16_t addr, _Bool hardware) {
+    struct gdb_bp* bps;
+
+    if (!(bps = realloc(g->bps, (g->n_bps + 1) * sizeof *bps))) {
+        return -1;
+    }
+    g->bps = bps;
+    if (sigma16_vm_add_breakpoint(g->vm, addr, NULL) < 0) {
+        return -1;
+    }
+    bps[g->n_bps++] = (struct gdb_bp){addr, hardware};
+    return 0;
+}
+
+static void remove_bp(struct gdb* g, uint16_t addr, _Bool hardware) {
+    for (int i = g->n_bps - 1; i >= 0; --i) {
+        if (g->bps[i].addr == addr && g->bps[i].hardware == hardware) {
+            g->bps[i] = g->bps[--g->n_bps];
+            sigma16_vm_remove_breakpoint(g->vm, addr);
+            return;
+        }
+    }
+}
+
+/* Z type,addr,kind and z type,addr,kind */
+static void change_point(struct gdb* g) {
+    static const int watch_kinds[] = {WATCH_WRITE, WATCH_READ,
+                                      WATCH_READ | WATCH_WRITE};
+    const char* in = g->packet + 1;
+    unsigned long type = parse_hex(&in);
+    unsigned long addr = *in == ',' ? (in++, parse_hex(&in)) : 0;
+    unsigned long len = *in == ',' ? (in++, parse_hex(&in)) : 1;
+    _Bool insert = g->packet[0] == 'Z';
+    int failed = 0;
+
+    addr &= GDB_ADDR_MASK;
+    switch (type) {
+        case 0:
+        case 1:
+            if (insert) {
+                failed = add_bp(g, addr >> 1, type) < 0;
+            } else {
+                remove_bp(g, addr >> 1, type);
+            }
+            break;
+        case 2:
+        case 3:
+        case 4:
+            /* only the watchpoint of this type and length, like remove_bp */
+            if (!insert) {
+                sigma16_vm_remove_watch_range(
+                    g->vm, addr >> 1, (addr + (len ? len : 1) - 1) >> 1,
+                    watch_kinds[type - 2]);
+            } else {
+                failed = sigma16_vm_add_watchpoint(
+                             g->vm, addr >> 1,
+                             (addr + (len ? len : 1) - 1) >> 1,
+                             watch_kinds[type - 2]) < 0;
+            }
+            break;
+        default:
+            /* unsupported */
+            g->reply[0] = '\0';
+            return;
+    }
+    strcpy(g->reply, failed ? "E0c" : "OK");
+}
+
+/* qXfer:features:read:target.xml:offset,length */
+static void read_features(struct gdb* g, const char* in) {
+    unsigned long offset;
+    unsigned long len;
+    size_t total = sizeof target_xml - 1;
+
+    if (strncmp(in, "target.xml:", 11)) {
+        strcpy(g->reply, "E00");
+        return;
+    }
+    in += 11;
+    offset = parse_hex(&in);
+    len = *in == ',' ? (in++, parse_hex(&in)) : 0;
+    if (offset > total) {
+        offset = total;
+    }
+    if (len > GDB_PACKET_SIZE - 1) {
+        len = GDB_PACKET_SIZE - 1;
+    }
+    if (len > total - offset) {
+        len = total - offset;
+    }
+    g->reply[0] = offset + len < total ? 'm' : 'l';
+    memcpy(g->reply + 1, target_xml + offset, len);
+    g->reply[1 + len] = '\0';
+}
+
+static void query(struct gdb* g) {
+    const char* p = g->packet;
+
+    if (!strncmp(p, "qSupported", 10)) {
+        snprintf(g->reply, sizeof g->reply,
+                 "PacketSize=%x;qXfer:features:read+;swbreak+;hwbreak+;"
+                 "QStartNoAckMode+",
+                 GDB_PACKET_SIZE);
+    } else if (!strncmp(p, "qXfer:features:read:", 20)) {
+        read_features(g, p + 20);
+    } else if (!strcmp(p, "qAttached")) {
+        strcpy(g->reply, "1");
+    } else if (!strcmp(p, "qSymbol::")) {
+        strcpy(g->reply, "OK");
+    } else if (!strcmp(p, "QStartNoAckMode")) {
+        /* from the next packet on */
+        strcpy(g->reply, "OK");
+    } else {
+        g->reply[0] = '\0';
+    }
+}
+
+/*
+ * Serve packets until GDB kills the program or goes away (0) or detaches
+ * from it (1).
+ */
+static int serve(struct gdb* g) {
+    while (read_packet(g) == 0) {
+        g->reply[0] = '\0';
+        switch (g->packet[0]) {
+            case '?':
+                if (g->exited) {
+                    strcpy(g->reply, "W00");
+                } else {
+                    snprintf(g->reply, sizeof g->reply, "S%02x",
+                             GDB_SIGTRAP);
+                }
+                break;
+            case 'g':
+                read_registers(g);
+                break;
+            case 'G':
+                write_registers(g);
+                break;
+            case 'p':
+                read_register(g);
+                break;
+            case 'P':
+                write_register_packet(g);
+                break;
+            case 'm':
+                read_memory(g);
+                break;
+            case 'M':
+            case 'X':
+                write_memory(g);
+                break;
+            case 'c':
+            case 's':
+                if (g->exited) {
+                    strcpy(g->reply, "W00");
+                    break;
+                }
+                /* c addr and s addr resume at addr */
+                if (g->packet[1]) {
+                    const char* in = g->packet + 1;
+
+                    g->vm->cpu.pc = parse_hex(&in) >> 1;
+                }
+                stop_reply(g, g->packet[0] == 'c' ? resume(g) : step(g));
+                break;
+            case 'H':
+                strcpy(g->reply, "OK");
+                break;
+            case 'Z':
+            case 'z':
+                change_point(g);
+                break;
+            case 'q':
+            case 'Q':
+                query(g);
+                break;
+            case 'k':
+                return 0;
+            case 'D':
+                send_packet(g, "OK");
+                return 1;
+            default:
+                /* vKill is the only v packet needed */
+                if (!strncmp(g->packet, "vKill", 5)) {
+                    send_packet(g, "OK");
+                    return 0;
+                }
+        }
+        if (send_packet(g, g->reply) < 0) {
+            break;
+        }
+        if (!strcmp(g->packet, "QStartNoAckMode")) {
+            g->no_ack = 1;
+        }
+    }
+    return 0;
+}
+
+/* a listening socket for where, a port number or a unix socket path */
+static int listen_on(const char* where, int* is_unix) {
+    struct sockaddr_in in = {.sin_family = AF_INET};
+    struct sockaddr_un un = {.sun_family = AF_UNIX};
+    char* end;
+    long port = strtol(where, &end, 10);
+    int fd;
+    int one = 1;
+
+    *is_unix = *end || end == where;
+    if (*is_unix) {
+        if (strlen(where) >= sizeof un.sun_path) {
+            fprintf(stderr, "socket path too long: %s\n", where);
+            return -1;
+        }
+        strcpy(un.sun_path, where);
+        if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0 ||
+            bind(fd, (struct sockaddr*)&un, sizeof un) < 0) {
+            goto error;
+        }
+    } else {
+        if (port <= 0 || port > 0xffff) {
+            fprintf(stderr, "invalid port: %s\n", where);
+            return -1;
+        }
+        /* GDB has full control of the vm, so only local clients */
+        in.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        in.sin_port = htons(port);
+        if ((fd = socket(AF_INET, SOCK_STREAM, 0)) < 0 ||
+            setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof one) < 0 ||
+            bind(fd, (struct sockaddr*)&in, sizeof in) < 0) {
+            goto error;
+        }
+    }
+    if (listen(fd, 1) < 0) {
+        goto error;
+    }
+    return fd;
+error:
+    perror("unable to listen for gdb");
+    if (fd >= 0) {
+        close(fd);
+    }
+    return -1;
+}
+
+/* run vm under the control of a GDB connecting to where */
+int sigma16_gdb_serve(sigma16_vm_t* vm, const char* where) {
+    struct gdb* g;
+    int listener;
+    int is_unix;
+    int detached;
+    int one = 1;
+    int ret = 0;
+
+    if (!(g = calloc(1, sizeof *g))) {
+        perror("unable to allocate gdb stub");
+        return -1;
+    }
+    if ((listener = listen_on(where, &is_unix)) < 0) {
+        free(g);
+        return -1;
+    }
+    fprintf(stderr, "waiting for gdb on %s\n", where);
+    while ((g->fd = accept(listener, NULL, NULL)) < 0 && errno == EINTR) {
+    }
+    close(listener);
+    if (is_unix) {
+        unlink(where);
+    }
+    if (g->fd < 0) {
+        perror("unable to accept gdb");
+        free(g);
+        return -1;
+    }
+    if (!is_unix) {
+        /* replies are small and GDB waits for each */
+        setsockopt(g->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one);
+    }
+
+    g->vm = vm;
+    g->icount_limit = vm->icount_limit;
+    g->deadline = vm->deadline;
+    detached = serve(g);
+
+    /* the vm outlives the stub */
+    for (int i = 0; i < g->n_bps; ++i) {
+        sigma16_vm_remove_breakpoint(vm, g->bps[i].addr);
+    }
+    close(g->fd);
+    if (detached && !g->exited) {
+        /* the program carries on by itself */
+        ret = sigma16_vm_exec(vm);
+    }
+    free(g->bps);
+    free(g);
+    return ret;
+}
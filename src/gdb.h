@@ -0,0 +1,24 @@
+#pragma once
+#include "vm.h"
+
+/*
+ * GDB remote serial protocol stub. Serves one connection on a localhost TCP
+ * port (given as a number) or a unix socket (given as a path) until GDB
+ * kills or detaches from the program.
+ *
+ * GDB addresses bytes, two per word in big-endian order as in executables,
+ * so the byte address of word w is 2w. The registers are r0-r15 (16 bits)
+ * followed by pc (32 bits, a byte address), all big-endian; see the target
+ * description sent to GDB.
+ *
+ * Software and hardware breakpoints are both the vm's breakpoints, which
+ * the interpreter checks while decoding; code in memory is never patched.
+ * Watchpoints are the vm's watchpoints. Continue runs on the selected
+ * engine when there are neither, and stops every GDB_POLL_INTERVAL
+ * instructions to look for an interrupt from GDB.
+ *
+ * Returns -1 if there was no session, otherwise 0, or what the program
+ * returned if GDB detached and it ran on by itself.
+ */
+
+int sigma16_gdb_serve(sigma16_vm_t*, const char*);
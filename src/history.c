@@ -0,0 +1,394 @@
+#include "history.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "config.h"
+#include "cpu.h"
+#include "ops.h"
+#include "vm.h"
+
+/* the cpu between two instructions, and how far each log had got */
+struct snapshot {
+    uint64_t icount;
+    size_t undo_len;
+    size_t input_pos;
+    sigma16_cpu_t cpu;
+};
+
+/* a store to addr replaced old, which is in vm byte order */
+struct undo {
+    uint16_t addr;
+    uint16_t old;
+};
+
+struct sigma16_history {
+    struct snapshot* snaps;
+    size_t n_snaps;
+    size_t snaps_cap;
+    struct undo* undo;
+    size_t undo_len;
+    size_t undo_cap;
+    /*
+     * Every trap read as a two byte little-endian count and the bytes read,
+     * kept whole so that restarts can replay it. Reads up to input_pos have
+     * been executed, later ones are returned again by replays.
+     */
+    unsigned char* input;
+    size_t input_len;
+    size_t input_cap;
+    size_t input_pos;
+    uint64_t next_snapshot;
+    /* furthest icount reached, trap output up to it was written already */
+    uint64_t high_water;
+    /* set while going back, snapshot indices must then stay put */
+    _Bool rewinding;
+    /* the program as loaded and the 256 word pages written since */
+    sigma16_cpu_t initial_cpu;
+    uint8_t dirty[256];
+    uint16_t initial[1 << 16];
+};
+
+/* buf grown to hold need items of size, NULL if that fails */
+static void* reserve(void* buf, size_t* cap, size_t need, size_t size) {
+    size_t n = *cap ? *cap : 256;
+
+    if (need <= *cap) {
+        return buf;
+    }
+    while (n < need) {
+        n *= 2;
+    }
+    if (!(buf = realloc(buf, n * size))) {
+        perror("unable to grow debugger history");
+        return NULL;
+    }
+    *cap = n;
+    return buf;
+}
+
+/* trap input is not counted, it is tiny next to the rest */
+static size_t history_size(struct sigma16_history* h) {
+    return h->n_snaps * sizeof *h->snaps + h->undo_len * sizeof *h->undo;
+}
+
+/* forget the older half of the snapshots and the stores made before them */
+static void drop_oldest(struct sigma16_history* h) {
+    size_t keep = h->n_snaps / 2;
+    size_t base;
+
+    if (h->rewinding || !keep) {
+        return;
+    }
+    base = h->snaps[keep].undo_len;
+    memmove(h->undo, h->undo + base, (h->undo_len - base) * sizeof *h->undo);
+    h->undo_len -= base;
+    h->n_snaps -= keep;
+    memmove(h->snaps, h->snaps + keep, h->n_snaps * sizeof *h->snaps);
+    for (size_t i = 0; i < h->n_snaps; ++i) {
+        h->snaps[i].undo_len -= base;
+    }
+}
+
+/* without memory for more, the history before now is lost */
+static void forget(struct sigma16_history* h) {
+    h->n_snaps = 0;
+    h->undo_len = 0;
+    h->next_snapshot = 0;
+}
+
+static void snapshot(sigma16_vm_t* vm) {
+    struct sigma16_history* h = vm->history;
+    struct snapshot* snaps;
+
+    /* the cpu may have been changed since, e.g. by the debugger */
+    if (h->n_snaps && h->snaps[h->n_snaps - 1].icount == vm->icount) {
+        h->n_snaps--;
+    }
+    if (!(snaps = reserve(h->snaps, &h->snaps_cap, h->n_snaps + 1,
+                          sizeof *snaps))) {
+        forget(h);
+        return;
+    }
+    h->snaps = snaps;
+    snaps[h->n_snaps++] = (struct snapshot){vm->icount, h->undo_len,
+                                            h->input_pos, vm->cpu};
+    h->next_snapshot = vm->icount + HISTORY_INTERVAL;
+    if (history_size(h) > HISTORY_LIMIT) {
+        drop_oldest(h);
+    }
+}
+
+int sigma16_history_init(sigma16_vm_t* vm) {
+    struct sigma16_history* h;
+
+    if (!(h = calloc(1, sizeof *h))) {
+        perror("unable to allocate debugger history");
+        return -1;
+    }
+    memcpy(h->initial, vm->mem, sizeof h->initial);
+    h->initial_cpu = vm->cpu;
+    vm->history = h;
+    snapshot(vm);
+    return 0;
+}
+
+void sigma16_history_del(sigma16_vm_t* vm) {
+    struct sigma16_history* h = vm->history;
+
+    if (h) {
+        free(h->snaps);
+        free(h->undo);
+        free(h->input);
+        free(h);
+        vm->history = NULL;
+    }
+}
+
+/* called before every store to addr, see LOG_STORE */
+void sigma16_history_store(sigma16_vm_t* vm, uint16_t addr) {
+    struct sigma16_history* h = vm->history;
+    struct undo* undo;
+
+    h->dirty[addr >> 8] = 1;
+    if (!h->n_snaps) {
+        /* nothing to go back to until the next snapshot */
+        return;
+    }
+    if (!(undo = reserve(h->undo, &h->undo_cap, h->undo_len + 1,
+                         sizeof *undo))) {
+        forget(h);
+        return;
+    }
+    h->undo = undo;
+    undo[h->undo_len++] = (struct undo){addr, vm->mem[addr]};
+    if (history_size(h) > HISTORY_LIMIT) {
+        drop_oldest(h);
+    }
+}
+
+/* called at budget checks, returns the icount of the next snapshot */
+uint64_t sigma16_history_tick(sigma16_vm_t* vm) {
+    if (vm->icount >= vm->history->next_snapshot) {
+        snapshot(vm);
+    }
+    return vm->history->next_snapshot;
+}
+
+/* whether the current instruction ran before, so its output was written */
+int sigma16_history_replaying(sigma16_vm_t* vm) {
+    return vm->icount <= vm->history->high_water;
+}
+
+/* a read trap done before, -1 once execution is past the logged reads */
+int sigma16_history_replay_read(sigma16_vm_t* vm, uint16_t addr, uint16_t n) {
+    struct sigma16_history* h = vm->history;
+    const unsigned char* bytes;
+    int count;
+
+    if (h->input_pos == h->input_len) {
+        return -1;
+    }
+    bytes = h->input + h->input_pos;
+    count = bytes[0] | bytes[1] << 8;
+    h->input_pos += 2 + count;
+    if (count > n) {
+        count = n;
+    }
+    for (int i = 0; i < count; ++i) {
+        sigma16_history_store(vm, addr + i);
+        write_mem(vm, addr + i, bytes[2 + i]);
+    }
+    return count;
+}
+
+/* a read trap put count bytes at addr */
+void sigma16_history_log_read(sigma16_vm_t* vm, uint16_t addr, int count) {
+    struct sigma16_history* h = vm->history;
+    unsigned char* input;
+
+    if (!(input = reserve(h->input, &h->input_cap, h->input_len + 2 + count,
+                          1))) {
+        return;
+    }
+    h->input = input;
+    input[h->input_len++] = count & 0xff;
+    input[h->input_len++] = count >> 8;
+    for (int i = 0; i < count; ++i) {
+        input[h->input_len++] = read_mem(vm, addr + i) & 0xff;
+    }
+    h->input_pos = h->input_len;
+}
+
+/* the earliest icount history can go back to */
+uint64_t sigma16_history_start(sigma16_vm_t* vm) {
+    struct sigma16_history* h = vm->history;
+
+    return h->n_snaps ? h->snaps[0].icount : vm->icount;
+}
+
+/* back to snapshot i, undoing every store made since */
+static void restore(sigma16_vm_t* vm, size_t i) {
+    struct sigma16_history* h = vm->history;
+    struct snapshot* s = &h->snaps[i];
+    struct undo* u;
+
+    if (vm->icount > h->high_water) {
+        h->high_water = vm->icount;
+    }
+    while (h->undo_len > s->undo_len) {
+        u = &h->undo[--h->undo_len];
+        vm->mem[u->addr] = u->old;
+        sigma16_vm_invalidate(vm, u->addr, 1);
+    }
+    vm->cpu = s->cpu;
+    vm->icount = s->icount;
+    h->input_pos = s->input_pos;
+    h->n_snaps = i + 1;
+    h->next_snapshot = s->icount + HISTORY_INTERVAL;
+}
+
+/*
+ * Execute forward again up to target without tracing or profiling. Only
+ * stops at breakpoints and watchpoints if stops is set.
+ */
+static int run_to(sigma16_vm_t* vm, uint64_t target, int stops) {
+    void (*handler)(sigma16_vm_t*, enum sigma16_trace_event);
+    struct sigma16_profile* profile = vm->profile;
+    uint64_t* breakpoints = vm->breakpoints;
+    uint8_t watch_pages[sizeof vm->watch_pages];
+    int ret;
+
+    handler = vm->trace_handler;
+    vm->trace_handler = NULL;
+    vm->profile = NULL;
+    if (!stops) {
+        vm->breakpoints = NULL;
+        memcpy(watch_pages, vm->watch_pages, sizeof watch_pages);
+        memset(vm->watch_pages, 0, sizeof vm->watch_pages);
+    }
+    ret = sigma16_vm_step(vm, target > vm->icount ? target - vm->icount : 0);
+    if (!stops) {
+        vm->breakpoints = breakpoints;
+        memcpy(vm->watch_pages, watch_pages, sizeof watch_pages);
+        /* they were decoded like any other address meanwhile */
+        for (int i = 0; i < vm->n_breakpoints; ++i) {
+            sigma16_vm_invalidate(vm, vm->break_list[i].addr, 1);
+        }
+    }
+    vm->trace_handler = handler;
+    vm->profile = profile;
+    return ret;
+}
+
+/*
+ * Go back to the instruction numbered target, or as close as history goes.
+ * The budget of the next run is left as it was.
+ */
+int sigma16_history_rewind(sigma16_vm_t* vm, uint64_t target) {
+    struct sigma16_history* h = vm->history;
+    uint64_t icount_limit = vm->icount_limit;
+    uint64_t deadline = vm->deadline;
+    size_t i = h->n_snaps;
+
+    if (!i) {
+        return -1;
+    }
+    if (target >= vm->icount) {
+        return 0;
+    }
+    while (i > 1 && h->snaps[i - 1].icount > target) {
+        i--;
+    }
+    h->rewinding = 1;
+    restore(vm, i - 1);
+    run_to(vm, target, 0);
+    h->rewinding = 0;
+    vm->icount_limit = icount_limit;
+    vm->deadline = deadline;
+    vm->next_check = 0;
+    return 0;
+}
+
+/*
+ * Go back to the last stop at a breakpoint or watchpoint before the current
+ * instruction. Returns SIGMA16_EXEC_BREAK or SIGMA16_EXEC_WATCH there, or
+ * SIGMA16_EXEC_BUDGET at the start of history if there was none. Each
+ * stretch between snapshots is searched by executing it again.
+ */
+int sigma16_history_reverse_continue(sigma16_vm_t* vm) {
+    struct sigma16_history* h = vm->history;
+    uint64_t icount_limit = vm->icount_limit;
+    uint64_t deadline = vm->deadline;
+    uint64_t end = vm->icount;
+    uint64_t hit = 0;
+    uint16_t watch_hit = 0;
+    uint8_t watch_kind = 0;
+    size_t i = h->n_snaps;
+    int found = 0;
+    int ret;
+
+    if (!i) {
+        return -1;
+    }
+    h->rewinding = 1;
+    while (!found && i--) {
+        if (h->snaps[i].icount >= end) {
+            continue;
+        }
+        restore(vm, i);
+        /* runs let a breakpoint where they start pass */
+        if (vm->breakpoints && test_addr(vm->breakpoints, vm->cpu.pc) &&
+            sigma16_vm_should_break(vm)) {
+            found = SIGMA16_EXEC_BREAK;
+            hit = vm->icount;
+        }
+        while ((ret = run_to(vm, end, 1)) == SIGMA16_EXEC_BREAK ||
+               ret == SIGMA16_EXEC_WATCH) {
+            if (vm->icount >= end) {
+                break;
+            }
+            found = ret;
+            hit = vm->icount;
+            watch_hit = vm->watch_hit;
+            watch_kind = vm->watch_kind;
+        }
+        end = h->snaps[i].icount;
+    }
+    if (found) {
+        restore(vm, i);
+        run_to(vm, hit, 0);
+        vm->watch_hit = watch_hit;
+        vm->watch_kind = watch_kind;
+    } else if (h->n_snaps) {
+        restore(vm, 0);
+    }
+    h->rewinding = 0;
+    vm->icount_limit = icount_limit;
+    vm->deadline = deadline;
+    vm->next_check = 0;
+    return found ? found : SIGMA16_EXEC_BUDGET;
+}
+
+/* back to the program as loaded, its trap input is read again */
+void sigma16_history_restart(sigma16_vm_t* vm) {
+    struct sigma16_history* h = vm->history;
+
+    for (int page = 0; page < 256; ++page) {
+        if (h->dirty[page]) {
+            memcpy(vm->mem + (page << 8), h->initial + (page << 8),
+                   256 * sizeof *vm->mem);
+            sigma16_vm_invalidate(vm, page << 8, 256);
+            h->dirty[page] = 0;
+        }
+    }
+    vm->cpu = h->initial_cpu;
+    vm->icount = 0;
+    vm->next_check = 0;
+    h->n_snaps = 0;
+    h->undo_len = 0;
+    h->input_pos = 0;
+    h->high_water = 0;
+    snapshot(vm);
+}
@@ -0,0 +1,31 @@
+#pragma once
+#include <stdint.h>
+
+#include "vm.h"
+
+/*
+ * Execution history for the debugger. The cpu is copied every
+ * HISTORY_INTERVAL instructions, stores log the word they replace in an
+ * append-only undo log, and trap reads log the bytes they returned. Going
+ * back to any instruction undoes the log down to the nearest snapshot at or
+ * before it and quietly executes forward again, reading the logged input
+ * and writing no trap output twice. The oldest history is dropped to stay
+ * under HISTORY_LIMIT bytes.
+ *
+ * The memory and cpu the program started with are kept as well, and stores
+ * mark the pages they dirty, so a restart only copies back those pages.
+ *
+ * Runs with history use the interpreter, whatever the engine.
+ */
+
+int sigma16_history_init(sigma16_vm_t*);
+void sigma16_history_del(sigma16_vm_t*);
+void sigma16_history_store(sigma16_vm_t*, uint16_t);
+uint64_t sigma16_history_tick(sigma16_vm_t*);
+int sigma16_history_replaying(sigma16_vm_t*);
+int sigma16_history_replay_read(sigma16_vm_t*, uint16_t, uint16_t);
+void sigma16_history_log_read(sigma16_vm_t*, uint16_t, int);
+uint64_t sigma16_history_start(sigma16_vm_t*);
+int sigma16_history_rewind(sigma16_vm_t*, uint64_t);
+int sigma16_history_reverse_continue(sigma16_vm_t*);
+void sigma16_history_restart(sigma16_vm_t*);
@@ -0,0 +1,162 @@
+#define _GNU_SOURCE
+#include "image.h"
+
+#include <byteswap.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "config.h"
+
+/* images are big-endian, vm memory may not be */
+#if defined(ENABLE_HOST_ENDIAN_MEM) && \
+    __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define IMAGE_SWAP
+#endif
+
+/* sealed memfd of size bytes, mapped writable at *mem until sealed */
+static int create_memfd(const char* fname, size_t size, uint16_t** mem) {
+    int fd;
+
+    if ((fd = memfd_create(fname, MFD_ALLOW_SEALING)) < 0) {
+        return -1;
+    }
+    if (ftruncate(fd, size) < 0 ||
+        (size && (*mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                              fd, 0)) == MAP_FAILED)) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static void seal_memfd(int fd, uint16_t* mem, size_t size) {
+    if (size) {
+        munmap(mem, size);
+    }
+    /* vms only ever map the image privately, nothing may change it now */
+    fcntl(fd, F_ADD_SEALS,
+          F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL);
+}
+
+#ifdef IMAGE_SWAP
+static void swap_words(uint16_t* dst, const uint16_t* src, size_t size) {
+    for (size_t i = 0; i < (size + 1) >> 1; ++i) {
+        dst[i] = bswap_16(src[i]);
+    }
+}
+#endif
+
+static int load_read(sigma16_image_t* image, const char* fname, int file) {
+    FILE* executable;
+    uint16_t* mem = NULL;
+    int fd;
+
+    if (!(executable = fdopen(file, "rb"))) {
+        close(file);
+        return -1;
+    }
+    if ((fd = create_memfd(fname, image->size, &mem)) < 0 ||
+        fread(mem, 1, image->size, executable) != image->size) {
+        if (fd >= 0) {
+            errno = EIO;
+            munmap(mem, image->size);
+            close(fd);
+        }
+        fclose(executable);
+        return -1;
+    }
+    fclose(executable);
+#ifdef IMAGE_SWAP
+    swap_words(mem, mem, image->size);
+#endif
+    seal_memfd(fd, mem, image->size);
+    image->fd = fd;
+    return 0;
+}
+
+static int load_mmap(sigma16_image_t* image, const char* fname, int file) {
+#ifdef IMAGE_SWAP
+    uint16_t* src;
+    uint16_t* mem = NULL;
+    int fd;
+
+    if (!image->size) {
+        close(file);
+        return (image->fd = create_memfd(fname, 0, &mem)) < 0 ? -1 : 0;
+    }
+    src = mmap(NULL, image->size, PROT_READ, MAP_PRIVATE, file, 0);
+    close(file);
+    if (src == MAP_FAILED) {
+        return -1;
+    }
+    /* swap straight out of the page cache, skipping read's copy */
+    if ((fd = create_memfd(fname, image->size, &mem)) < 0) {
+        munmap(src, image->size);
+        return -1;
+    }
+    swap_words(mem, src, image->size);
+    munmap(src, image->size);
+    seal_memfd(fd, mem, image->size);
+    image->fd = fd;
+#else
+    /* already in vm byte order, vms map the file itself */
+    image->fd = file;
+#endif
+    return 0;
+}
+
+int sigma16_image_load(sigma16_image_t** image, const char* fname,
+                       enum sigma16_loader loader) {
+    struct stat st;
+    int file, ret, err;
+
+    if (!(*image = calloc(1, sizeof **image))) {
+        perror("unable to allocate memory for image");
+        return -1;
+    }
+
+    if ((file = open(fname, O_RDONLY | O_CLOEXEC)) < 0 ||
+        fstat(file, &st) < 0) {
+        perror("unable to open file");
+        goto error;
+    }
+
+    if ((size_t)st.st_size > SIGMA16_MEM_SIZE) {
+        fprintf(stderr,
+                "%s: executable is %lld bytes, memory only holds %zu\n",
+                fname, (long long)st.st_size, SIGMA16_MEM_SIZE);
+        errno = EFBIG;
+        goto error;
+    }
+    (*image)->size = st.st_size;
+
+    /* the loaders take ownership of the file */
+    ret = loader == LOADER_READ ? load_read(*image, fname, file)
+                                : load_mmap(*image, fname, file);
+    if (ret < 0) {
+        file = -1;
+        perror("unable to load image");
+        goto error;
+    }
+    return 0;
+error:
+    /* callers report the cause, e.g. the Python bindings */
+    err = errno;
+    if (file >= 0) {
+        close(file);
+    }
+    free(*image);
+    errno = err;
+    return -1;
+}
+
+void sigma16_image_del(sigma16_image_t* image) {
+    close(image->fd);
+    free(image);
+}
@@ -0,0 +1,28 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+/* bytes of vm memory, one word for every 16 bit address */
+#define SIGMA16_MEM_SIZE ((size_t)sizeof(uint16_t) << 16)
+
+enum sigma16_loader {
+    /* read the executable into a private copy */
+    LOADER_READ,
+    /* map the executable, copying only when it must be byte swapped */
+    LOADER_MMAP
+};
+
+/*
+ * A program image loaded once and shared by any number of vms. The image is
+ * a file descriptor holding the program in vm byte order; vms map it
+ * copy-on-write, so pages a program never writes stay shared between every
+ * instance and are only faulted in when first touched.
+ */
+typedef struct _sigma16_image {
+    int fd;
+    /* bytes of the program, vms map the pages covering them */
+    size_t size;
+} sigma16_image_t;
+
+int sigma16_image_load(sigma16_image_t**, const char*, enum sigma16_loader);
+void sigma16_image_del(sigma16_image_t*);
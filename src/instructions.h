@@ -3,6 +3,14 @@
 
 enum sigma16_instruction_fmt { RRR, RX, EXP0 };
 
+/*
+ * Secondary opcodes of EXP instructions, the low byte of the first word.
+ * The second word holds the operands: getctl and putctl name a control
+ * register in its top nibble, shifts their source register there and the
+ * shift distance in its bottom nibble.
+ */
+enum sigma16_exp_op { EXP_RFI, EXP_GETCTL, EXP_PUTCTL, EXP_SHIFTL, EXP_SHIFTR };
+
 typedef struct _sigma16_inst_rrr {
     uint8_t d : 4;
     uint8_t op : 4;
@@ -0,0 +1,396 @@
+/*
+ * Interpreter body, included by vm.c once for each variant:
+ *
+ * INTERP_NAME     name of the function to define
+ * INTERP_TRACED   1 to call vm->trace_handler before every instruction
+ * INTERP_PROFILED 1 to count every instruction into vm->profile
+ *
+ * Every variant checks the budget after taken branches, and before any
+ * instruction whose successor wraps around memory: every loop passes one
+ * or the other. Such instructions are decoded to do_wrap.
+ *
+ * The traced variant returns EXEC_SWITCH as soon as the handler is removed,
+ * so sigma16_vm_exec can carry on with the untraced engines. It also counts
+ * into vm->profile when that is set, so traced runs can be profiled too. As
+ * it checks before every instruction anyway, it keeps to instruction budgets
+ * exactly, which sigma16_vm_step relies on.
+ *
+ * Interrupts are taken by the budget check, so they too wait for a taken
+ * branch (rfi counts as one) or a wrapping instruction.
+ *
+ * Addresses with breakpoints are never decoded, so every visit goes through
+ * do_predecode, which stops there unless the run starts there or the
+ * breakpoint's condition does not hold. Loads and stores check a flag of
+ * their page for watchpoints.
+ */
+
+#if INTERP_PROFILED
+#define IF_PROFILING(vm)
+#elif INTERP_TRACED
+#define IF_PROFILING(vm) if (vm->profile)
+#endif
+
+#ifdef IF_PROFILING
+#define PROFILE(vm, table)                    \
+    IF_PROFILING(vm) {                        \
+        vm->profile->pc[vm->cpu.pc]++;        \
+        vm->profile->table[inst->op]++;       \
+    }
+#define PROFILE_TAKEN(vm)                     \
+    IF_PROFILING(vm) {                        \
+        vm->profile->taken[vm->cpu.pc]++;     \
+        vm->profile->rx_taken[inst->op]++;    \
+    }
+#else
+#define PROFILE(vm, table)
+#define PROFILE_TAKEN(vm)
+#endif
+
+#if INTERP_TRACED
+/* the instruction register is only materialised for the trace handler */
+#define TRACE_RRR(vm)        \
+    RECORD(vm);              \
+    PROFILE(vm, rrr);        \
+    INTERP_INST(vm, rrr);    \
+    vm->trace_handler(vm, INST_RRR)
+#define TRACE_RX(vm)      \
+    RECORD(vm);           \
+    PROFILE(vm, rx);      \
+    INTERP_RX(vm);        \
+    vm->trace_handler(vm, INST_RX)
+#define TRACE_EXP0(vm)       \
+    RECORD(vm);              \
+    PROFILE(vm, exp);        \
+    INTERP_INST(vm, exp0);   \
+    vm->trace_handler(vm, INST_EXP0)
+#define TRACE_EVENT(vm, event) vm->trace_handler(vm, event)
+/* keep trap output in order with the trace */
+#define FLUSH_TRACED(vm) sigma16_io_flush(vm)
+#define CHECK_TRACED(vm)                   \
+    if (!vm->trace_handler) {             \
+        return EXEC_SWITCH;                \
+    }                                      \
+    if (vm->icount >= vm->icount_limit) { \
+        goto budget_spent;                 \
+    }
+#else
+#define TRACE_RRR(vm) \
+    RECORD(vm);       \
+    PROFILE(vm, rrr)
+#define TRACE_RX(vm) \
+    RECORD(vm);      \
+    PROFILE(vm, rx)
+#define TRACE_EXP0(vm) \
+    RECORD(vm);        \
+    PROFILE(vm, exp)
+#define TRACE_EVENT(vm, event)
+#define FLUSH_TRACED(vm)
+#define CHECK_TRACED(vm)
+#endif
+
+#define CHECK_BUDGET(vm) \
+    if (BUDGET_SPENT(vm)) {  \
+        goto budget_spent;   \
+    }
+
+#define APPLY_OP_RRR(vm, inst, op)                                             \
+    TRACE_RRR(vm);                                                             \
+    SAFE_UPDATE(vm, inst->d, vm->cpu.regs[inst->sa] op vm->cpu.regs[inst->sb]); \
+    vm->cpu.pc += sizeof vm->cpu.ir.rrr >> 1;
+
+/*
+ * Handlers are reached through vm->decoded, which caches the handler (as an
+ * offset from do_predecode so that a zeroed slot means "not yet decoded"),
+ * the operand registers and the host-endian displacement of every executed
+ * address. Stores invalidate the slots they overlap.
+ */
+static int INTERP_NAME(sigma16_vm_t* vm) {
+#define HANDLER(label) (&&label - &&do_predecode)
+    static const int32_t dispatch_table[] = {
+        HANDLER(do_add),    HANDLER(do_sub),    HANDLER(do_mul),
+        HANDLER(do_div),    HANDLER(do_cmp),    HANDLER(do_cmplt),
+        HANDLER(do_cmpeq),  HANDLER(do_cmpgt),  HANDLER(do_invold),
+        HANDLER(do_andold), HANDLER(do_orold),  HANDLER(do_xorold),
+        HANDLER(do_nop),    HANDLER(do_trap)};
+
+    static const int32_t exp_dispatch_table[] = {
+        HANDLER(do_rfi), HANDLER(do_getctl), HANDLER(do_putctl),
+        HANDLER(do_shiftl), HANDLER(do_shiftr)};
+
+    static const int32_t rx_dispatch_table[] = {
+        HANDLER(do_lea),    HANDLER(do_load),   HANDLER(do_store),
+        HANDLER(do_jump),   HANDLER(do_jumpc0), HANDLER(do_jumpc1),
+        HANDLER(do_jumpf),  HANDLER(do_jumpt),  HANDLER(do_jal),
+        HANDLER(do_bad_op), HANDLER(do_bad_op), HANDLER(do_bad_op),
+        HANDLER(do_bad_op), HANDLER(do_bad_op), HANDLER(do_bad_op),
+        HANDLER(do_bad_op)};
+#define DISPATCH()                         \
+    CHECK_TRACED(vm);                      \
+    vm->icount++;                          \
+    inst = &vm->decoded[vm->cpu.pc];       \
+    goto* (&&do_predecode + inst->handler)
+
+    sigma16_decoded_t* inst;
+    uint16_t word;
+    int32_t handler;
+
+    TRACE_EVENT(vm, EXEC_START);
+    DISPATCH();
+
+do_predecode:
+    if (vm->breakpoints && test_addr(vm->breakpoints, vm->cpu.pc) &&
+        vm->icount != vm->break_skip && sigma16_vm_should_break(vm)) {
+        /* not executed after all */
+        vm->icount--;
+        return SIGMA16_EXEC_BREAK;
+    }
+    word = read_mem(vm, vm->cpu.pc);
+    inst->d = (word >> 8) & 0xf;
+    inst->sa = (word >> 4) & 0xf;
+    inst->sb = word & 0xf;
+    inst->op = word >> 12;
+
+    switch (word >> 12) {
+        case 0xe:
+            inst->disp = read_mem(vm, vm->cpu.pc + 1);
+            inst->op = word & 0xff;
+            if ((word & 0xff) < sizeof exp_dispatch_table /
+                                    sizeof *exp_dispatch_table) {
+                handler = exp_dispatch_table[word & 0xff];
+            } else {
+                handler = HANDLER(do_bad_op);
+            }
+            break;
+        case 0xf:
+            inst->disp = read_mem(vm, vm->cpu.pc + 1);
+            inst->op = inst->sb;
+            handler = rx_dispatch_table[inst->sb];
+            break;
+        default:
+            handler = dispatch_table[word >> 12];
+    }
+    /* do_wrap comes back here every time, so leave it in place */
+    if (vm->cpu.pc + (word >> 12 >= 0xe ? 2 : 1) > 0xffff) {
+        inst->handler = HANDLER(do_wrap);
+    } else if (vm->breakpoints && test_addr(vm->breakpoints, vm->cpu.pc)) {
+        inst->handler = 0;
+    } else {
+        inst->handler = handler;
+    }
+    goto* (&&do_predecode + handler);
+
+do_wrap:
+    /* not executed yet, which snapshots taken by the check rely on */
+    vm->icount--;
+    if (BUDGET_SPENT(vm)) {
+        goto budget_spent;
+    }
+    if (inst != &vm->decoded[vm->cpu.pc]) {
+        /* the check took an interrupt instead */
+        DISPATCH();
+    }
+    vm->icount++;
+    goto do_predecode;
+
+do_add:
+    APPLY_OP_RRR(vm, inst, +);
+    op_add_flags(vm, inst->d);
+    DISPATCH();
+do_sub:
+    APPLY_OP_RRR(vm, inst, -);
+    DISPATCH();
+do_mul:
+    APPLY_OP_RRR(vm, inst, *);
+    DISPATCH();
+do_div:
+    TRACE_RRR(vm);
+    op_div(vm, inst->d, inst->sa, inst->sb);
+    vm->cpu.pc += sizeof vm->cpu.ir.rrr >> 1;
+    DISPATCH();
+do_cmp:
+    TRACE_RRR(vm);
+    op_cmp(vm, vm->cpu.regs[inst->sa], vm->cpu.regs[inst->sb]);
+    vm->cpu.pc += sizeof vm->cpu.ir.rrr >> 1;
+    DISPATCH();
+do_cmplt:
+    APPLY_OP_RRR(vm, inst, <);
+    CLEARFLAGS(vm->cpu.regs[15]);
+    DISPATCH();
+do_cmpeq:
+    APPLY_OP_RRR(vm, inst, ==);
+    CLEARFLAGS(vm->cpu.regs[15]);
+    DISPATCH();
+do_cmpgt:
+    APPLY_OP_RRR(vm, inst, >);
+    CLEARFLAGS(vm->cpu.regs[15]);
+    DISPATCH();
+do_invold:
+    TRACE_RRR(vm);
+    SAFE_UPDATE(vm, inst->d, ~vm->cpu.regs[inst->sa]);
+    vm->cpu.pc += sizeof vm->cpu.ir.rrr >> 1;
+
+    CLEARFLAGS(vm->cpu.regs[15]);
+    DISPATCH();
+do_andold:
+    APPLY_OP_RRR(vm, inst, &);
+    CLEARFLAGS(vm->cpu.regs[15]);
+    DISPATCH();
+do_orold:
+    APPLY_OP_RRR(vm, inst, |);
+    CLEARFLAGS(vm->cpu.regs[15]);
+    DISPATCH();
+do_xorold:
+    APPLY_OP_RRR(vm, inst, ^);
+    CLEARFLAGS(vm->cpu.regs[15]);
+    DISPATCH();
+do_nop:
+    TRACE_RRR(vm);
+    CLEARFLAGS(vm->cpu.regs[15]);
+    vm->cpu.pc += sizeof vm->cpu.ir.rrr >> 1;
+    DISPATCH();
+do_trap:
+    TRACE_RRR(vm);
+    switch (vm->cpu.regs[inst->d]) {
+        case 0:
+            goto end_hotloop;
+        case 1:
+            trap_read(vm, inst->sa, inst->sb);
+            break;
+        case 2:
+            trap_write(vm, inst->sa, inst->sb);
+            FLUSH_TRACED(vm);
+            break;
+    }
+    vm->cpu.pc += sizeof vm->cpu.ir.rrr >> 1;
+    CLEARFLAGS(vm->cpu.regs[15]);
+    DISPATCH();
+do_rfi:
+    TRACE_EXP0(vm);
+    sigma16_vm_rfi(vm);
+    CHECK_BUDGET(vm);
+    DISPATCH();
+do_getctl:
+    TRACE_EXP0(vm);
+    SAFE_UPDATE(vm, inst->d, sigma16_vm_getctl(vm, inst->disp >> 12));
+    vm->cpu.pc += sizeof vm->cpu.ir.exp0 >> 1;
+    DISPATCH();
+do_putctl:
+    TRACE_EXP0(vm);
+    sigma16_vm_putctl(vm, inst->disp >> 12, vm->cpu.regs[inst->d]);
+    vm->cpu.pc += sizeof vm->cpu.ir.exp0 >> 1;
+    DISPATCH();
+do_shiftl:
+    TRACE_EXP0(vm);
+    SAFE_UPDATE(vm, inst->d, vm->cpu.regs[inst->disp >> 12]
+                                 << (inst->disp & 0xf));
+    vm->cpu.pc += sizeof vm->cpu.ir.exp0 >> 1;
+    DISPATCH();
+do_shiftr:
+    TRACE_EXP0(vm);
+    SAFE_UPDATE(vm, inst->d, vm->cpu.regs[inst->disp >> 12] >>
+                                 (inst->disp & 0xf));
+    vm->cpu.pc += sizeof vm->cpu.ir.exp0 >> 1;
+    DISPATCH();
+do_lea:
+    TRACE_RX(vm);
+    SAFE_UPDATE(vm, inst->d, compute_rx_eaddr(vm, inst));
+    vm->cpu.pc += sizeof vm->cpu.ir.rx >> 1;
+    DISPATCH();
+do_load:
+    TRACE_RX(vm);
+    SAFE_UPDATE(vm, inst->d, read_mem(vm, compute_rx_eaddr(vm, inst)));
+    vm->cpu.pc += sizeof vm->cpu.ir.rx >> 1;
+    CHECK_WATCH(vm, vm->cpu.adr, WATCH_READ);
+    DISPATCH();
+do_store:
+    TRACE_RX(vm);
+    compute_rx_eaddr(vm, inst);
+    LOG_STORE(vm, vm->cpu.adr);
+    write_mem(vm, vm->cpu.adr, vm->cpu.regs[inst->d]);
+    vm->cpu.pc += sizeof vm->cpu.ir.rx >> 1;
+    CHECK_WATCH(vm, vm->cpu.adr, WATCH_WRITE);
+    DISPATCH();
+// TODO rest of rx instructions
+do_jump:
+    TRACE_RX(vm);
+    vm->cpu.pc = compute_rx_eaddr(vm, inst);
+    CHECK_BUDGET(vm);
+    DISPATCH();
+do_jumpc0:
+    TRACE_RX(vm);
+    if (!select_bit(vm->cpu.regs[15], inst->d)) {
+        PROFILE_TAKEN(vm);
+        vm->cpu.pc = compute_rx_eaddr(vm, inst);
+        CHECK_BUDGET(vm);
+    } else {
+        vm->cpu.pc += sizeof vm->cpu.ir.rx >> 1;
+    }
+    DISPATCH();
+do_jumpc1:
+    TRACE_RX(vm);
+    if (select_bit(vm->cpu.regs[15], inst->d)) {
+        PROFILE_TAKEN(vm);
+        vm->cpu.pc = compute_rx_eaddr(vm, inst);
+        CHECK_BUDGET(vm);
+    } else {
+        vm->cpu.pc += sizeof vm->cpu.ir.rx >> 1;
+    }
+    DISPATCH();
+do_jumpf:
+    TRACE_RX(vm);
+    if (!vm->cpu.regs[inst->d]) {
+        PROFILE_TAKEN(vm);
+        vm->cpu.pc = compute_rx_eaddr(vm, inst);
+        CHECK_BUDGET(vm);
+    } else {
+        vm->cpu.pc += sizeof(vm->cpu.ir.rx) >> 1;
+    }
+    DISPATCH();
+do_jumpt:
+    TRACE_RX(vm);
+    if (vm->cpu.regs[inst->d]) {
+        PROFILE_TAKEN(vm);
+        vm->cpu.pc = compute_rx_eaddr(vm, inst);
+        CHECK_BUDGET(vm);
+    } else {
+        vm->cpu.pc += sizeof(vm->cpu.ir.rx) >> 1;
+    }
+    DISPATCH();
+do_jal:
+    TRACE_RX(vm);
+    SAFE_UPDATE(vm, inst->d, vm->cpu.pc + (sizeof vm->cpu.ir.rx >> 1));
+    vm->cpu.pc = compute_rx_eaddr(vm, inst);
+    CHECK_BUDGET(vm);
+    DISPATCH();
+do_bad_op:
+    fprintf(stderr, "invalid opcode: pc=%04x\n", vm->cpu.pc);
+#ifdef ENABLE_FLIGHT_RECORDER
+    RECORD(vm);
+    dump_flight_recorder(stderr, vm);
+#endif
+    goto error;
+end_hotloop:
+    TRACE_EVENT(vm, EXEC_END);
+    return 0;
+budget_spent:
+    return SIGMA16_EXEC_BUDGET;
+error:
+    return -1;
+#undef HANDLER
+#undef DISPATCH
+}
+
+#undef TRACE_RRR
+#undef TRACE_RX
+#undef TRACE_EXP0
+#undef TRACE_EVENT
+#undef FLUSH_TRACED
+#undef CHECK_TRACED
+#undef IF_PROFILING
+#undef PROFILE
+#undef PROFILE_TAKEN
+#undef CHECK_BUDGET
+#undef APPLY_OP_RRR
+#undef INTERP_NAME
+#undef INTERP_TRACED
+#undef INTERP_PROFILED
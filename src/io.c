@@ -0,0 +1,226 @@
+#include "io.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "history.h"
+#include "ops.h"
+
+/* allocated on the first trap, most vms never do I/O */
+struct sigma16_io {
+    /* trap output waiting for sigma16_io_flush */
+    size_t out_len;
+    /* unread input is in[in_pos, in_len), refilled from in_fd if >= 0 */
+    const unsigned char* in;
+    size_t in_pos;
+    size_t in_len;
+    int in_fd;
+    /* copy made by sigma16_io_set_input */
+    unsigned char* input;
+    unsigned char out[IO_BUFFER_SIZE];
+    unsigned char in_buf[IO_BUFFER_SIZE];
+};
+
+typedef uint16_t word_vec __attribute__((vector_size(32)));
+typedef uint8_t byte_vec __attribute__((vector_size(16)));
+
+#define VEC_WORDS (int)(sizeof(word_vec) / sizeof(uint16_t))
+
+/* low byte of each memory word */
+static void narrow(unsigned char* dst, const uint16_t* src, size_t n) {
+    size_t i = 0;
+    word_vec w;
+    byte_vec b;
+
+    for (; i + VEC_WORDS <= n; i += VEC_WORDS) {
+        memcpy(&w, src + i, sizeof w);
+#ifndef ENABLE_HOST_ENDIAN_MEM
+        w >>= 8;
+#endif
+        b = __builtin_convertvector(w, byte_vec);
+        memcpy(dst + i, &b, sizeof b);
+    }
+    for (; i < n; ++i) {
+        dst[i] = MEM_SWAP(src[i]) & 0xff;
+    }
+}
+
+/* one memory word for each byte */
+static void widen(uint16_t* dst, const unsigned char* src, size_t n) {
+    size_t i = 0;
+    word_vec w;
+    byte_vec b;
+
+    for (; i + VEC_WORDS <= n; i += VEC_WORDS) {
+        memcpy(&b, src + i, sizeof b);
+        w = __builtin_convertvector(b, word_vec);
+#ifndef ENABLE_HOST_ENDIAN_MEM
+        w <<= 8;
+#endif
+        memcpy(dst + i, &w, sizeof w);
+    }
+    for (; i < n; ++i) {
+        dst[i] = MEM_SWAP((uint16_t)src[i]);
+    }
+}
+
+static size_t min(size_t a, size_t b) {
+    return a < b ? a : b;
+}
+
+static struct sigma16_io* get_io(sigma16_vm_t* vm) {
+    if (!vm->io) {
+        if (!(vm->io = malloc(sizeof *vm->io))) {
+            perror("unable to allocate trap buffers");
+            return NULL;
+        }
+        vm->io->out_len = 0;
+        vm->io->in = vm->io->in_buf;
+        vm->io->in_pos = vm->io->in_len = 0;
+        vm->io->in_fd = STDIN_FILENO;
+        vm->io->input = NULL;
+    }
+    return vm->io;
+}
+
+void sigma16_io_flush(sigma16_vm_t* vm) {
+    struct sigma16_io* io = vm->io;
+    size_t done = 0;
+    ssize_t n;
+    int fd;
+
+    if (!io || !io->out_len) {
+        return;
+    }
+    /* anything already written through the stream, e.g. traces, goes first */
+    fflush(vm->out);
+    if ((fd = fileno(vm->out)) < 0) {
+        /* memory streams have no descriptor */
+        fwrite(io->out, 1, io->out_len, vm->out);
+    } else {
+        while (done < io->out_len) {
+            if ((n = write(fd, io->out + done, io->out_len - done)) < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                perror("unable to write trap output");
+                break;
+            }
+            done += n;
+        }
+    }
+    io->out_len = 0;
+}
+
+/* trap 2: write the low bytes of n words starting at addr */
+void sigma16_trap_write(sigma16_vm_t* vm, uint16_t addr, uint16_t n) {
+    struct sigma16_io* io;
+    size_t chunk;
+
+    /* going over history again, this was written the first time */
+    if (vm->history && sigma16_history_replaying(vm)) {
+        return;
+    }
+    if (!(io = get_io(vm))) {
+        return;
+    }
+    while (n) {
+        /* memory wraps around, the buffer is flushed when full */
+        chunk = min(min(n, IO_BUFFER_SIZE - io->out_len), 0x10000 - addr);
+        narrow(io->out + io->out_len, vm->mem + addr, chunk);
+        io->out_len += chunk;
+        addr += chunk;
+        n -= chunk;
+        if (io->out_len == IO_BUFFER_SIZE) {
+            sigma16_io_flush(vm);
+        }
+    }
+}
+
+/*
+ * trap 1: read up to n bytes into words starting at addr. Like read(2) this
+ * only waits for input when none is buffered; returns the bytes read, 0 at
+ * the end of input.
+ */
+int sigma16_trap_read(sigma16_vm_t* vm, uint16_t addr, uint16_t n) {
+    struct sigma16_io* io;
+    uint16_t start = addr;
+    size_t chunk;
+    ssize_t got;
+    int count = 0;
+
+    /* going over history again, the same input is read */
+    if (vm->history &&
+        (count = sigma16_history_replay_read(vm, addr, n)) >= 0) {
+        return count;
+    }
+    count = 0;
+    if (!(io = get_io(vm))) {
+        return 0;
+    }
+    /* prompts must be visible before blocking */
+    sigma16_io_flush(vm);
+    while (count < n) {
+        if (io->in_pos == io->in_len) {
+            if (count || io->in_fd < 0) {
+                break;
+            }
+            while ((got = read(io->in_fd, io->in_buf, IO_BUFFER_SIZE)) < 0 &&
+                   errno == EINTR) {
+            }
+            if (got <= 0) {
+                break;
+            }
+            io->in_pos = 0;
+            io->in_len = got;
+        }
+        chunk = min(min(n - count, io->in_len - io->in_pos), 0x10000 - addr);
+        for (size_t i = 0; vm->history && i < chunk; ++i) {
+            sigma16_history_store(vm, addr + i);
+        }
+        widen(vm->mem + addr, io->in + io->in_pos, chunk);
+        sigma16_vm_invalidate(vm, addr, chunk);
+        io->in_pos += chunk;
+        addr += chunk;
+        count += chunk;
+    }
+    if (vm->history) {
+        sigma16_history_log_read(vm, start, count);
+    }
+    return count;
+}
+
+/* read traps consume a copy of data instead of stdin */
+int sigma16_io_set_input(sigma16_vm_t* vm, const void* data, size_t len) {
+    struct sigma16_io* io = get_io(vm);
+    unsigned char* input;
+
+    if (!io) {
+        return -1;
+    }
+    if (!(input = malloc(len ? len : 1))) {
+        perror("unable to allocate trap input");
+        return -1;
+    }
+    memcpy(input, data, len);
+    free(io->input);
+    io->input = input;
+    io->in = input;
+    io->in_pos = 0;
+    io->in_len = len;
+    io->in_fd = -1;
+    return 0;
+}
+
+void sigma16_io_del(sigma16_vm_t* vm) {
+    if (vm->io) {
+        sigma16_io_flush(vm);
+        free(vm->io->input);
+        free(vm->io);
+        vm->io = NULL;
+    }
+}
@@ -0,0 +1,18 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+#include "vm.h"
+
+/*
+ * Buffered trap I/O. Write traps narrow memory words to bytes in bulk and
+ * append them to a per-vm buffer, flushed to vm->out once full, before a
+ * read trap and when sigma16_vm_exec returns. Read traps widen bytes from
+ * the input buffer (or stdin) straight into memory.
+ */
+
+void sigma16_trap_write(sigma16_vm_t*, uint16_t, uint16_t);
+int sigma16_trap_read(sigma16_vm_t*, uint16_t, uint16_t);
+void sigma16_io_flush(sigma16_vm_t*);
+int sigma16_io_set_input(sigma16_vm_t*, const void*, size_t);
+void sigma16_io_del(sigma16_vm_t*);
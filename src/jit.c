@@ -0,0 +1,565 @@
+#include "jit.h"
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "block.h"
+#include "ops.h"
+#include "vm.h"
+
+#ifdef HAVE_JIT
+/*
+ * x86-64 backend for hot basic blocks. A compiled block is entered with the
+ * vm in rdi, keeps vm->mem in rsi and uses rax/rcx/rdx as scratch. The most
+ * used sigma16 registers of the block live in host registers for its
+ * duration and are written back on every exit; the rest are operated on in
+ * place in vm->cpu.regs. Blocks containing trap or EXP instructions are
+ * never compiled, and a store into translated code leaves the block so the
+ * block engine can invalidate it.
+ */
+
+#define JIT_CODE_SIZE (1 << 20)
+/* upper bound on the native size of one instruction, exits included */
+#define JIT_MAX_INSN 256
+
+#define REG_OFFSET(r) (offsetof(sigma16_vm_t, cpu.regs) + 2 * (r))
+
+enum x86_reg {
+    RAX,
+    RCX,
+    RDX,
+    RBX,
+    RSP,
+    RBP,
+    RSI,
+    RDI,
+    R8,
+    R9,
+    R10,
+    R11,
+    R12,
+    R13,
+    R14,
+    R15
+};
+
+/* byte registers addressable without a REX prefix */
+enum x86_reg8 { AL, CL, DL, AH = 4, CH, DH };
+
+enum x86_cond { CC_C = 0x2, CC_NC = 0x3, CC_Z = 0x4, CC_NZ = 0x5, CC_A = 0x7 };
+
+#define CC_B CC_C
+#define CC_E CC_Z
+#define CC_L 0xc
+#define CC_G 0xf
+
+struct sigma16_jit {
+    uint8_t* code;
+    size_t used;
+};
+
+struct x86_operand {
+    int8_t reg;   /* register direct when >= 0 */
+    int8_t base;  /* otherwise [base + disp] ... */
+    int8_t index; /* ... or [base + index * 2] when >= 0 */
+    int32_t disp;
+};
+
+struct jit_ctx {
+    uint8_t* p;
+    /* host register holding each sigma16 register, -1 when in memory */
+    int8_t host[16];
+    /* sigma16 registers written by the block */
+    uint16_t written;
+    int8_t saved[6];
+    int n_saved;
+    const uint64_t* code_map;
+};
+
+static const int8_t alloc_order[] = {R8,  R9,  R10, R11, RBX,
+                                     RBP, R12, R13, R14, R15};
+
+static void emit8(struct jit_ctx* c, uint8_t v) { *c->p++ = v; }
+
+static void emit16(struct jit_ctx* c, uint16_t v) {
+    memcpy(c->p, &v, sizeof v);
+    c->p += sizeof v;
+}
+
+static void emit32(struct jit_ctx* c, uint32_t v) {
+    memcpy(c->p, &v, sizeof v);
+    c->p += sizeof v;
+}
+
+static void emit64(struct jit_ctx* c, uint64_t v) {
+    memcpy(c->p, &v, sizeof v);
+    c->p += sizeof v;
+}
+
+static struct x86_operand x86_reg(int reg) {
+    return (struct x86_operand){.reg = reg, .base = -1, .index = -1};
+}
+
+static struct x86_operand x86_mem(int base, int32_t disp) {
+    return (struct x86_operand){
+        .reg = -1, .base = base, .index = -1, .disp = disp};
+}
+
+static struct x86_operand x86_word(int base, int index) {
+    return (struct x86_operand){.reg = -1, .base = base, .index = index};
+}
+
+/* sigma16 register as an operand */
+static struct x86_operand loc(struct jit_ctx* c, int r) {
+    if (c->host[r] >= 0) {
+        return x86_reg(c->host[r]);
+    }
+    return x86_mem(RDI, REG_OFFSET(r));
+}
+
+/* [66] [REX] opcode modrm [sib] [disp] */
+static void emit_insn(struct jit_ctx* c, _Bool p66, _Bool w, uint16_t opcode,
+                      int regfield, struct x86_operand rm) {
+    uint8_t rex = 0x40 | w << 3 | ((regfield >> 3) & 1) << 2;
+    uint8_t mod;
+
+    if (rm.reg >= 0) {
+        rex |= (rm.reg >> 3) & 1;
+    } else {
+        rex |= (rm.base >> 3) & 1;
+        if (rm.index >= 0) {
+            rex |= ((rm.index >> 3) & 1) << 1;
+        }
+    }
+
+    if (p66) {
+        emit8(c, 0x66);
+    }
+    if (rex != 0x40) {
+        emit8(c, rex);
+    }
+    if (opcode > 0xff) {
+        emit8(c, opcode >> 8);
+    }
+    emit8(c, opcode & 0xff);
+
+    if (rm.reg >= 0) {
+        emit8(c, 0xc0 | (regfield & 7) << 3 | (rm.reg & 7));
+        return;
+    }
+    if (rm.index >= 0) {
+        /* scale 2, the base is never rbp/r13 */
+        emit8(c, 0x04 | (regfield & 7) << 3);
+        emit8(c, 0x40 | (rm.index & 7) << 3 | (rm.base & 7));
+        return;
+    }
+
+    if (!rm.disp && (rm.base & 7) != RBP) {
+        mod = 0;
+    } else if (-128 <= rm.disp && rm.disp <= 127) {
+        mod = 1;
+    } else {
+        mod = 2;
+    }
+    emit8(c, mod << 6 | (regfield & 7) << 3 | (rm.base & 7));
+    if ((rm.base & 7) == RSP) {
+        emit8(c, 0x24);
+    }
+    if (mod == 1) {
+        emit8(c, rm.disp);
+    } else if (mod == 2) {
+        emit32(c, rm.disp);
+    }
+}
+
+/* movzx r32, r/m16 */
+static void emit_load16(struct jit_ctx* c, int dst, struct x86_operand src) {
+    emit_insn(c, 0, 0, 0x0fb7, dst, src);
+}
+
+/* mov r/m16, r16 */
+static void emit_store16(struct jit_ctx* c, struct x86_operand dst, int src) {
+    emit_insn(c, 1, 0, 0x89, src, dst);
+}
+
+/* mov r/m16, imm16 */
+static void emit_store_imm16(struct jit_ctx* c, struct x86_operand dst,
+                             uint16_t imm) {
+    emit_insn(c, 1, 0, 0xc7, 0, dst);
+    emit16(c, imm);
+}
+
+static void emit_set_reg(struct jit_ctx* c, int r, int src) {
+    if (r) {
+        emit_store16(c, loc(c, r), src);
+    }
+}
+
+/* jcc rel32, returns the location of the displacement to patch */
+static uint8_t* emit_jcc(struct jit_ctx* c, enum x86_cond cc) {
+    uint8_t* patch;
+
+    emit8(c, 0x0f);
+    emit8(c, 0x80 | cc);
+    patch = c->p;
+    emit32(c, 0);
+    return patch;
+}
+
+static void patch_jcc(struct jit_ctx* c, uint8_t* patch) {
+    int32_t rel = c->p - (patch + 4);
+    memcpy(patch, &rel, sizeof rel);
+}
+
+static void emit_push(struct jit_ctx* c, int reg) {
+    if (reg >= 8) {
+        emit8(c, 0x41);
+    }
+    emit8(c, 0x50 | (reg & 7));
+}
+
+static void emit_pop(struct jit_ctx* c, int reg) {
+    if (reg >= 8) {
+        emit8(c, 0x41);
+    }
+    emit8(c, 0x58 | (reg & 7));
+}
+
+/* write back registers and return eax to the block engine */
+static void emit_exit(struct jit_ctx* c) {
+    for (int r = 1; r < 16; ++r) {
+        if (c->host[r] >= 0 && (c->written & 1 << r)) {
+            emit_store16(c, x86_mem(RDI, REG_OFFSET(r)), c->host[r]);
+        }
+    }
+    for (int i = c->n_saved - 1; i >= 0; --i) {
+        emit_pop(c, c->saved[i]);
+    }
+    emit8(c, 0xc3);
+}
+
+static void emit_exit_imm(struct jit_ctx* c, uint32_t ret) {
+    emit8(c, 0xb8);
+    emit32(c, ret);
+    emit_exit(c);
+}
+
+/* leave with the effective address in ax as the taken target */
+static void emit_exit_taken(struct jit_ctx* c) {
+    emit8(c, 0x0d);
+    emit32(c, JIT_EXIT_TAKEN);
+    emit_exit(c);
+}
+
+/* convert a word between vm->mem and host order, see MEM_SWAP */
+static void emit_mem_swap(struct jit_ctx* c, int reg) {
+#ifndef ENABLE_HOST_ENDIAN_MEM
+    /* rol r16, 8 */
+    emit_insn(c, 1, 0, 0xc1, 0, x86_reg(reg));
+    emit8(c, 8);
+#endif
+}
+
+/* ax = vm->cpu.adr = regs[sa] + disp */
+static void emit_eaddr(struct jit_ctx* c, const struct block_op* op) {
+    emit_load16(c, RAX, loc(c, op->sa));
+    if (op->disp) {
+        emit8(c, 0x66);
+        emit8(c, 0x05);
+        emit16(c, op->disp);
+    }
+    emit_store16(c, x86_mem(RDI, offsetof(sigma16_vm_t, cpu.adr)), RAX);
+}
+
+static void emit_rrr(struct jit_ctx* c, const struct block_op* op,
+                     uint16_t opcode) {
+    emit_load16(c, RAX, loc(c, op->sa));
+    emit_insn(c, 1, 0, opcode, RAX, loc(c, op->sb));
+    emit_set_reg(c, op->d, RAX);
+}
+
+static void emit_setcc_rrr(struct jit_ctx* c, const struct block_op* op,
+                           enum x86_cond cc) {
+    emit_load16(c, RAX, loc(c, op->sa));
+    emit_insn(c, 0, 0, 0x31, RCX, x86_reg(RCX));
+    emit_insn(c, 1, 0, 0x3b, RAX, loc(c, op->sb));
+    emit_insn(c, 0, 0, 0x0f90 | cc, 0, x86_reg(CL));
+    emit_set_reg(c, op->d, RCX);
+    emit_store_imm16(c, loc(c, 15), 0);
+}
+
+/* rebuild the cmp flags in R15 from the host flags */
+static void emit_cmp(struct jit_ctx* c, const struct block_op* op) {
+    static const struct {
+        uint8_t cc;
+        uint8_t reg;
+    } flags[] = {{CC_A, DL}, {CC_G, CH}, {CC_E, CL}, {CC_L, AH}, {CC_B, AL}};
+
+    emit_load16(c, RAX, loc(c, op->sa));
+    emit_insn(c, 1, 0, 0x3b, RAX, loc(c, op->sb));
+    for (int i = 0; i < sizeof flags / sizeof *flags; ++i) {
+        emit_insn(c, 0, 0, 0x0f90 | flags[i].cc, 0, x86_reg(flags[i].reg));
+    }
+    /* edx = G:g:E:l:L, then shifted into place (L is bit 11) */
+    emit_insn(c, 0, 0, 0x0fb6, RDX, x86_reg(DL));
+    for (int i = 1; i < sizeof flags / sizeof *flags; ++i) {
+        emit_insn(c, 0, 0, 0xc1, 4, x86_reg(RDX));
+        emit8(c, 1);
+        emit_insn(c, 0, 0, 0x0a, DL, x86_reg(flags[i].reg));
+    }
+    emit_insn(c, 0, 0, 0xc1, 4, x86_reg(RDX));
+    emit8(c, 11);
+    emit_store16(c, loc(c, 15), RDX);
+}
+
+static void emit_div(struct jit_ctx* c, const struct block_op* op) {
+    uint8_t* skip;
+
+    emit_load16(c, RAX, loc(c, op->sa));
+    emit_load16(c, RCX, loc(c, op->sb));
+    emit_insn(c, 1, 0, 0x85, RCX, x86_reg(RCX));
+    skip = emit_jcc(c, CC_Z);
+    emit_insn(c, 0, 0, 0x31, RDX, x86_reg(RDX));
+    emit_insn(c, 1, 0, 0xf7, 6, x86_reg(RCX));
+    emit_set_reg(c, op->d, RAX);
+    if (op->d != 15) {
+        emit_store16(c, loc(c, 15), RDX);
+    }
+    patch_jcc(c, skip);
+}
+
+static void emit_store(struct jit_ctx* c, const struct block_op* op) {
+    uint8_t* skip;
+
+    emit_eaddr(c, op);
+    emit_load16(c, RCX, loc(c, op->d));
+    emit_mem_swap(c, RCX);
+    emit_store16(c, x86_word(RSI, RAX), RCX);
+
+    /* bt [code_map], eax */
+    emit8(c, 0x48);
+    emit8(c, 0xba);
+    emit64(c, (uintptr_t)c->code_map);
+    emit_insn(c, 0, 0, 0x0fa3, RAX, x86_mem(RDX, 0));
+    skip = emit_jcc(c, CC_NC);
+    emit_exit_imm(c, (uint16_t)(op->pc + 2) | JIT_EXIT_SMC);
+    patch_jcc(c, skip);
+}
+
+/* branch when cond holds on the preceding test, otherwise fall through */
+static void emit_cond_branch(struct jit_ctx* c, const struct block_op* op,
+                             enum x86_cond not_taken) {
+    uint8_t* skip = emit_jcc(c, not_taken);
+
+    emit_eaddr(c, op);
+    emit_exit_taken(c);
+    patch_jcc(c, skip);
+    emit_exit_imm(c, (uint16_t)(op->pc + 2));
+}
+
+static int emit_op(struct jit_ctx* c, const struct block_op* op) {
+    switch (op->kind) {
+        case BOP_ADD:
+            emit_rrr(c, op, 0x03);
+            emit_store_imm16(c, loc(c, 15), add_flags_value(op->d));
+            break;
+        case BOP_SUB:
+            emit_rrr(c, op, 0x2b);
+            break;
+        case BOP_MUL:
+            emit_rrr(c, op, 0x0faf);
+            break;
+        case BOP_DIV:
+            emit_div(c, op);
+            break;
+        case BOP_CMP:
+            emit_cmp(c, op);
+            break;
+        case BOP_CMPLT:
+            emit_setcc_rrr(c, op, CC_B);
+            break;
+        case BOP_CMPEQ:
+            emit_setcc_rrr(c, op, CC_E);
+            break;
+        case BOP_CMPGT:
+            emit_setcc_rrr(c, op, CC_A);
+            break;
+        case BOP_INV:
+            emit_load16(c, RAX, loc(c, op->sa));
+            emit_insn(c, 1, 0, 0xf7, 2, x86_reg(RAX));
+            emit_set_reg(c, op->d, RAX);
+            emit_store_imm16(c, loc(c, 15), 0);
+            break;
+        case BOP_AND:
+            emit_rrr(c, op, 0x23);
+            emit_store_imm16(c, loc(c, 15), 0);
+            break;
+        case BOP_OR:
+            emit_rrr(c, op, 0x0b);
+            emit_store_imm16(c, loc(c, 15), 0);
+            break;
+        case BOP_XOR:
+            emit_rrr(c, op, 0x33);
+            emit_store_imm16(c, loc(c, 15), 0);
+            break;
+        case BOP_NOP:
+            emit_store_imm16(c, loc(c, 15), 0);
+            break;
+        case BOP_LEA:
+            emit_eaddr(c, op);
+            emit_set_reg(c, op->d, RAX);
+            break;
+        case BOP_LOAD:
+            emit_eaddr(c, op);
+            emit_load16(c, RCX, x86_word(RSI, RAX));
+            emit_mem_swap(c, RCX);
+            emit_set_reg(c, op->d, RCX);
+            break;
+        case BOP_STORE:
+            emit_store(c, op);
+            break;
+        case BOP_JUMP:
+            emit_eaddr(c, op);
+            emit_exit_taken(c);
+            break;
+        case BOP_JUMPC0:
+        case BOP_JUMPC1:
+            /* bt word R15, 15 - d */
+            emit_insn(c, 1, 0, 0x0fba, 4, loc(c, 15));
+            emit8(c, 15 - op->d);
+            emit_cond_branch(c, op, op->kind == BOP_JUMPC0 ? CC_C : CC_NC);
+            break;
+        case BOP_JUMPF:
+        case BOP_JUMPT:
+            /* cmp word Rd, 0 */
+            emit_insn(c, 1, 0, 0x83, 7, loc(c, op->d));
+            emit8(c, 0);
+            emit_cond_branch(c, op, op->kind == BOP_JUMPF ? CC_NZ : CC_Z);
+            break;
+        case BOP_JAL:
+            if (op->d) {
+                emit_store_imm16(c, loc(c, op->d), op->pc + 2);
+            }
+            emit_eaddr(c, op);
+            emit_exit_taken(c);
+            break;
+        case BOP_FALLTHROUGH:
+            emit_exit_imm(c, op->pc);
+            break;
+        default:
+            return -1;
+    }
+    return 0;
+}
+
+/* pick host registers for the most used sigma16 registers of the block */
+static void alloc_regs(struct jit_ctx* c, const struct block_op* ops, int n) {
+    int uses[16] = {0};
+    int best;
+
+    c->written = 0;
+    for (int i = 0; i < n; ++i) {
+        uses[ops[i].sa]++;
+        uses[ops[i].d]++;
+        if (ops[i].kind <= BOP_NOP) {
+            uses[ops[i].sb]++;
+            uses[15]++;
+            c->written |= 1 << ops[i].d | 1 << 15;
+        } else if (ops[i].kind == BOP_LEA || ops[i].kind == BOP_LOAD ||
+                   ops[i].kind == BOP_JAL) {
+            c->written |= 1 << ops[i].d;
+        } else if (ops[i].kind == BOP_JUMPC0 || ops[i].kind == BOP_JUMPC1) {
+            uses[15]++;
+        }
+    }
+    uses[0] = 0;
+    c->written &= ~1;
+
+    memset(c->host, -1, sizeof c->host);
+    c->n_saved = 0;
+    for (int i = 0; i < sizeof alloc_order; ++i) {
+        best = 0;
+        for (int r = 1; r < 16; ++r) {
+            if (c->host[r] < 0 && uses[r] > uses[best]) {
+                best = r;
+            }
+        }
+        if (!best) {
+            break;
+        }
+        c->host[best] = alloc_order[i];
+        if (alloc_order[i] == RBX || alloc_order[i] >= R12 ||
+            alloc_order[i] == RBP) {
+            c->saved[c->n_saved++] = alloc_order[i];
+        }
+    }
+}
+
+sigma16_native_fn sigma16_jit_compile(sigma16_vm_t* vm,
+                                      const struct block_op* ops, int n,
+                                      const uint64_t* code_map) {
+    struct sigma16_jit* jit = vm->jit;
+    struct jit_ctx c;
+    uint8_t* entry;
+
+    if (!jit) {
+        if (!(jit = calloc(1, sizeof *jit))) {
+            return NULL;
+        }
+        if ((jit->code = mmap(NULL, JIT_CODE_SIZE,
+                              PROT_READ | PROT_WRITE | PROT_EXEC,
+                              MAP_ANON | MAP_PRIVATE, -1, 0)) == MAP_FAILED) {
+            perror("unable to allocate jit code buffer");
+            free(jit);
+            return NULL;
+        }
+        vm->jit = jit;
+    }
+
+    if (jit->used + (n + 1) * JIT_MAX_INSN > JIT_CODE_SIZE) {
+        return NULL;
+    }
+
+    entry = c.p = jit->code + jit->used;
+    c.code_map = code_map;
+    alloc_regs(&c, ops, n);
+
+    for (int i = 0; i < c.n_saved; ++i) {
+        emit_push(&c, c.saved[i]);
+    }
+    /* mov rsi, [rdi + mem] */
+    emit_insn(&c, 0, 1, 0x8b, RSI, x86_mem(RDI, offsetof(sigma16_vm_t, mem)));
+    for (int r = 1; r < 16; ++r) {
+        if (c.host[r] >= 0) {
+            emit_load16(&c, c.host[r], x86_mem(RDI, REG_OFFSET(r)));
+        }
+    }
+
+    for (int i = 0; i < n; ++i) {
+        if (emit_op(&c, &ops[i]) < 0) {
+            /* abandon, the buffer space is simply reused */
+            return NULL;
+        }
+    }
+
+    jit->used = c.p - jit->code;
+    return (sigma16_native_fn)entry;
+}
+
+void sigma16_jit_del(sigma16_vm_t* vm) {
+    munmap(vm->jit->code, JIT_CODE_SIZE);
+    free(vm->jit);
+    vm->jit = NULL;
+}
+#else
+sigma16_native_fn sigma16_jit_compile(sigma16_vm_t* vm,
+                                      const struct block_op* ops, int n,
+                                      const uint64_t* code_map) {
+    return NULL;
+}
+
+void sigma16_jit_del(sigma16_vm_t* vm) {}
+#endif
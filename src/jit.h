@@ -0,0 +1,25 @@
+#pragma once
+#include <stdint.h>
+
+#include "block.h"
+#include "config.h"
+#include "vm.h"
+
+/* hot blocks are only compiled when nothing needs to observe each step */
+#if defined(__x86_64__) && defined(__linux__) && \
+    !defined(ENABLE_FLIGHT_RECORDER)
+#define HAVE_JIT
+#endif
+
+/* block executions before it is compiled to native code */
+#define JIT_THRESHOLD 64
+
+/* native blocks return the next pc, or'd with the exit flags below */
+#define JIT_EXIT_TAKEN (1 << 16)
+#define JIT_EXIT_SMC (1 << 17)
+
+typedef uint32_t (*sigma16_native_fn)(sigma16_vm_t*);
+
+sigma16_native_fn sigma16_jit_compile(sigma16_vm_t*, const struct block_op*,
+                                      int, const uint64_t*);
+void sigma16_jit_del(sigma16_vm_t*);
@@ -1,50 +1,192 @@
+#include <getopt.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
 #include "config.h"
 #ifdef ENABLE_DEBUGGER
 #include "debugger.h"
 #endif
+#include "disasm.h"
+#include "gdb.h"
+#include "jit.h"
+#include "pool.h"
+#include "tailcall.h"
 #include "tracing.h"
 #include "vm.h"
 
+/* exit status of a run which exhausted its budget, as timeout(1) */
+#define EXIT_BUDGET 124
+
+struct options {
+    enum sigma16_engine engine;
+    int trace;
+    int profile;
+    int disasm;
+    int threads;
+    /* budget of every run, 0 for none */
+    uint64_t max_insts;
+    double timeout;
+};
+
+#ifdef ENABLE_FLIGHT_RECORDER
+/* the vm whose recorder is dumped on a signal */
+static sigma16_vm_t* recording;
+
+static void dump_on_signal(int sig) {
+    /* not async-signal-safe, but the process is usually going down */
+    fprintf(stderr, "\n%s\n", strsignal(sig));
+    dump_flight_recorder(stderr, recording);
+    if (sig != SIGUSR1) {
+        /* delivered with the default action once the handler returns */
+        raise(sig);
+    }
+}
+
+/* dump on a fault, or on request with SIGUSR1 */
+static void record_signals(sigma16_vm_t* vm) {
+    static const int faults[] = {SIGSEGV, SIGBUS, SIGILL, SIGFPE, SIGABRT};
+    struct sigaction sa = {.sa_handler = dump_on_signal};
+
+    recording = vm;
+    sa.sa_flags = SA_RESTART;
+    sigaction(SIGUSR1, &sa, NULL);
+    sa.sa_flags = SA_RESETHAND;
+    for (int i = 0; i < sizeof faults / sizeof *faults; ++i) {
+        sigaction(faults[i], &sa, NULL);
+    }
+}
+#endif
+
+static void report_budget(sigma16_vm_t* vm) {
+    fprintf(stderr, "budget exhausted after %llu instructions, pc=%04x\n",
+            (unsigned long long)vm->icount, vm->cpu.pc);
+}
+
 #ifdef ENABLE_DEBUGGER
-int exec_debugger(char* fname) {
+int exec_debugger(char* fname, struct options* opts) {
     sigma16_vm_t* vm;
+    int ret;
 
     if (!(vm = debugger_init(fname))) {
         fprintf(stderr, "unable to initialise debugger\n");
         return EXIT_FAILURE;
     }
+    vm->engine = opts->engine;
+    /* print every instruction, which also slows continue down */
+    ((struct debugger_ctx*)vm->vm_refl)->trace = opts->trace;
+    if (opts->profile && sigma16_vm_profile(vm) < 0) {
+        return EXIT_FAILURE;
+    }
+    sigma16_vm_set_budget(vm, opts->max_insts, opts->timeout);
+#ifdef ENABLE_FLIGHT_RECORDER
+    record_signals(vm);
+#endif
 
-    if (sigma16_vm_exec(vm) < 0) {
+    if ((ret = debugger_exec(vm)) < 0) {
         perror("an error occured during execution");
         return EXIT_FAILURE;
     }
+    if (ret == SIGMA16_EXEC_BUDGET) {
+        report_budget(vm);
+        return EXIT_BUDGET;
+    }
     return 0;
 }
 #endif
 
-int exec_normal(char* fname) {
+/* list the executable, telling code from data by following its jumps */
+int exec_disasm(char* fname) {
+    struct sigma16_disasm_rec* recs = NULL;
+    uint16_t* words = NULL;
+    FILE* executable;
+    long size;
+    ssize_t n;
+
+    if (!(executable = fopen(fname, "rb"))) {
+        perror("unable to open executable");
+        return EXIT_FAILURE;
+    }
+    if (fseek(executable, 0, SEEK_END) < 0 || (size = ftell(executable)) < 0 ||
+        fseek(executable, 0, SEEK_SET) < 0 ||
+        !(words = malloc(size + 1)) ||
+        fread(words, 1, size, executable) != (size_t)size ||
+        !(recs = malloc((size >> 1) * sizeof *recs + 1)) ||
+        (n = sigma16_disasm(words, size >> 1, 0, DISASM_BIG_ENDIAN, recs)) <
+            0) {
+        perror("unable to disassemble executable");
+        fclose(executable);
+        free(words);
+        free(recs);
+        return EXIT_FAILURE;
+    }
+    fclose(executable);
+    dump_disasm(stdout, recs, n, 0, -1);
+    free(words);
+    free(recs);
+    return 0;
+}
+
+int exec_gdb(char* fname, char* where, struct options* opts) {
     sigma16_vm_t* vm;
+    int ret;
 
     if (sigma16_vm_init(&vm, fname) < 0) {
         perror("failed to initialise vm");
         return EXIT_FAILURE;
     }
-#ifdef ENABLE_TRACE
-    vm->trace_handler = sigma16_trace;
-    puts("Instruction Trace:");
+    vm->engine = opts->engine;
+    sigma16_vm_set_budget(vm, opts->max_insts, opts->timeout);
+
+    ret = sigma16_gdb_serve(vm, where);
+    sigma16_vm_del(vm);
+    if (ret < 0) {
+        return EXIT_FAILURE;
+    }
+    return ret == SIGMA16_EXEC_BUDGET ? EXIT_BUDGET : 0;
+}
+
+int exec_normal(char* fname, struct options* opts) {
+    sigma16_vm_t* vm;
+    int ret;
+
+    if (sigma16_vm_init(&vm, fname) < 0) {
+        perror("failed to initialise vm");
+        return EXIT_FAILURE;
+    }
+    vm->engine = opts->engine;
+    if (opts->profile && sigma16_vm_profile(vm) < 0) {
+        goto error;
+    }
+    sigma16_vm_set_budget(vm, opts->max_insts, opts->timeout);
+#ifdef ENABLE_FLIGHT_RECORDER
+    record_signals(vm);
 #endif
+    if (opts->trace) {
+        vm->trace_handler = sigma16_trace;
+        puts("Instruction Trace:");
+    }
 
-    if (sigma16_vm_exec(vm) < 0) {
+    ret = sigma16_vm_exec(vm);
+    /* also shows where a failing program spent its time */
+    if (opts->profile) {
+        dump_profile(stderr, vm);
+    }
+    if (ret < 0) {
         perror("an error occured during execution");
         goto error;
     }
+    if (ret == SIGMA16_EXEC_BUDGET) {
+        report_budget(vm);
+        sigma16_vm_del(vm);
+        return EXIT_BUDGET;
+    }
 
 #ifdef ENABLE_CPU_DUMP
     puts("Termination.\n");
-    dump_cpu(&vm->cpu);
+    dump_cpu(vm->out, &vm->cpu);
 #endif
 #ifdef ENABLE_DUMP_MEM
     puts("Memory:");
@@ -57,22 +199,267 @@ error:
     return EXIT_FAILURE;
 }
 
+static void free_jobs(struct sigma16_job* jobs, int n) {
+    for (int i = 0; i < n; ++i) {
+        free(jobs[i].output);
+        free(jobs[i].fname);
+    }
+    free(jobs);
+}
+
+/* reads one executable path per non-empty line, "-" is stdin */
+static int read_list(char* list, struct sigma16_job** jobs) {
+    FILE* f = strcmp(list, "-") ? fopen(list, "r") : stdin;
+    struct sigma16_job* grown;
+    char* line = NULL;
+    char* fname;
+    size_t cap = 0, alloc = 0;
+    ssize_t len;
+    int n = 0;
+
+    if (!f) {
+        return -1;
+    }
+    *jobs = NULL;
+    while ((len = getline(&line, &cap, f)) >= 0) {
+        while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r')) {
+            line[--len] = '\0';
+        }
+        if (!len) {
+            continue;
+        }
+        if (n == alloc) {
+            alloc = alloc ? alloc * 2 : 16;
+            if (!(grown = realloc(*jobs, alloc * sizeof **jobs))) {
+                goto error;
+            }
+            *jobs = grown;
+        }
+        if (!(fname = strdup(line))) {
+            goto error;
+        }
+        (*jobs)[n++] = (struct sigma16_job){.fname = fname};
+    }
+    free(line);
+    if (f != stdin) {
+        fclose(f);
+    }
+    return n;
+error:
+    free_jobs(*jobs, n);
+    free(line);
+    if (f != stdin) {
+        fclose(f);
+    }
+    return -1;
+}
+
+static int by_fname(const void* a, const void* b) {
+    return strcmp((*(struct sigma16_job**)a)->fname,
+                  (*(struct sigma16_job**)b)->fname);
+}
+
+/* load every distinct executable once, jobs naming it share the image */
+static void share_images(struct sigma16_job** sorted, int n) {
+    sigma16_image_t* image = NULL;
+
+    qsort(sorted, n, sizeof *sorted, by_fname);
+    for (int i = 0; i < n; ++i) {
+        if (!i || strcmp(sorted[i - 1]->fname, sorted[i]->fname)) {
+            /* unloadable files are reported again by their jobs */
+            if (sigma16_image_load(&image, sorted[i]->fname,
+                                   LOADER_MMAP) < 0) {
+                image = NULL;
+            }
+        }
+        sorted[i]->image = image;
+    }
+}
+
+static void release_images(struct sigma16_job** sorted, int n) {
+    for (int i = 0; i < n; ++i) {
+        if (sorted[i]->image &&
+            (i == n - 1 || sorted[i + 1]->image != sorted[i]->image)) {
+            sigma16_image_del(sorted[i]->image);
+        }
+    }
+}
+
+int exec_batch(char* list, struct options* opts) {
+    struct sigma16_job* jobs;
+    struct sigma16_job** sorted;
+    uint64_t total = 0;
+    int n, failed = 0, spent = 0;
+
+    if ((n = read_list(list, &jobs)) < 0) {
+        perror("unable to read batch list");
+        return EXIT_FAILURE;
+    }
+    if (!(sorted = malloc(n * sizeof *sorted))) {
+        perror("unable to allocate batch");
+        free_jobs(jobs, n);
+        return EXIT_FAILURE;
+    }
+    for (int i = 0; i < n; ++i) {
+        jobs[i].engine = opts->engine;
+        jobs[i].max_insts = opts->max_insts;
+        jobs[i].timeout = opts->timeout;
+        sorted[i] = &jobs[i];
+    }
+    share_images(sorted, n);
+
+    if (sigma16_pool_run(jobs, n, opts->threads) < 0) {
+        goto error;
+    }
+    release_images(sorted, n);
+    free(sorted);
+
+    for (int i = 0; i < n; ++i) {
+        printf("== %s: status %d, %lu instructions, %.3f s\n", jobs[i].fname,
+               jobs[i].status, (unsigned long)jobs[i].icount,
+               jobs[i].seconds);
+        fwrite(jobs[i].output, 1, jobs[i].output_len, stdout);
+        failed += jobs[i].status < 0;
+        spent += jobs[i].status == SIGMA16_EXEC_BUDGET;
+        total += jobs[i].icount;
+    }
+    printf("== %d jobs, %d failed, %d out of budget, %lu instructions\n", n,
+           failed, spent, (unsigned long)total);
+    free_jobs(jobs, n);
+    return failed ? EXIT_FAILURE : spent ? EXIT_BUDGET : 0;
+error:
+    release_images(sorted, n);
+    free(sorted);
+    free_jobs(jobs, n);
+    return EXIT_FAILURE;
+}
+
+static int parse_engine(char* name, enum sigma16_engine* engine) {
+    if (!strcmp(name, "interp")) {
+        *engine = ENGINE_INTERP;
+    } else if (!strcmp(name, "block")) {
+        *engine = ENGINE_BLOCK;
+    } else if (!strcmp(name, "jit")) {
+#ifndef HAVE_JIT
+        fprintf(stderr, "jit not available in this build, using block\n");
+#endif
+        *engine = ENGINE_JIT;
+    } else if (!strcmp(name, "tailcall")) {
+#ifndef HAVE_TAILCALL
+        fprintf(stderr,
+                "tailcall not available in this build, using interp\n");
+#endif
+        *engine = ENGINE_TAILCALL;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+static void usage(char* prog) {
+    fprintf(stderr,
+            "usage: %s [--engine=interp|block|jit|tailcall] "
+            "[--trace|--no-trace] [--profile] [--max-instructions=N] "
+            "[--timeout=SECONDS] [filename]\n"
+            "       %s [--engine=interp|block|jit|tailcall] [--threads=N] "
+            "[--max-instructions=N] [--timeout=SECONDS] --batch=list\n"
+            "       %s [--engine=interp|block|jit|tailcall] "
+            "[--max-instructions=N] [--timeout=SECONDS] --gdb=PORT|SOCKET "
+            "filename\n"
+            "       %s --disasm filename\n",
+            prog, prog, prog, prog);
+}
+
 int main(int argc, char** argv) {
-    sigma16_vm_t* vm = NULL;
+    static struct options opts = {
+        .engine = DEFAULT_ENGINE,
+#ifdef ENABLE_TRACE
+        .trace = 1,
+#endif
+    };
+    static struct option long_options[] = {
+        {"engine", required_argument, NULL, 'e'},
+        {"batch", required_argument, NULL, 'b'},
+        {"threads", required_argument, NULL, 't'},
+        {"trace", no_argument, &opts.trace, 1},
+        {"no-trace", no_argument, &opts.trace, 0},
+        {"profile", no_argument, &opts.profile, 1},
+        {"disasm", no_argument, &opts.disasm, 1},
+        {"max-instructions", required_argument, NULL, 'm'},
+        {"timeout", required_argument, NULL, 'T'},
+        {"gdb", required_argument, NULL, 'g'},
+        {NULL, 0, NULL, 0}};
     char* fname;
+    char* list = NULL;
+    char* gdb = NULL;
+    char* end;
+    int opt;
+
+    opts.threads = sysconf(_SC_NPROCESSORS_ONLN);
+    while ((opt = getopt_long(argc, argv, "", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 0:
+                break;
+            case 'e':
+                if (parse_engine(optarg, &opts.engine) < 0) {
+                    fprintf(stderr, "unknown engine: %s\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'b':
+                list = optarg;
+                break;
+            case 'g':
+                gdb = optarg;
+                break;
+            case 't':
+                if ((opts.threads = atoi(optarg)) < 1) {
+                    fprintf(stderr, "invalid thread count: %s\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'm':
+                opts.max_insts = strtoull(optarg, &end, 0);
+                if (*end || !opts.max_insts) {
+                    fprintf(stderr, "invalid instruction count: %s\n",
+                            optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'T':
+                opts.timeout = strtod(optarg, &end);
+                if (*end || opts.timeout <= 0) {
+                    fprintf(stderr, "invalid timeout: %s\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            default:
+                usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+
+    if (list) {
+        return exec_batch(list, &opts);
+    }
 
-    if (argc < 2) {
-        fprintf(stderr, "usage: %s [filename]\n", argv[0]);
+    if (optind >= argc) {
+        usage(argv[0]);
         return EXIT_FAILURE;
     }
 
-    fname = argv[1];
+    fname = argv[optind];
+    if (opts.disasm) {
+        return exec_disasm(fname);
+    }
+    if (gdb) {
+        return exec_gdb(fname, gdb, &opts);
+    }
 
     return
 #ifndef ENABLE_DEBUGGER
-        exec_normal(fname);
+        exec_normal(fname, &opts);
 #else
-        exec_debugger(fname);
+        exec_debugger(fname, &opts);
 #endif
 }
-
@@ -0,0 +1,154 @@
+#pragma once
+/* instruction semantics shared by the execution engines */
+#include <byteswap.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "cpu.h"
+#include "history.h"
+#include "instructions.h"
+#include "io.h"
+#include "vm.h"
+
+/* vm->mem word to host order and back */
+#ifdef ENABLE_HOST_ENDIAN_MEM
+#define MEM_SWAP(word) (word)
+#else
+#define MEM_SWAP(word) bswap_16(word)
+#endif
+
+/* engines check at taken branches and block boundaries */
+#define BUDGET_SPENT(vm)                                   \
+    (__builtin_expect(vm->icount >= vm->next_check, 0) && \
+     sigma16_vm_budget_check(vm))
+
+/* stores log the word they replace while the debugger keeps history */
+#define LOG_STORE(vm, addr)                         \
+    if (__builtin_expect(vm->history != NULL, 0)) { \
+        sigma16_history_store(vm, addr);            \
+    }
+
+/* bit addr of the breakpoint bitmap */
+static inline int test_addr(const uint64_t* map, uint16_t addr) {
+    return map[addr >> 6] >> (addr & 63) & 1;
+}
+
+/* accesses to watched addresses end the run once they are done */
+#define CHECK_WATCH(vm, addr, kind)                                 \
+    if (__builtin_expect(vm->watch_pages[(addr) >> 8] & (kind), 0) && \
+        sigma16_vm_watched(vm, addr, kind)) {                       \
+        return SIGMA16_EXEC_WATCH;                                  \
+    }
+
+#define SAFE_UPDATE(vm, dst, val) \
+    if (dst != 0) vm->cpu.regs[dst] = val;
+
+#ifdef ENABLE_HOST_ENDIAN_MEM
+/* the instruction layouts describe the big-endian image, so rebuild it */
+#define INTERP_INST(vm, type)                                            \
+    do {                                                                 \
+        uint16_t raw[sizeof(sigma16_inst_##type##_t) >> 1];              \
+        for (int i = 0; i < sizeof raw >> 1; ++i) {                      \
+            raw[i] = bswap_16(vm->mem[(uint16_t)(vm->cpu.pc + i)]);      \
+        }                                                                \
+        memcpy(&vm->cpu.ir.type, raw, sizeof raw);                       \
+    } while (0)
+#else
+#define INTERP_INST(vm, type) \
+    vm->cpu.ir.type = *(sigma16_inst_##type##_t*)&vm->mem[vm->cpu.pc]
+#endif
+
+#define INTERP_RX(vm)    \
+    INTERP_INST(vm, rx); \
+    vm->cpu.ir.rx.disp = bswap_16(vm->cpu.ir.rx.disp)
+
+#ifdef ENABLE_FLIGHT_RECORDER
+/* single writer; readers load flight_head before and after a record */
+static inline void flight_record(sigma16_vm_t* vm, uint16_t pc, uint8_t d,
+                                 uint8_t sa, uint8_t sb, uint16_t disp) {
+    uint64_t head = vm->flight_head;
+    struct sigma16_flight_record* rec =
+        &vm->flight[head & (FLIGHT_RECORDER_SIZE - 1)];
+
+    rec->pc = pc;
+    rec->word = MEM_SWAP(vm->mem[pc]);
+    rec->disp = disp;
+    rec->d = vm->cpu.regs[d];
+    rec->sa = vm->cpu.regs[sa];
+    rec->sb = vm->cpu.regs[sb];
+    rec->r15 = vm->cpu.regs[15];
+    __atomic_store_n(&vm->flight_head, head + 1, __ATOMIC_RELEASE);
+}
+#endif
+
+#define SETFLAG(reg, flag, val) (*(sigma16_reg_status_t*)&reg).flag = val
+
+#define CLEARFLAGS(reg) memset(&reg, 0, sizeof(sigma16_reg_status_t));
+
+static inline int select_bit(uint16_t val, uint8_t bit_pos) {
+    return (val >> 15 - bit_pos) & 0x1;
+}
+
+__attribute__((always_inline)) static inline void op_add_flags(
+    sigma16_vm_t* vm, uint8_t d) {
+    CLEARFLAGS(vm->cpu.regs[15]);
+    SETFLAG(vm->cpu.regs[15], G, d > 0);
+    SETFLAG(vm->cpu.regs[15], g, (int16_t)d > 0);
+    SETFLAG(vm->cpu.regs[15], E, d == 0);
+    SETFLAG(vm->cpu.regs[15], L, (int16_t)d < 0);
+    SETFLAG(vm->cpu.regs[15], L, d == 0);
+    // TODO overflow & carry
+    SETFLAG(vm->cpu.regs[15], V, d > 0);
+    SETFLAG(vm->cpu.regs[15], v, d > 0);
+    SETFLAG(vm->cpu.regs[15], C, d > 0);
+}
+
+/* R15 as left by op_add_flags, a constant for each destination */
+static inline uint16_t add_flags_value(uint8_t d) {
+    sigma16_vm_t scratch;
+
+    op_add_flags(&scratch, d);
+    return scratch.cpu.regs[15];
+}
+
+__attribute__((always_inline)) static inline void op_cmp(sigma16_vm_t* vm,
+                                                         uint16_t a,
+                                                         uint16_t b) {
+    CLEARFLAGS(vm->cpu.regs[15]);
+    SETFLAG(vm->cpu.regs[15], G, a > b);
+    SETFLAG(vm->cpu.regs[15], g, (int16_t)a > (int16_t)b);
+    SETFLAG(vm->cpu.regs[15], E, a == b);
+    SETFLAG(vm->cpu.regs[15], l, (int16_t)a < (int16_t)b);
+    SETFLAG(vm->cpu.regs[15], L, a < b);
+}
+
+__attribute__((always_inline)) static inline void op_div(sigma16_vm_t* vm,
+                                                         uint8_t d, uint8_t sa,
+                                                         uint8_t sb) {
+    int a, b;
+    int quotient;
+
+    a = vm->cpu.regs[sa];
+    b = vm->cpu.regs[sb];
+
+    if (!b) {
+        return;
+    }
+    quotient = (int)(a / b);
+    SAFE_UPDATE(vm, d, quotient);
+
+    if (d != 15) {
+        vm->cpu.regs[15] = a % b;
+    }
+}
+
+static inline void trap_write(sigma16_vm_t* vm, uint8_t sa, uint8_t sb) {
+    sigma16_trap_write(vm, vm->cpu.regs[sa], vm->cpu.regs[sb]);
+}
+
+/* Rsb is left holding the number of bytes read */
+static inline void trap_read(sigma16_vm_t* vm, uint8_t sa, uint8_t sb) {
+    int n = sigma16_trap_read(vm, vm->cpu.regs[sa], vm->cpu.regs[sb]);
+
+    SAFE_UPDATE(vm, sb, n);
+}
@@ -0,0 +1,143 @@
+#include "pool.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "config.h"
+#include "vm.h"
+
+/*
+ * Work stealing pool for independent jobs. Every worker owns a contiguous
+ * range of the job array and takes jobs from its front; a worker whose
+ * range is exhausted steals from the back of another. Each job gets its own
+ * vm and its output goes to a private memory stream, so nothing is shared
+ * between workers but the ranges.
+ */
+
+struct worker {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    /* jobs [next, end) are still queued */
+    int next;
+    int end;
+    int id;
+    struct pool* pool;
+};
+
+struct pool {
+    struct sigma16_job* jobs;
+    struct worker* workers;
+    int n_workers;
+};
+
+static double now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int take(struct worker* w) {
+    int job = -1;
+
+    pthread_mutex_lock(&w->lock);
+    if (w->next < w->end) {
+        job = w->next++;
+    }
+    pthread_mutex_unlock(&w->lock);
+    return job;
+}
+
+static int steal(struct worker* thief) {
+    struct pool* pool = thief->pool;
+    struct worker* victim;
+    int job = -1;
+
+    for (int i = 1; i < pool->n_workers && job < 0; ++i) {
+        victim = &pool->workers[(thief->id + i) % pool->n_workers];
+        pthread_mutex_lock(&victim->lock);
+        if (victim->next < victim->end) {
+            job = --victim->end;
+        }
+        pthread_mutex_unlock(&victim->lock);
+    }
+    return job;
+}
+
+static void run_job(struct sigma16_job* job) {
+    sigma16_vm_t* vm;
+    FILE* out;
+    double start = now();
+
+    job->status = -1;
+    if (!(out = open_memstream(&job->output, &job->output_len))) {
+        perror("unable to allocate job output");
+        return;
+    }
+
+    if ((job->image ? sigma16_vm_init_image(&vm, job->image)
+                    : sigma16_vm_init(&vm, job->fname)) == 0) {
+        vm->engine = job->engine;
+        vm->out = out;
+        sigma16_vm_set_budget(vm, job->max_insts, job->timeout);
+        job->status = sigma16_vm_exec(vm);
+        job->icount = vm->icount;
+        sigma16_vm_del(vm);
+    }
+
+    fclose(out);
+    job->seconds = now() - start;
+}
+
+static void* work(void* arg) {
+    struct worker* self = arg;
+    int job;
+
+    while ((job = take(self)) >= 0 || (job = steal(self)) >= 0) {
+        run_job(&self->pool->jobs[job]);
+    }
+    return NULL;
+}
+
+int sigma16_pool_run(struct sigma16_job* jobs, int n, int threads) {
+    struct pool pool = {.jobs = jobs, .n_workers = threads};
+    int started = 0;
+
+    if (threads < 1) {
+        threads = pool.n_workers = 1;
+    }
+    if (!(pool.workers = calloc(threads, sizeof *pool.workers))) {
+        perror("unable to allocate workers");
+        return -1;
+    }
+
+    for (int i = 0; i < threads; ++i) {
+        pool.workers[i].id = i;
+        pool.workers[i].pool = &pool;
+        pool.workers[i].next = (long)n * i / threads;
+        pool.workers[i].end = (long)n * (i + 1) / threads;
+        pthread_mutex_init(&pool.workers[i].lock, NULL);
+    }
+
+    /* the calling thread is worker 0 */
+    for (int i = 1; i < threads; ++i) {
+        if (pthread_create(&pool.workers[i].thread, NULL, work,
+                           &pool.workers[i])) {
+            perror("unable to start worker");
+            break;
+        }
+        started = i;
+    }
+    work(&pool.workers[0]);
+
+    for (int i = 1; i <= started; ++i) {
+        pthread_join(pool.workers[i].thread, NULL);
+    }
+    for (int i = 0; i < threads; ++i) {
+        pthread_mutex_destroy(&pool.workers[i].lock);
+    }
+    free(pool.workers);
+    return 0;
+}
@@ -0,0 +1,26 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+#include "image.h"
+#include "vm.h"
+
+/* one executable run by sigma16_pool_run */
+struct sigma16_job {
+    char* fname;
+    /* if set, mapped instead of loading fname again */
+    sigma16_image_t* image;
+    enum sigma16_engine engine;
+    /* budget of the run, 0 for none */
+    uint64_t max_insts;
+    double timeout;
+    /* filled in by the pool */
+    int status;
+    uint64_t icount;
+    double seconds;
+    /* trap output, owned by the job */
+    char* output;
+    size_t output_len;
+};
+
+int sigma16_pool_run(struct sigma16_job*, int, int);
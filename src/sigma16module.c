@@ -3,9 +3,10 @@
 #include <structmember.h>
 
 #include "config.h"
-#ifdef ENABLE_TRACE
+#include "disasm.h"
 #include "events.h"
-#endif
+#include "expr.h"
+#include "io.h"
 #include "vm.h"
 
 typedef struct {
@@ -48,13 +49,12 @@ PyObject* Sigma16InstructionRRR_FromBytes(sigma16_inst_rrr_t instruction) {
     if (!(obj = PyObject_New(InstructionRRRObject, &InstructionRRRType))) {
         return NULL;
     }
-    Py_INCREF(obj);
 
     obj->d = PyLong_FromLong((long)instruction.d);
     obj->op = PyLong_FromLong((long)instruction.op);
     obj->sb = PyLong_FromLong((long)instruction.sb);
     obj->sa = PyLong_FromLong((long)instruction.sa);
-    return obj;
+    return (PyObject*)obj;
 }
 
 typedef struct {
@@ -101,20 +101,18 @@ PyObject* Sigma16InstructionRX_FromBytes(sigma16_inst_rx_t instruction) {
     if (!(obj = PyObject_New(InstructionRXObject, &InstructionRXType))) {
         return NULL;
     }
-    Py_INCREF(obj);
 
     obj->d = PyLong_FromLong((long)instruction.d);
     obj->op = PyLong_FromLong((long)instruction.op);
     obj->sb = PyLong_FromLong((long)instruction.sb);
     obj->sa = PyLong_FromLong((long)instruction.sa);
     obj->disp = PyLong_FromLong((long)instruction.disp);
-    return obj;
+    return (PyObject*)obj;
 }
 
 typedef struct {
     PyObject_HEAD PyObject* d;
     PyObject* op;
-    PyObject* sb;
     PyObject* ab;
 } InstructionEXP0Object;
 
@@ -148,36 +146,277 @@ PyObject* Sigma16InstructionEXP0_FromBytes(sigma16_inst_exp0_t instruction) {
     if (!(obj = PyObject_New(InstructionEXP0Object, &InstructionEXP0Type))) {
         return NULL;
     }
-    Py_INCREF(obj);
 
     obj->d = PyLong_FromLong((long)instruction.d);
     obj->op = PyLong_FromLong((long)instruction.op);
     obj->ab = PyLong_FromLong((long)instruction.ab);
-    return obj;
+    return (PyObject*)obj;
+}
+
+typedef struct {
+    PyObject_HEAD PyObject* executable;
+    sigma16_image_t* image;
+} ImageObject;
+
+static void Image_dealloc(ImageObject* self) {
+    if (self->image) {
+        sigma16_image_del(self->image);
+    }
+    Py_XDECREF(self->executable);
+    Py_TYPE(self)->tp_free((PyObject*)self);
+}
+
+static int Image_init(ImageObject* self, PyObject* args, PyObject* kwds) {
+    static char* kwlist[] = {"executable", NULL};
+    PyObject* executable;
+    const char* fname;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "U", kwlist, &executable) ||
+        !(fname = PyUnicode_AsUTF8(executable))) {
+        return -1;
+    }
+    if (self->image) {
+        sigma16_image_del(self->image);
+        self->image = NULL;
+    }
+    if (sigma16_image_load(&self->image, fname, LOADER_MMAP) < 0) {
+        self->image = NULL;
+        PyErr_SetFromErrnoWithFilenameObject(PyExc_OSError, executable);
+        return -1;
+    }
+    Py_INCREF(executable);
+    Py_XSETREF(self->executable, executable);
+    return 0;
 }
 
+static PyMemberDef Image_members[] = {
+    {"executable", T_OBJECT_EX, offsetof(ImageObject, executable), READONLY,
+     "executable filename"},
+    {NULL}};
+
+static PyTypeObject ImageType = {
+    PyVarObject_HEAD_INIT(NULL, 0).tp_name = "sigma16.Image",
+    .tp_doc = "Executable loaded once and shared copy-on-write by emulators",
+    .tp_basicsize = sizeof(ImageObject),
+    .tp_itemsize = 0,
+    .tp_flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE,
+    .tp_new = PyType_GenericNew,
+    .tp_init = (initproc)Image_init,
+    .tp_dealloc = (destructor)Image_dealloc,
+    .tp_members = Image_members};
+
+/* one traced instruction, see Emulator.batch_handler */
+struct trace_record {
+    uint16_t pc;
+    uint16_t word;
+    /* second word of RX and EXP instructions, else 0 */
+    uint16_t disp;
+    /* fields of the first word */
+    uint8_t op;
+    uint8_t d;
+    uint8_t sa;
+    uint8_t sb;
+};
+
+/* PEP 3118 structure, NumPy turns it into named fields */
+#define TRACE_RECORD_FORMAT "T{H:pc:H:word:H:disp:B:op:B:d:B:sa:B:sb:}"
+
 typedef struct {
     PyObject_HEAD PyObject* cpu;
-    PyObject* memory;
     PyObject* executable;
-#ifdef ENABLE_TRACE
     PyObject* trace_handler;
-#endif
+    /* called with a memoryview of up to batch_size trace_record at once */
+    PyObject* batch_handler;
+    struct trace_record* records;
+    Py_ssize_t n_records;
+    Py_ssize_t batch_size;
     sigma16_vm_t* vm;
+    /* set while executing, released if the run does not hold the GIL */
+    int running;
+    int released;
+    /* why the last run stopped, NULL before the first */
+    const char* stop_reason;
 } EmulatorObject;
 
+/*
+ * Exports an array inside an emulator, or any other object, without
+ * copying, for memoryviews. Holds a reference to the owner, which keeps the
+ * vm alive.
+ */
+typedef struct {
+    PyObject_HEAD PyObject* owner;
+    void* buf;
+    Py_ssize_t len;
+    Py_ssize_t itemsize;
+    const char* format;
+    int readonly;
+} ViewObject;
+
+/* vm->mem is big-endian unless it is kept in host byte order */
+#ifdef ENABLE_HOST_ENDIAN_MEM
+#define MEM_FORMAT "H"
+#else
+#define MEM_FORMAT ">H"
+#endif
+
+static int View_getbuffer(ViewObject* self, Py_buffer* view, int flags) {
+    if (PyBuffer_FillInfo(view, (PyObject*)self, self->buf,
+                          self->len * self->itemsize, self->readonly,
+                          flags) < 0) {
+        return -1;
+    }
+    if (flags & PyBUF_FORMAT) {
+        view->format = (char*)self->format;
+    }
+    view->itemsize = self->itemsize;
+    if (flags & PyBUF_ND) {
+        view->shape = &self->len;
+    }
+    return 0;
+}
+
+static void View_dealloc(ViewObject* self) {
+    Py_XDECREF(self->owner);
+    Py_TYPE(self)->tp_free((PyObject*)self);
+}
+
+static PyBufferProcs View_as_buffer = {
+    .bf_getbuffer = (getbufferproc)View_getbuffer};
+
+static PyTypeObject ViewType = {
+    PyVarObject_HEAD_INIT(NULL, 0).tp_name = "sigma16._View",
+    .tp_doc = "Array inside an emulator, see Emulator.memory",
+    .tp_basicsize = sizeof(ViewObject),
+    .tp_itemsize = 0,
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_dealloc = (destructor)View_dealloc,
+    .tp_as_buffer = &View_as_buffer};
+
+static PyObject* export_view(PyObject* owner, void* buf, Py_ssize_t len,
+                             Py_ssize_t itemsize, const char* format,
+                             int readonly) {
+    ViewObject* view;
+    PyObject* memoryview;
+
+    if (!(view = PyObject_New(ViewObject, &ViewType))) {
+        return NULL;
+    }
+    Py_INCREF(owner);
+    view->owner = owner;
+    view->buf = buf;
+    view->len = len;
+    view->itemsize = itemsize;
+    view->format = format;
+    view->readonly = readonly;
+    memoryview = PyMemoryView_FromObject((PyObject*)view);
+    Py_DECREF(view);
+    return memoryview;
+}
+
+static PyObject* view_of(EmulatorObject* self, void* buf, Py_ssize_t len,
+                         Py_ssize_t itemsize, const char* format,
+                         int readonly) {
+    if (!self->vm) {
+        PyErr_SetString(PyExc_ValueError, "emulator is not initialised");
+        return NULL;
+    }
+    return export_view((PyObject*)self, buf, len, itemsize, format,
+                       readonly);
+}
+
 static void Emulator_dealloc(EmulatorObject* self) {
     Py_XDECREF(self->cpu);
-    Py_XDECREF(self->memory);
     Py_XDECREF(self->executable);
+    Py_XDECREF(self->trace_handler);
+    Py_XDECREF(self->batch_handler);
+    PyMem_Free(self->records);
+    if (self->vm) {
+        sigma16_vm_del(self->vm);
+    }
     Py_TYPE(self)->tp_free((PyObject*)self);
 }
 
-#ifdef ENABLE_TRACE
+/*
+ * Handler exceptions end the run at its next budget check, execute then
+ * raises them. Handlers are not called again meanwhile.
+ */
+static void call_handler(sigma16_vm_t* vm, PyObject* handler, PyObject* arg) {
+    PyObject* ret = NULL;
+
+    if (arg) {
+        /* the handler may replace itself */
+        Py_INCREF(handler);
+        ret = PyObject_CallFunctionObjArgs(handler, arg, NULL);
+        Py_DECREF(handler);
+        Py_DECREF(arg);
+    }
+    if (!ret) {
+        sigma16_vm_stop(vm);
+        return;
+    }
+    Py_DECREF(ret);
+}
+
+/* pass the buffered records to the batch handler, valid only during a call */
+static void flush_records(EmulatorObject* self) {
+    Py_ssize_t n = self->n_records;
+    PyObject *view, *ret, *type, *value, *traceback;
+
+    if (!n || PyErr_Occurred()) {
+        return;
+    }
+    /* the handler may change handlers, which flushes again */
+    self->n_records = 0;
+    view = view_of(self, self->records, n, sizeof *self->records,
+                   TRACE_RECORD_FORMAT, 1);
+    Py_XINCREF(view);
+    call_handler(self->vm, self->batch_handler, view);
+    if (view) {
+        /* fails if the handler kept an export, it then sees later records */
+        PyErr_Fetch(&type, &value, &traceback);
+        if (!(ret = PyObject_CallMethod(view, "release", NULL))) {
+            PyErr_Clear();
+        }
+        PyErr_Restore(type, value, traceback);
+        Py_XDECREF(ret);
+        Py_DECREF(view);
+    }
+}
+
+static void record(EmulatorObject* self, sigma16_vm_t* vm) {
+    struct trace_record* rec = &self->records[self->n_records];
+    uint16_t word = read_mem(vm, vm->cpu.pc);
+
+    rec->pc = vm->cpu.pc;
+    rec->word = word;
+    rec->op = word >> 12;
+    rec->d = word >> 8 & 0xf;
+    rec->sa = word >> 4 & 0xf;
+    rec->sb = word & 0xf;
+    /* RX and EXP instructions are two words long */
+    rec->disp = rec->op >= 0xe ? read_mem(vm, vm->cpu.pc + 1) : 0;
+    if (++self->n_records == self->batch_size) {
+        flush_records(self);
+    }
+}
+
 void vm_trace_compat(sigma16_vm_t* vm, enum sigma16_trace_event event) {
-    PyObject* args;
+    EmulatorObject* self = vm->vm_refl;
     PyObject* instruction;
 
+    if (event == EXEC_START || PyErr_Occurred()) {
+        return;
+    }
+    if (self->batch_handler) {
+        if (event == EXEC_END) {
+            flush_records(self);
+            return;
+        }
+        record(self, vm);
+    }
+    if (!self->trace_handler) {
+        return;
+    }
     switch (event) {
         case INST_RRR:
             instruction = Sigma16InstructionRRR_FromBytes(vm->cpu.ir.rrr);
@@ -191,84 +430,619 @@ void vm_trace_compat(sigma16_vm_t* vm, enum sigma16_trace_event event) {
         default:
             return;
     }
+    call_handler(vm, self->trace_handler, instruction);
+}
 
-    if (!((EmulatorObject*)vm->vm_refl)->trace_handler) {
-        return;
+/* the vm belongs to another thread while it runs without the GIL */
+static int check_released(EmulatorObject* self) {
+    if (self->released) {
+        PyErr_SetString(PyExc_RuntimeError, "emulator is executing");
+        return -1;
     }
+    return 0;
+}
 
-    args = PyTuple_Pack(1, instruction);
-    PyObject_CallObject(((EmulatorObject*)vm->vm_refl)->trace_handler, args);
+/* without a handler the vm runs on the untraced engines */
+static void update_trace_handler(EmulatorObject* self) {
+    if (self->vm) {
+        self->vm->trace_handler = self->trace_handler || self->batch_handler
+                                      ? vm_trace_compat
+                                      : NULL;
+    }
+}
+
+static PyObject* Emulator_get_trace_handler(EmulatorObject* self,
+                                            void* closure) {
+    PyObject* handler = self->trace_handler ? self->trace_handler : Py_None;
+
+    Py_INCREF(handler);
+    return handler;
+}
+
+/* takes effect immediately, even from within the handler */
+static int Emulator_set_trace_handler(EmulatorObject* self, PyObject* value,
+                                      void* closure) {
+    if (check_released(self) < 0) {
+        return -1;
+    }
+    if (value == Py_None) {
+        value = NULL;
+    }
+    Py_XINCREF(value);
+    Py_XSETREF(self->trace_handler, value);
+    update_trace_handler(self);
+    return 0;
+}
+
+static PyObject* Emulator_get_batch_handler(EmulatorObject* self,
+                                            void* closure) {
+    PyObject* handler = self->batch_handler ? self->batch_handler : Py_None;
+
+    Py_INCREF(handler);
+    return handler;
+}
+
+/* records buffered for the previous handler are passed to it first */
+static int Emulator_set_batch_handler(EmulatorObject* self, PyObject* value,
+                                      void* closure) {
+    if (check_released(self) < 0) {
+        return -1;
+    }
+    if (value == Py_None) {
+        value = NULL;
+    }
+    if (value && !self->records &&
+        !(self->records =
+              PyMem_Malloc(self->batch_size * sizeof *self->records))) {
+        PyErr_NoMemory();
+        return -1;
+    }
+    flush_records(self);
+    if (PyErr_Occurred()) {
+        return -1;
+    }
+    Py_XINCREF(value);
+    Py_XSETREF(self->batch_handler, value);
+    update_trace_handler(self);
+    return 0;
 }
-#endif
 
 static int Emulator_init(EmulatorObject* self, PyObject* args, PyObject* kwds) {
-#ifdef ENABLE_TRACE
-    static char* kwlist[] = {"executable", "trace_handler", NULL};
+    static char* kwlist[] = {"executable", "trace_handler", "batch_handler",
+                             "batch_size", NULL};
     PyObject* trace_handler = NULL;
-#else
-    static char* kwlist[] = {"executable", NULL};
-#endif
+    PyObject* batch_handler = NULL;
     PyObject* executable = NULL;
     PyObject* tmp;
 
-#ifdef ENABLE_TRACE
-    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|OO", kwlist, &executable,
-                                     &trace_handler)) {
+    self->batch_size = TRACE_BATCH_SIZE;
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|OOOn", kwlist, &executable,
+                                     &trace_handler, &batch_handler,
+                                     &self->batch_size)) {
         return -1;
     }
-#else
-    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|O", kwlist, &executable)) {
+    if (self->batch_size < 1) {
+        PyErr_SetString(PyExc_ValueError, "batch_size must be positive");
         return -1;
     }
-#endif
     if (executable) {
         tmp = self->executable;
         Py_INCREF(executable);
         self->executable = executable;
         Py_XDECREF(tmp);
     }
-#ifdef ENABLE_TRACE
     if (trace_handler) {
-        tmp = self->trace_handler;
-        Py_INCREF(trace_handler);
-        self->trace_handler = trace_handler;
-        Py_XDECREF(tmp);
+        Emulator_set_trace_handler(self, trace_handler, NULL);
     }
-#endif
-    const char* executable_c_str = PyUnicode_AsUTF8(executable);
-    if (sigma16_vm_init(&self->vm, executable_c_str) < 0) {
-        return PyErr_SetFromErrno(PyExc_BaseException);
+    if (batch_handler &&
+        Emulator_set_batch_handler(self, batch_handler, NULL) < 0) {
+        return -1;
+    }
+    if (executable && PyObject_TypeCheck(executable, &ImageType)) {
+        if (!((ImageObject*)executable)->image) {
+            PyErr_SetString(PyExc_ValueError, "image is not loaded");
+            return -1;
+        }
+        /* the image is mapped, not copied */
+        if (sigma16_vm_init_image(&self->vm,
+                                  ((ImageObject*)executable)->image) < 0) {
+            PyErr_SetFromErrno(PyExc_BaseException);
+            return -1;
+        }
+    } else {
+        const char* executable_c_str = PyUnicode_AsUTF8(executable);
+        if (sigma16_vm_init(&self->vm, (char*)executable_c_str) < 0) {
+            PyErr_SetFromErrno(PyExc_BaseException);
+            return -1;
+        }
     }
-#ifdef ENABLE_TRACE
     self->vm->vm_refl = self;
-    self->vm->trace_handler = vm_trace_compat;
-#endif
+    update_trace_handler(self);
     return 0;
 }
 
+/* writes would bypass the decoded code caches, so memory is read-only */
+static PyObject* Emulator_get_memory(EmulatorObject* self, void* closure) {
+    return view_of(self, self->vm ? self->vm->mem : NULL, 1 << 16,
+                   sizeof(uint16_t), MEM_FORMAT, 1);
+}
+
+/* read-only too, set_register keeps R0 at 0 and waits for runs to end */
+static PyObject* Emulator_get_registers(EmulatorObject* self,
+                                        void* closure) {
+    return view_of(self, self->vm ? self->vm->cpu.regs : NULL,
+                   sizeof self->vm->cpu.regs / sizeof *self->vm->cpu.regs,
+                   sizeof(uint16_t), "H", 1);
+}
+
+static PyObject* Emulator_get_pc(EmulatorObject* self, void* closure) {
+    return PyLong_FromLong(self->vm ? self->vm->cpu.pc : 0);
+}
+
+static int Emulator_set_pc(EmulatorObject* self, PyObject* value,
+                           void* closure) {
+    long pc;
+
+    if (!value) {
+        PyErr_SetString(PyExc_AttributeError, "pc cannot be deleted");
+        return -1;
+    }
+    if (!self->vm) {
+        PyErr_SetString(PyExc_ValueError, "emulator is not initialised");
+        return -1;
+    }
+    if (check_released(self) < 0) {
+        return -1;
+    }
+    if ((pc = PyLong_AsLong(value)) == -1 && PyErr_Occurred()) {
+        return -1;
+    }
+    self->vm->cpu.pc = pc;
+    return 0;
+}
+
+static PyObject* Emulator_get_stop_reason(EmulatorObject* self,
+                                          void* closure) {
+    if (!self->stop_reason) {
+        Py_RETURN_NONE;
+    }
+    return PyUnicode_FromString(self->stop_reason);
+}
+
+static PyObject* Emulator_get_watch_address(EmulatorObject* self,
+                                            void* closure) {
+    if (!self->stop_reason || strcmp(self->stop_reason, "watchpoint")) {
+        Py_RETURN_NONE;
+    }
+    return PyLong_FromLong(self->vm->watch_hit);
+}
+
+static PyObject* Emulator_get_icount(EmulatorObject* self, void* closure) {
+    return PyLong_FromUnsignedLongLong(self->vm ? self->vm->icount : 0);
+}
+
 static PyMemberDef Emulator_members[] = {
     {"cpu", T_OBJECT_EX, offsetof(EmulatorObject, cpu), 0, "sigma16 CPU"},
-    {"memory", T_OBJECT_EX, offsetof(EmulatorObject, memory), 0,
-     "sigma16 emulator memory view"},
     {"executable", T_OBJECT_EX, offsetof(EmulatorObject, executable), 0,
      "executable filename"},
-#ifdef ENABLE_TRACE
-    {"trace_handler", T_OBJECT_EX, offsetof(EmulatorObject, trace_handler), 0,
-#endif
-     "function handler for tracing"},
     {NULL}};
 
-static PyObject* Emulator_execute(EmulatorObject* self,
-                                  PyObject* Py_UNUSED(ignored)) {
-    if (sigma16_vm_exec(self->vm) < 0) {
+static PyGetSetDef Emulator_getset[] = {
+    {"trace_handler", (getter)Emulator_get_trace_handler,
+     (setter)Emulator_set_trace_handler,
+     "function handler for tracing, None to run untraced", NULL},
+    {"batch_handler", (getter)Emulator_get_batch_handler,
+     (setter)Emulator_set_batch_handler,
+     "function handler for batches of trace records, None to run untraced",
+     NULL},
+    {"memory", (getter)Emulator_get_memory, NULL,
+     "read-only memoryview of the 65536 memory words, without copying", NULL},
+    {"registers", (getter)Emulator_get_registers, NULL,
+     "read-only memoryview of R0-R15, see set_register", NULL},
+    {"pc", (getter)Emulator_get_pc, (setter)Emulator_set_pc,
+     "program counter", NULL},
+    {"icount", (getter)Emulator_get_icount, NULL, "instructions executed",
+     NULL},
+    {"stop_reason", (getter)Emulator_get_stop_reason, NULL,
+     "why the last run stopped: halted, budget, breakpoint, watchpoint or "
+     "error",
+     NULL},
+    {"watch_address", (getter)Emulator_get_watch_address, NULL,
+     "address of the access which stopped the last run at a watchpoint",
+     NULL},
+    {NULL}};
+
+/* marks the emulator running, only one thread may execute it at a time */
+static int start_running(EmulatorObject* self) {
+    if (!self->vm) {
+        PyErr_SetString(PyExc_ValueError, "emulator is not initialised");
+        return -1;
+    }
+    if (self->running) {
+        PyErr_SetString(PyExc_RuntimeError, "emulator is already executing");
+        return -1;
+    }
+    self->running = 1;
+    /* without handlers, nothing calls back into Python during the run */
+    self->released = !self->trace_handler && !self->batch_handler;
+    return 0;
+}
+
+static int exec_vm(sigma16_vm_t* vm, unsigned long long steps) {
+    return steps ? sigma16_vm_step(vm, steps) : sigma16_vm_exec(vm);
+}
+
+/*
+ * Execute exactly steps instructions, or within the budget if steps is 0.
+ * True once the program halts, False if it stopped for any other reason.
+ */
+static PyObject* run(EmulatorObject* self, unsigned long long steps,
+                     unsigned long long max_instructions, double timeout) {
+    int ret;
+
+    sigma16_vm_set_budget(self->vm, max_instructions, timeout);
+    if (!self->released) {
+        ret = exec_vm(self->vm, steps);
+    } else {
+        Py_BEGIN_ALLOW_THREADS
+        ret = exec_vm(self->vm, steps);
+        Py_END_ALLOW_THREADS
+        self->released = 0;
+    }
+    self->running = 0;
+    if (ret < 0) {
+        self->stop_reason = "error";
         return PyErr_SetFromErrno(PyExc_BaseException);
     }
+    switch (ret) {
+        case SIGMA16_EXEC_BUDGET:
+            self->stop_reason = "budget";
+            break;
+        case SIGMA16_EXEC_BREAK:
+            self->stop_reason = "breakpoint";
+            break;
+        case SIGMA16_EXEC_WATCH:
+            self->stop_reason = "watchpoint";
+            break;
+        default:
+            self->stop_reason = "halted";
+    }
+    /* runs stopped by the budget never reach EXEC_END */
+    if (self->batch_handler) {
+        flush_records(self);
+    }
+    /* or by a handler exception */
+    if (PyErr_Occurred()) {
+        return NULL;
+    }
+    return PyBool_FromLong(ret == 0);
+}
+
+static PyObject* Emulator_execute(EmulatorObject* self, PyObject* args,
+                                  PyObject* kwds) {
+    static char* kwlist[] = {"max_instructions", "timeout", NULL};
+    unsigned long long max_instructions = 0;
+    double timeout = 0;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|Kd", kwlist,
+                                     &max_instructions, &timeout) ||
+        start_running(self) < 0) {
+        return NULL;
+    }
+    return run(self, 0, max_instructions, timeout);
+}
+
+static PyObject* Emulator_step(EmulatorObject* self, PyObject* args) {
+    unsigned long long n = 1;
+
+    if (!PyArg_ParseTuple(args, "|K", &n) || start_running(self) < 0) {
+        return NULL;
+    }
+    return run(self, n, 0, 0);
+}
+
+/* a breakpoint at pc for the length of the run */
+static PyObject* Emulator_run_until(EmulatorObject* self, PyObject* args,
+                                    PyObject* kwds) {
+    static char* kwlist[] = {"pc", "max_instructions", "timeout", NULL};
+    unsigned long long max_instructions = 0;
+    double timeout = 0;
+    unsigned short pc;
+    PyObject* ret;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "H|Kd", kwlist, &pc,
+                                     &max_instructions, &timeout) ||
+        start_running(self) < 0) {
+        return NULL;
+    }
+    if (sigma16_vm_add_breakpoint(self->vm, pc, NULL) < 0) {
+        self->running = self->released = 0;
+        return PyErr_NoMemory();
+    }
+    ret = run(self, 0, max_instructions, timeout);
+    /* the last one added at pc, any others stay */
+    sigma16_vm_remove_breakpoint(self->vm, pc);
+    return ret;
+}
+
+static int check_points(EmulatorObject* self) {
+    if (check_released(self) < 0) {
+        return -1;
+    }
+    if (!self->vm) {
+        PyErr_SetString(PyExc_ValueError, "emulator is not initialised");
+        return -1;
+    }
+    return 0;
+}
+
+static PyObject* Emulator_add_breakpoint(EmulatorObject* self, PyObject* args,
+                                         PyObject* kwds) {
+    static char* kwlist[] = {"addr", "condition", NULL};
+    struct sigma16_expr* cond = NULL;
+    const char* src = NULL;
+    const char* error;
+    unsigned short addr;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "H|z", kwlist, &addr,
+                                     &src) ||
+        check_points(self) < 0) {
+        return NULL;
+    }
+    if (src && !(cond = sigma16_expr_compile(src, &error))) {
+        PyErr_Format(PyExc_ValueError, "invalid condition: %s", error);
+        return NULL;
+    }
+    if (sigma16_vm_add_breakpoint(self->vm, addr, cond) < 0) {
+        free(cond);
+        return PyErr_NoMemory();
+    }
+    Py_RETURN_NONE;
+}
+
+static PyObject* Emulator_set_register(EmulatorObject* self,
+                                       PyObject* args) {
+    unsigned char reg;
+    unsigned short value;
+
+    if (!PyArg_ParseTuple(args, "bH", &reg, &value) ||
+        check_points(self) < 0) {
+        return NULL;
+    }
+    if (reg > 15) {
+        PyErr_SetString(PyExc_ValueError, "no such register");
+        return NULL;
+    }
+    if (!reg && value) {
+        PyErr_SetString(PyExc_ValueError, "R0 is always 0");
+        return NULL;
+    }
+    self->vm->cpu.regs[reg] = value;
+    Py_RETURN_NONE;
+}
+
+static PyObject* Emulator_remove_breakpoint(EmulatorObject* self,
+                                            PyObject* args) {
+    unsigned short addr;
+
+    if (!PyArg_ParseTuple(args, "H", &addr) || check_points(self) < 0) {
+        return NULL;
+    }
+    sigma16_vm_remove_breakpoint(self->vm, addr);
+    Py_RETURN_NONE;
+}
+
+static PyObject* Emulator_add_watchpoint(EmulatorObject* self, PyObject* args,
+                                         PyObject* kwds) {
+    static char* kwlist[] = {"addr", "length", "access", NULL};
+    unsigned short addr;
+    unsigned int length = 1;
+    const char* access = "w";
+    int kind;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "H|Is", kwlist, &addr,
+                                     &length, &access) ||
+        check_points(self) < 0) {
+        return NULL;
+    }
+    if (!strcmp(access, "r")) {
+        kind = WATCH_READ;
+    } else if (!strcmp(access, "w")) {
+        kind = WATCH_WRITE;
+    } else if (!strcmp(access, "rw")) {
+        kind = WATCH_READ | WATCH_WRITE;
+    } else {
+        PyErr_SetString(PyExc_ValueError, "access must be r, w or rw");
+        return NULL;
+    }
+    if (!length || addr + length > 0x10000) {
+        PyErr_SetString(PyExc_ValueError, "watched range is outside memory");
+        return NULL;
+    }
+    if (sigma16_vm_add_watchpoint(self->vm, addr, addr + length - 1, kind) <
+        0) {
+        return PyErr_NoMemory();
+    }
+    Py_RETURN_NONE;
+}
+
+static PyObject* Emulator_remove_watchpoint(EmulatorObject* self,
+                                            PyObject* args) {
+    unsigned short addr;
+
+    if (!PyArg_ParseTuple(args, "H", &addr) || check_points(self) < 0) {
+        return NULL;
+    }
+    sigma16_vm_remove_watchpoint(self->vm, addr);
+    Py_RETURN_NONE;
+}
+
+/* an execute_async call, owned by its worker thread */
+struct async_run {
+    EmulatorObject* emulator;
+    PyObject* loop;
+    PyObject* future;
+    unsigned long long max_instructions;
+    double timeout;
+};
+
+/* runs on the event loop, the future may have been cancelled meanwhile */
+static PyObject* resolve(PyObject* module, PyObject* args) {
+    PyObject *future, *result, *exception, *done;
+    int is_done;
+
+    if (!PyArg_ParseTuple(args, "OOO", &future, &result, &exception) ||
+        !(done = PyObject_CallMethod(future, "done", NULL))) {
+        return NULL;
+    }
+    is_done = PyObject_IsTrue(done);
+    Py_DECREF(done);
+    if (is_done) {
+        Py_RETURN_NONE;
+    }
+    return exception != Py_None
+               ? PyObject_CallMethod(future, "set_exception", "O", exception)
+               : PyObject_CallMethod(future, "set_result", "O", result);
+}
+
+static PyMethodDef resolve_def = {"_resolve", resolve, METH_VARARGS, NULL};
+
+static void async_worker(void* arg) {
+    struct async_run* job = arg;
+    PyGILState_STATE gil = PyGILState_Ensure();
+    PyObject *result, *callback, *type, *exception = NULL, *traceback, *ret;
+
+    /* run releases the GIL again unless there is a trace handler */
+    if (!(result = run(job->emulator, 0, job->max_instructions,
+                       job->timeout))) {
+        PyErr_Fetch(&type, &exception, &traceback);
+        PyErr_NormalizeException(&type, &exception, &traceback);
+        Py_XDECREF(type);
+        Py_XDECREF(traceback);
+    }
+    if (!(callback = PyCFunction_New(&resolve_def, NULL)) ||
+        !(ret = PyObject_CallMethod(job->loop, "call_soon_threadsafe", "OOOO",
+                                    callback, job->future,
+                                    result ? result : Py_None,
+                                    exception ? exception : Py_None))) {
+        /* e.g. the loop was closed, nobody is waiting for the result */
+        PyErr_WriteUnraisable(job->future);
+    } else {
+        Py_DECREF(ret);
+    }
+    Py_XDECREF(callback);
+    Py_XDECREF(result);
+    Py_XDECREF(exception);
+    Py_DECREF(job->future);
+    Py_DECREF(job->loop);
+    Py_DECREF(job->emulator);
+    PyMem_Free(job);
+    PyGILState_Release(gil);
+}
+
+/* a future resolved like execute, which runs on a native worker thread */
+static PyObject* Emulator_execute_async(EmulatorObject* self, PyObject* args,
+                                        PyObject* kwds) {
+    static char* kwlist[] = {"max_instructions", "timeout", NULL};
+    unsigned long long max_instructions = 0;
+    double timeout = 0;
+    struct async_run* job;
+    PyObject *asyncio, *loop, *future;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|Kd", kwlist,
+                                     &max_instructions, &timeout)) {
+        return NULL;
+    }
+    if (!(asyncio = PyImport_ImportModule("asyncio"))) {
+        return NULL;
+    }
+    loop = PyObject_CallMethod(asyncio, "get_running_loop", NULL);
+    Py_DECREF(asyncio);
+    if (!loop) {
+        return NULL;
+    }
+    if (!(future = PyObject_CallMethod(loop, "create_future", NULL))) {
+        Py_DECREF(loop);
+        return NULL;
+    }
+    if (!(job = PyMem_Malloc(sizeof *job))) {
+        Py_DECREF(future);
+        Py_DECREF(loop);
+        return PyErr_NoMemory();
+    }
+    if (start_running(self) < 0) {
+        PyMem_Free(job);
+        Py_DECREF(future);
+        Py_DECREF(loop);
+        return NULL;
+    }
+    Py_INCREF(self);
+    Py_INCREF(future);
+    job->emulator = self;
+    job->loop = loop;
+    job->future = future;
+    job->max_instructions = max_instructions;
+    job->timeout = timeout;
+    if (PyThread_start_new_thread(async_worker, job) ==
+        PYTHREAD_INVALID_THREAD_ID) {
+        self->running = self->released = 0;
+        Py_DECREF(self);
+        Py_DECREF(future);
+        Py_DECREF(loop);
+        PyMem_Free(job);
+        Py_DECREF(future);
+        PyErr_SetString(PyExc_RuntimeError, "unable to start worker thread");
+        return NULL;
+    }
+    return future;
+}
+
+static PyObject* Emulator_set_input(EmulatorObject* self, PyObject* args) {
+    Py_buffer data;
+    int ret;
+
+    if (check_released(self) < 0 || !PyArg_ParseTuple(args, "y*", &data)) {
+        return NULL;
+    }
+    ret = sigma16_io_set_input(self->vm, data.buf, data.len);
+    PyBuffer_Release(&data);
+    if (ret < 0) {
+        return PyErr_NoMemory();
+    }
     Py_RETURN_NONE;
 }
 
 static PyMethodDef Emulator_methods[] = {
-    {"execute", (PyCFunction)Emulator_execute, METH_NOARGS,
-     "Read and execute filename held in executable instance attribute"},
+    {"execute", (PyCFunction)Emulator_execute, METH_VARARGS | METH_KEYWORDS,
+     "Execute the program, at most max_instructions or timeout seconds if "
+     "given. Returns False if it stopped early, execute again to resume. "
+     "The GIL is released unless there is a trace handler"},
+    {"execute_async", (PyCFunction)Emulator_execute_async,
+     METH_VARARGS | METH_KEYWORDS,
+     "Like execute, but runs on a worker thread. Returns an asyncio future "
+     "of the result, must be called from a running event loop"},
+    {"step", (PyCFunction)Emulator_step, METH_VARARGS,
+     "Execute exactly n instructions, 1 by default, unless the program "
+     "stops first. Returns True once the program halts"},
+    {"run_until", (PyCFunction)Emulator_run_until,
+     METH_VARARGS | METH_KEYWORDS,
+     "Execute until pc is reached, like execute with a breakpoint at pc"},
+    {"set_register", (PyCFunction)Emulator_set_register, METH_VARARGS,
+     "Set a register, not while the emulator is executing. R0 stays 0"},
+    {"add_breakpoint", (PyCFunction)Emulator_add_breakpoint,
+     METH_VARARGS | METH_KEYWORDS,
+     "Stop before executing the instruction at an address, if the optional "
+     "condition holds, e.g. \"R3 == 10 && m[R1 + 2] != 0\""},
+    {"remove_breakpoint", (PyCFunction)Emulator_remove_breakpoint,
+     METH_VARARGS, "Remove the breakpoint at an address added last"},
+    {"add_watchpoint", (PyCFunction)Emulator_add_watchpoint,
+     METH_VARARGS | METH_KEYWORDS,
+     "Stop after accesses to length words from an address, access is r, w "
+     "(the default) or rw"},
+    {"remove_watchpoint", (PyCFunction)Emulator_remove_watchpoint,
+     METH_VARARGS, "Remove the watchpoints starting at an address"},
+    {"set_input", (PyCFunction)Emulator_set_input, METH_VARARGS,
+     "Bytes consumed by read traps instead of stdin"},
     {NULL}};
 
 static PyTypeObject EmulatorType = {
@@ -281,13 +1055,93 @@ static PyTypeObject EmulatorType = {
     .tp_init = (initproc)Emulator_init,
     .tp_dealloc = (destructor)Emulator_dealloc,
     .tp_members = Emulator_members,
+    .tp_getset = Emulator_getset,
     .tp_methods = Emulator_methods};
 
+/* a memoryview of disasm records, see disasm.h */
+static PyObject* disassemble(PyObject* module, PyObject* args,
+                             PyObject* kwds) {
+    static char* kwlist[] = {"buffer", "entry", "linear", NULL};
+    Py_buffer data;
+    unsigned short entry = 0;
+    int linear = 0;
+    void* words;
+    size_t n_words;
+    PyObject *records, *view;
+    ssize_t n;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "y*|Hp", kwlist, &data,
+                                     &entry, &linear)) {
+        return NULL;
+    }
+    n_words = data.len >> 1;
+    if (!(records = PyBytes_FromStringAndSize(
+              NULL, n_words * sizeof(struct sigma16_disasm_rec)))) {
+        PyBuffer_Release(&data);
+        return NULL;
+    }
+    words = data.buf;
+    /* slices of other buffers may start at any byte */
+    if ((uintptr_t)words & 1 && !(words = PyMem_Malloc(data.len))) {
+        PyBuffer_Release(&data);
+        Py_DECREF(records);
+        return PyErr_NoMemory();
+    }
+    if (words != data.buf) {
+        memcpy(words, data.buf, data.len);
+    }
+    Py_BEGIN_ALLOW_THREADS;
+    n = sigma16_disasm(words, n_words, entry,
+                       DISASM_BIG_ENDIAN | (linear ? DISASM_LINEAR : 0),
+                       (struct sigma16_disasm_rec*)PyBytes_AS_STRING(records));
+    Py_END_ALLOW_THREADS;
+    if (words != data.buf) {
+        PyMem_Free(words);
+    }
+    PyBuffer_Release(&data);
+    if (n < 0) {
+        Py_DECREF(records);
+        return PyErr_NoMemory();
+    }
+    if (_PyBytes_Resize(&records, n * sizeof(struct sigma16_disasm_rec)) <
+        0) {
+        return NULL;
+    }
+    view = export_view(records, PyBytes_AS_STRING(records), n,
+                       sizeof(struct sigma16_disasm_rec), DISASM_REC_FORMAT,
+                       1);
+    Py_DECREF(records);
+    return view;
+}
+
+static PyObject* format_instruction(PyObject* module, PyObject* args) {
+    struct sigma16_disasm_rec rec;
+    unsigned short word;
+    unsigned short disp = 0;
+    char buf[64];
+
+    if (!PyArg_ParseTuple(args, "H|H", &word, &disp)) {
+        return NULL;
+    }
+    sigma16_disasm_decode(word, disp, &rec);
+    sigma16_disasm_format(buf, sizeof buf, &rec);
+    return PyUnicode_FromString(buf);
+}
+
+static PyMethodDef sigma16_methods[] = {
+    {"disassemble", (PyCFunction)disassemble, METH_VARARGS | METH_KEYWORDS,
+     "Decode the big-endian words of an executable into a memoryview of "
+     "records, telling code from data by following jumps from entry"},
+    {"format_instruction", format_instruction, METH_VARARGS,
+     "Assembler text of the instruction starting with word"},
+    {NULL}};
+
 static PyModuleDef sigma16_module = {
     PyModuleDef_HEAD_INIT,
     .m_name = "sigma16",
     .m_doc = "Sigma16 interfacing layer",
     .m_size = -1,
+    .m_methods = sigma16_methods,
 };
 
 PyMODINIT_FUNC PyInit_sigma16(void) {
@@ -295,6 +1149,12 @@ PyMODINIT_FUNC PyInit_sigma16(void) {
     if (PyType_Ready(&EmulatorType) < 0) {
         return NULL;
     }
+    if (PyType_Ready(&ViewType) < 0) {
+        return NULL;
+    }
+    if (PyType_Ready(&ImageType) < 0) {
+        return NULL;
+    }
     if (PyType_Ready(&InstructionRRRType) < 0) {
         return NULL;
     }
@@ -316,6 +1176,13 @@ PyMODINIT_FUNC PyInit_sigma16(void) {
         Py_DECREF(m);
         return NULL;
     }
+    Py_INCREF(&ImageType);
+    if (PyModule_AddObject(m, "Image", (PyObject*)&ImageType) < 0) {
+        Py_DECREF(&ImageType);
+        Py_DECREF(&EmulatorType);
+        Py_DECREF(m);
+        return NULL;
+    }
     Py_INCREF(&InstructionRRRType);
     if (PyModule_AddObject(m, "InstructionRRR",
                            (PyObject*)&InstructionRRRType) < 0) {
@@ -0,0 +1,380 @@
+#include "tailcall.h"
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "config.h"
+#include "cpu.h"
+#include "instructions.h"
+#include "ops.h"
+#include "vm.h"
+
+#ifdef ENABLE_FLIGHT_RECORDER
+#include "tracing.h"
+#endif
+
+#ifdef HAVE_TAILCALL
+
+/*
+ * Handlers share the interpreter's decode cache, vm->decoded, with their
+ * offset from tc_predecode in place of a label's. The engine only runs
+ * untraced and unprofiled, without breakpoints, watchpoints or history
+ * (see sigma16_vm_exec), so handlers have none of those checks.
+ *
+ * pc and icount are only stored back into the vm when something outside
+ * the handlers may look at them: budget checks, EXP instructions and the
+ * end of the run. Like the interpreter, the budget (and so interrupts) is
+ * checked after taken branches and before instructions whose successor
+ * wraps around memory.
+ */
+
+#ifdef HAVE_MUSTTAIL
+#define MUSTTAIL __attribute__((musttail))
+#else
+#define MUSTTAIL
+/* GCC only turns sibling calls into jumps from -O2, whatever the build */
+#pragma GCC optimize("O2")
+#endif
+
+#define TC_PARAMS                                            \
+    sigma16_vm_t* vm, sigma16_reg_t* regs, uint16_t* mem,    \
+        sigma16_decoded_t* decoded, uint16_t pc, uint64_t icount
+#define TC_ARGS vm, regs, mem, decoded, pc, icount
+
+typedef int tc_handler(TC_PARAMS);
+
+static tc_handler tc_predecode;
+
+#define HANDLER_AT(offset) \
+    ((tc_handler*)((uintptr_t)tc_predecode + (offset)))
+#define HANDLER_OFFSET(fn) \
+    ((int32_t)((uintptr_t)(fn) - (uintptr_t)tc_predecode))
+
+#define DISPATCH()                                                \
+    do {                                                          \
+        icount++;                                                 \
+        MUSTTAIL return HANDLER_AT(decoded[pc].handler)(TC_ARGS); \
+    } while (0)
+
+/* make pc and icount visible to the rest of the vm */
+#define SYNC()            \
+    vm->cpu.pc = pc;      \
+    vm->icount = icount
+
+#define CHECK_BUDGET()                                        \
+    if (__builtin_expect(icount >= vm->next_check, 0)) {      \
+        SYNC();                                               \
+        if (sigma16_vm_budget_check(vm)) {                    \
+            return SIGMA16_EXEC_BUDGET;                       \
+        }                                                     \
+        pc = vm->cpu.pc;                                      \
+    }
+
+#ifdef ENABLE_FLIGHT_RECORDER
+#define RECORD()                                                         \
+    flight_record(vm, pc, decoded[pc].d, decoded[pc].sa, decoded[pc].sb, \
+                  decoded[pc].disp)
+#else
+#define RECORD()
+#endif
+
+#define UPDATE(dst, val)     \
+    if ((dst) != 0) {        \
+        regs[dst] = (val);   \
+    }
+
+#define RX_EADDR() (vm->cpu.adr = regs[inst->sa] + inst->disp)
+
+/* the logic and comparison ops, which clear the flags */
+#define TC_RRR(name, op)                                      \
+    static int name(TC_PARAMS) {                              \
+        sigma16_decoded_t* inst = &decoded[pc];               \
+                                                              \
+        RECORD();                                             \
+        UPDATE(inst->d, regs[inst->sa] op regs[inst->sb]);    \
+        CLEARFLAGS(regs[15]);                                 \
+        pc += 1;                                              \
+        DISPATCH();                                           \
+    }
+
+#define TC_JUMP_IF(name, cond)                        \
+    static int name(TC_PARAMS) {                      \
+        sigma16_decoded_t* inst = &decoded[pc];       \
+                                                      \
+        RECORD();                                     \
+        if (cond) {                                   \
+            pc = RX_EADDR();                          \
+            CHECK_BUDGET();                           \
+        } else {                                      \
+            pc += 2;                                  \
+        }                                             \
+        DISPATCH();                                   \
+    }
+
+static int tc_add(TC_PARAMS) {
+    sigma16_decoded_t* inst = &decoded[pc];
+
+    RECORD();
+    UPDATE(inst->d, regs[inst->sa] + regs[inst->sb]);
+    op_add_flags(vm, inst->d);
+    pc += 1;
+    DISPATCH();
+}
+
+static int tc_sub(TC_PARAMS) {
+    sigma16_decoded_t* inst = &decoded[pc];
+
+    RECORD();
+    UPDATE(inst->d, regs[inst->sa] - regs[inst->sb]);
+    pc += 1;
+    DISPATCH();
+}
+
+static int tc_mul(TC_PARAMS) {
+    sigma16_decoded_t* inst = &decoded[pc];
+
+    RECORD();
+    UPDATE(inst->d, regs[inst->sa] * regs[inst->sb]);
+    pc += 1;
+    DISPATCH();
+}
+
+static int tc_div(TC_PARAMS) {
+    sigma16_decoded_t* inst = &decoded[pc];
+
+    RECORD();
+    op_div(vm, inst->d, inst->sa, inst->sb);
+    pc += 1;
+    DISPATCH();
+}
+
+static int tc_cmp(TC_PARAMS) {
+    sigma16_decoded_t* inst = &decoded[pc];
+
+    RECORD();
+    op_cmp(vm, regs[inst->sa], regs[inst->sb]);
+    pc += 1;
+    DISPATCH();
+}
+
+TC_RRR(tc_cmplt, <)
+TC_RRR(tc_cmpeq, ==)
+TC_RRR(tc_cmpgt, >)
+TC_RRR(tc_and, &)
+TC_RRR(tc_or, |)
+TC_RRR(tc_xor, ^)
+
+static int tc_inv(TC_PARAMS) {
+    sigma16_decoded_t* inst = &decoded[pc];
+
+    RECORD();
+    UPDATE(inst->d, ~regs[inst->sa]);
+    CLEARFLAGS(regs[15]);
+    pc += 1;
+    DISPATCH();
+}
+
+static int tc_nop(TC_PARAMS) {
+    RECORD();
+    CLEARFLAGS(regs[15]);
+    pc += 1;
+    DISPATCH();
+}
+
+static int tc_trap(TC_PARAMS) {
+    sigma16_decoded_t* inst = &decoded[pc];
+
+    RECORD();
+    switch (regs[inst->d]) {
+        case 0:
+            SYNC();
+            return 0;
+        case 1:
+            trap_read(vm, inst->sa, inst->sb);
+            break;
+        case 2:
+            trap_write(vm, inst->sa, inst->sb);
+            break;
+    }
+    CLEARFLAGS(regs[15]);
+    pc += 1;
+    DISPATCH();
+}
+
+static int tc_rfi(TC_PARAMS) {
+    RECORD();
+    sigma16_vm_rfi(vm);
+    pc = vm->cpu.pc;
+    CHECK_BUDGET();
+    DISPATCH();
+}
+
+static int tc_getctl(TC_PARAMS) {
+    sigma16_decoded_t* inst = &decoded[pc];
+
+    RECORD();
+    SYNC();
+    UPDATE(inst->d, sigma16_vm_getctl(vm, inst->disp >> 12));
+    pc += 2;
+    DISPATCH();
+}
+
+static int tc_putctl(TC_PARAMS) {
+    sigma16_decoded_t* inst = &decoded[pc];
+
+    RECORD();
+    SYNC();
+    sigma16_vm_putctl(vm, inst->disp >> 12, regs[inst->d]);
+    pc += 2;
+    DISPATCH();
+}
+
+static int tc_shiftl(TC_PARAMS) {
+    sigma16_decoded_t* inst = &decoded[pc];
+
+    RECORD();
+    UPDATE(inst->d, regs[inst->disp >> 12] << (inst->disp & 0xf));
+    pc += 2;
+    DISPATCH();
+}
+
+static int tc_shiftr(TC_PARAMS) {
+    sigma16_decoded_t* inst = &decoded[pc];
+
+    RECORD();
+    UPDATE(inst->d, regs[inst->disp >> 12] >> (inst->disp & 0xf));
+    pc += 2;
+    DISPATCH();
+}
+
+static int tc_lea(TC_PARAMS) {
+    sigma16_decoded_t* inst = &decoded[pc];
+
+    RECORD();
+    UPDATE(inst->d, RX_EADDR());
+    pc += 2;
+    DISPATCH();
+}
+
+static int tc_load(TC_PARAMS) {
+    sigma16_decoded_t* inst = &decoded[pc];
+
+    RECORD();
+    UPDATE(inst->d, MEM_SWAP(mem[RX_EADDR()]));
+    pc += 2;
+    DISPATCH();
+}
+
+static int tc_store(TC_PARAMS) {
+    sigma16_decoded_t* inst = &decoded[pc];
+
+    RECORD();
+    write_mem(vm, RX_EADDR(), regs[inst->d]);
+    pc += 2;
+    DISPATCH();
+}
+
+static int tc_jump(TC_PARAMS) {
+    sigma16_decoded_t* inst = &decoded[pc];
+
+    RECORD();
+    pc = RX_EADDR();
+    CHECK_BUDGET();
+    DISPATCH();
+}
+
+TC_JUMP_IF(tc_jumpc0, !select_bit(regs[15], inst->d))
+TC_JUMP_IF(tc_jumpc1, select_bit(regs[15], inst->d))
+TC_JUMP_IF(tc_jumpf, !regs[inst->d])
+TC_JUMP_IF(tc_jumpt, regs[inst->d])
+
+static int tc_jal(TC_PARAMS) {
+    sigma16_decoded_t* inst = &decoded[pc];
+
+    RECORD();
+    UPDATE(inst->d, pc + 2);
+    pc = RX_EADDR();
+    CHECK_BUDGET();
+    DISPATCH();
+}
+
+static int tc_bad_op(TC_PARAMS) {
+    SYNC();
+    fprintf(stderr, "invalid opcode: pc=%04x\n", pc);
+#ifdef ENABLE_FLIGHT_RECORDER
+    RECORD();
+    dump_flight_recorder(stderr, vm);
+#endif
+    return -1;
+}
+
+/* instructions whose successor wraps, see the interpreter's do_wrap */
+static int tc_wrap(TC_PARAMS) {
+    uint16_t at = pc;
+
+    /* not executed yet, which snapshots taken by the check rely on */
+    icount--;
+    CHECK_BUDGET();
+    if (pc != at) {
+        /* the check took an interrupt instead */
+        DISPATCH();
+    }
+    icount++;
+    MUSTTAIL return tc_predecode(TC_ARGS);
+}
+
+static tc_handler* const rrr_table[] = {
+    tc_add, tc_sub, tc_mul, tc_div, tc_cmp, tc_cmplt, tc_cmpeq,
+    tc_cmpgt, tc_inv, tc_and, tc_or, tc_xor, tc_nop, tc_trap};
+
+static tc_handler* const exp_table[] = {tc_rfi, tc_getctl, tc_putctl,
+                                        tc_shiftl, tc_shiftr};
+
+static tc_handler* const rx_table[] = {
+    tc_lea,    tc_load,   tc_store,  tc_jump,   tc_jumpc0, tc_jumpc1,
+    tc_jumpf,  tc_jumpt,  tc_jal,    tc_bad_op, tc_bad_op, tc_bad_op,
+    tc_bad_op, tc_bad_op, tc_bad_op, tc_bad_op};
+
+static int tc_predecode(TC_PARAMS) {
+    sigma16_decoded_t* inst = &decoded[pc];
+    uint16_t word = MEM_SWAP(mem[pc]);
+    tc_handler* handler;
+
+    inst->d = (word >> 8) & 0xf;
+    inst->sa = (word >> 4) & 0xf;
+    inst->sb = word & 0xf;
+    inst->op = word >> 12;
+
+    switch (word >> 12) {
+        case 0xe:
+            inst->disp = MEM_SWAP(mem[(uint16_t)(pc + 1)]);
+            inst->op = word & 0xff;
+            handler = (word & 0xff) < sizeof exp_table / sizeof *exp_table
+                          ? exp_table[word & 0xff]
+                          : tc_bad_op;
+            break;
+        case 0xf:
+            inst->disp = MEM_SWAP(mem[(uint16_t)(pc + 1)]);
+            inst->op = inst->sb;
+            handler = rx_table[inst->sb];
+            break;
+        default:
+            handler = rrr_table[word >> 12];
+    }
+    /* tc_wrap comes back here every time, so leave it in place */
+    inst->handler = pc + (word >> 12 >= 0xe ? 2 : 1) > 0xffff
+                        ? HANDLER_OFFSET(tc_wrap)
+                        : HANDLER_OFFSET(handler);
+    MUSTTAIL return handler(TC_ARGS);
+}
+
+/* runs until the program halts, fails or runs out of budget */
+int sigma16_tailcall_exec(sigma16_vm_t* vm) {
+    uint16_t pc = vm->cpu.pc;
+
+    return HANDLER_AT(vm->decoded[pc].handler)(vm, vm->cpu.regs, vm->mem,
+                                                vm->decoded, pc,
+                                                vm->icount + 1);
+}
+
+#endif
@@ -0,0 +1,27 @@
+#pragma once
+#include "config.h"
+#include "vm.h"
+
+/*
+ * Tail-call threaded interpreter, see --engine=tailcall. Every instruction
+ * has a handler function of its own which ends by calling the next one,
+ * with pc, the register file, memory and the decode cache passed as
+ * arguments so that they live in host registers across the whole run.
+ *
+ * The calls must be compiled to jumps, or every instruction would take a
+ * stack frame. Compilers with musttail guarantee it; GCC before 15 has no
+ * such attribute but turns them into jumps at -O2, which tailcall.c asks
+ * for whatever the build's own level. Other compilers run --engine=tailcall
+ * on the interpreter instead.
+ */
+#if defined(__has_attribute)
+#if __has_attribute(musttail)
+#define HAVE_MUSTTAIL
+#endif
+#endif
+
+#if defined(HAVE_MUSTTAIL) || (defined(__GNUC__) && !defined(__clang__))
+#define HAVE_TAILCALL
+#endif
+
+int sigma16_tailcall_exec(sigma16_vm_t*);
@@ -1,250 +1,302 @@
+#define _GNU_SOURCE
 #include "tracing.h"
 
 #include <stdio.h>
+#include <stdlib.h>
 
 #ifdef ENABLE_DEBUGGER
 #include "debugger.h"
 #endif
 #include "cpu.h"
+#include "disasm.h"
 #include "events.h"
 #include "instructions.h"
 #include "vm.h"
 
-const static char* RRR_INST_MNEMONICS[] = {
-    "add",   "sub", "mul", "div", "cmp", "cmplt", "cmpeq",
-    "cmpgt", "inv", "and", "or",  "xor", "nop",   "trap"};
-
-const static char* RX_INST_MNEMONICS[] = {"lea",   "load",   "store",
-                                          "jump",  "jumpc0", "jumpc1",
-                                          "jumpf", "jumpt",  "jal"};
-
-const static char* EXP_INST_MNEMONICS[] = {"rfi"};
-
-void dump_cpu(sigma16_cpu_t*);
+void dump_cpu(FILE*, sigma16_cpu_t*);
 static void trace_rx(sigma16_vm_t*, const char*);
 static void trace_rrr(sigma16_vm_t*, const char*);
 static void trace_branch(sigma16_vm_t*, const char*);
 static void trace_pseudoinst(sigma16_vm_t*, const char*);
-static void print_status(sigma16_reg_status_t);
+static void trace_exp(sigma16_vm_t*, const char*);
+static void print_status(FILE*, sigma16_reg_status_t);
 
-static void print_reg(sigma16_reg_t r) {
+static void print_reg(FILE* out, sigma16_reg_t r) {
     switch (r) {
         case 0:
-            printf(ANSI_GREEN "R0" ANSI_OFF);
+            fprintf(out, ANSI_GREEN "R0" ANSI_OFF);
             break;
         case 15:
-            printf(ANSI_RED "R15" ANSI_OFF);
+            fprintf(out, ANSI_RED "R15" ANSI_OFF);
             break;
         default:
-            printf(ANSI_MAGENTA "R%d" ANSI_OFF, r);
+            fprintf(out, ANSI_MAGENTA "R%d" ANSI_OFF, r);
     }
 }
 
-static void print_value(uint16_t val) {
+static void print_value(FILE* out, uint16_t val) {
     if (!val) {
-        printf(ANSI_WHITE "%04x" ANSI_OFF, val);
+        fprintf(out, ANSI_WHITE "%04x" ANSI_OFF, val);
     } else {
-        printf(ANSI_CYAN "%04x" ANSI_OFF, val);
+        fprintf(out, ANSI_CYAN "%04x" ANSI_OFF, val);
     }
 }
 
+static const char* mnemonic(enum sigma16_disasm_kind kind, unsigned int op) {
+    struct sigma16_disasm_rec rec = {.kind = kind, .op = op};
+
+    return sigma16_disasm_mnemonic(&rec);
+}
+
 void sigma16_trace(sigma16_vm_t* vm, enum sigma16_trace_event event) {
+    FILE* out = vm->out;
+
     if (event == EXEC_START || event == EXEC_END) {
         return;
     }
 
-    printf(ANSI_OFF "[%04x]\t", vm->cpu.pc);
+    fprintf(out, ANSI_OFF "[%04x]\t", vm->cpu.pc);
 
     switch (event) {
         case INST_RRR:
-            trace_rrr(vm, RRR_INST_MNEMONICS[vm->cpu.ir.rrr.op]);
+            trace_rrr(vm, mnemonic(DISASM_RRR, vm->cpu.ir.rrr.op));
             break;
         case INST_RX:
-            trace_rx(vm, RX_INST_MNEMONICS[vm->cpu.ir.rx.sb]);
+            trace_rx(vm, mnemonic(DISASM_RX, vm->cpu.ir.rx.sb));
             break;
         case INST_EXP0:
-            /* TODO EXP */
+            /* the secondary opcode is the second byte, as sa and sb */
+            trace_exp(vm, mnemonic(DISASM_EXP, vm->cpu.ir.rrr.sa << 4 |
+                                                   vm->cpu.ir.rrr.sb));
             break;
     }
 }
 
 static void trace_rx(sigma16_vm_t* vm, const char* mnemonic) {
+    FILE* out = vm->out;
+
     if (3 <= vm->cpu.ir.rx.sb && vm->cpu.ir.rx.sb <= 8) {
         trace_branch(vm, mnemonic);
     } else {
-        printf(ANSI_YELLOW "%-05s\t", mnemonic);
-        print_reg(vm->cpu.ir.rx.d);
-        printf(", ");
-        print_value(vm->cpu.ir.rx.disp);
-        printf(ANSI_OFF "[");
-        print_reg(vm->cpu.ir.rx.sa);
-        puts(ANSI_OFF "]");
+        fprintf(out, ANSI_YELLOW "%-05s\t", mnemonic);
+        print_reg(out, vm->cpu.ir.rx.d);
+        fprintf(out, ", ");
+        print_value(out, vm->cpu.ir.rx.disp);
+        fprintf(out, ANSI_OFF "[");
+        print_reg(out, vm->cpu.ir.rx.sa);
+        fputs(ANSI_OFF "]\n", out);
     }
 }
 
 static void trace_rrr(sigma16_vm_t* vm, const char* mnemonic) {
+    FILE* out = vm->out;
+
     if (vm->cpu.ir.rrr.op == 4 || vm->cpu.ir.rrr.op == 8) {
         trace_pseudoinst(vm, mnemonic);
     } else {
-        printf(ANSI_BLUE "%-05s\t", mnemonic);
-        print_reg(vm->cpu.ir.rrr.d);
-        printf(", ");
-        print_reg(vm->cpu.ir.rrr.sa);
-        printf(", ");
-        print_reg(vm->cpu.ir.rrr.sb);
-        printf("\n");
+        fprintf(out, ANSI_BLUE "%-05s\t", mnemonic);
+        print_reg(out, vm->cpu.ir.rrr.d);
+        fprintf(out, ", ");
+        print_reg(out, vm->cpu.ir.rrr.sa);
+        fprintf(out, ", ");
+        print_reg(out, vm->cpu.ir.rrr.sb);
+        fprintf(out, "\n");
     }
 }
 
 static void trace_branch(sigma16_vm_t* vm, const char* mnemonic) {
-    printf(ANSI_RED "%-05s\t", mnemonic);
+    FILE* out = vm->out;
+
+    fprintf(out, ANSI_RED "%-05s\t", mnemonic);
 
     /* jump instruction has useless d operand */
     if (vm->cpu.ir.rx.sb != 3) {
-        print_reg(vm->cpu.ir.rx.d);
-        printf(", ");
+        print_reg(out, vm->cpu.ir.rx.d);
+        fprintf(out, ", ");
     }
 
-    print_value(vm->cpu.ir.rx.disp);
-    printf(ANSI_OFF "[");
-    print_reg(vm->cpu.ir.rx.sa);
-    puts(ANSI_OFF "]");
+    print_value(out, vm->cpu.ir.rx.disp);
+    fprintf(out, ANSI_OFF "[");
+    print_reg(out, vm->cpu.ir.rx.sa);
+    fputs(ANSI_OFF "]\n", out);
 }
 
 static void trace_pseudoinst(sigma16_vm_t* vm, const char* mnemonic) {
-    printf(ANSI_BLUE "%-05s\t", mnemonic);
-    print_reg(vm->cpu.ir.rrr.sa);
-    printf(", ");
-    print_reg(vm->cpu.ir.rrr.sb);
-    printf("\n" ANSI_OFF);
+    FILE* out = vm->out;
+
+    fprintf(out, ANSI_BLUE "%-05s\t", mnemonic);
+    print_reg(out, vm->cpu.ir.rrr.sa);
+    fprintf(out, ", ");
+    print_reg(out, vm->cpu.ir.rrr.sb);
+    fprintf(out, "\n" ANSI_OFF);
+}
+
+static void trace_exp(sigma16_vm_t* vm, const char* mnemonic) {
+    FILE* out = vm->out;
+    /* the operand word, which exp0 holds in memory order */
+    uint16_t ops = read_mem(vm, vm->cpu.pc + 1);
+    const char* ctl;
+
+    fprintf(out, ANSI_GREEN "%-05s\t", mnemonic);
+    switch (vm->cpu.ir.rrr.sa << 4 | vm->cpu.ir.rrr.sb) {
+        case EXP_RFI:
+            break;
+        case EXP_GETCTL:
+        case EXP_PUTCTL:
+            print_reg(out, vm->cpu.ir.exp0.d);
+            if ((ctl = sigma16_disasm_ctl(ops >> 12))) {
+                fprintf(out, ", " ANSI_YELLOW "%s" ANSI_OFF, ctl);
+            } else {
+                fprintf(out, ", " ANSI_YELLOW "%d" ANSI_OFF, ops >> 12);
+            }
+            break;
+        case EXP_SHIFTL:
+        case EXP_SHIFTR:
+            print_reg(out, vm->cpu.ir.exp0.d);
+            fprintf(out, ", ");
+            print_reg(out, ops >> 12);
+            fprintf(out, ", " ANSI_CYAN "%d" ANSI_OFF, ops & 0xf);
+            break;
+        default:
+            print_reg(out, vm->cpu.ir.exp0.d);
+    }
+    fprintf(out, "\n" ANSI_OFF);
 }
 
-static void print_status(sigma16_reg_status_t stat) {
+static void print_status(FILE* out, sigma16_reg_status_t stat) {
     if (stat.C) {
-        printf(ANSI_YELLOW "C");
+        fprintf(out, ANSI_YELLOW "C");
     } else {
-        printf(ANSI_BLUE "C");
+        fprintf(out, ANSI_BLUE "C");
     }
 
     if (stat.v) {
-        printf(ANSI_YELLOW "v");
+        fprintf(out, ANSI_YELLOW "v");
     } else {
-        printf(ANSI_BLUE "v");
+        fprintf(out, ANSI_BLUE "v");
     }
 
     if (stat.V) {
-        printf(ANSI_YELLOW "V");
+        fprintf(out, ANSI_YELLOW "V");
     } else {
-        printf(ANSI_BLUE "V");
+        fprintf(out, ANSI_BLUE "V");
     }
 
     if (stat.L) {
-        printf(ANSI_YELLOW "L");
+        fprintf(out, ANSI_YELLOW "L");
     } else {
-        printf(ANSI_BLUE "L");
+        fprintf(out, ANSI_BLUE "L");
     }
 
     if (stat.l) {
-        printf(ANSI_YELLOW "l");
+        fprintf(out, ANSI_YELLOW "l");
     } else {
-        printf(ANSI_BLUE "l");
+        fprintf(out, ANSI_BLUE "l");
     }
 
     if (stat.E) {
-        printf(ANSI_YELLOW "E");
+        fprintf(out, ANSI_YELLOW "E");
     } else {
-        printf(ANSI_BLUE "E");
+        fprintf(out, ANSI_BLUE "E");
     }
 
     if (stat.g) {
-        printf(ANSI_YELLOW "g");
+        fprintf(out, ANSI_YELLOW "g");
     } else {
-        printf(ANSI_BLUE "g");
+        fprintf(out, ANSI_BLUE "g");
     }
 
     if (stat.G) {
-        printf(ANSI_YELLOW "G" ANSI_OFF);
+        fprintf(out, ANSI_YELLOW "G" ANSI_OFF);
     } else {
-        printf(ANSI_BLUE "G" ANSI_OFF);
+        fprintf(out, ANSI_BLUE "G" ANSI_OFF);
     }
 }
 
-void dump_cpu(sigma16_cpu_t* cpu) {
-    puts("General Registers:");
+void dump_cpu(FILE* out, sigma16_cpu_t* cpu) {
+    fputs("General Registers:\n", out);
     for (int i = 0; i < 15; ++i) {
-        printf(ANSI_MAGENTA "R%02d: " ANSI_OFF, i);
-        print_value(cpu->regs[i]);
+        fprintf(out, ANSI_MAGENTA "R%02d: " ANSI_OFF, i);
+        print_value(out, cpu->regs[i]);
         if (cpu->regs[i]) {
-            printf(ANSI_CYAN "\t%d\n" ANSI_OFF, cpu->regs[i]);
+            fprintf(out, ANSI_CYAN "\t%d\n" ANSI_OFF, cpu->regs[i]);
         } else {
-            puts(ANSI_WHITE "\t0" ANSI_OFF);
+            fputs(ANSI_WHITE "\t0" ANSI_OFF "\n", out);
         }
     }
 
-    printf(ANSI_MAGENTA "R15: " ANSI_OFF);
-    print_value(cpu->regs[15]);
-    printf("\t");
-    print_status(*((sigma16_reg_status_t*)&cpu->regs[15]));
+    fprintf(out, ANSI_MAGENTA "R15: " ANSI_OFF);
+    print_value(out, cpu->regs[15]);
+    fprintf(out, "\t");
+    print_status(out, *((sigma16_reg_status_t*)&cpu->regs[15]));
 
-    puts("\nControl Registers:");
-    puts(ANSI_RED "IR:\t" ANSI_BLUE "N/A" ANSI_OFF);
+    fputs("\nControl Registers:\n", out);
+    fputs(ANSI_RED "IR:\t" ANSI_BLUE "N/A" ANSI_OFF "\n", out);
 
-    printf(ANSI_RED "PC:\t");
-    print_value(cpu->pc);
+    fprintf(out, ANSI_RED "PC:\t");
+    print_value(out, cpu->pc);
 
-    printf("\n" ANSI_RED "ADR:\t");
-    print_value(cpu->adr);
+    fprintf(out, "\n" ANSI_RED "ADR:\t");
+    print_value(out, cpu->adr);
 
-    printf("\n" ANSI_RED "DAT:\t");
-    print_value(cpu->dat);
+    fprintf(out, "\n" ANSI_RED "DAT:\t");
+    print_value(out, cpu->dat);
 
-    printf("\n" ANSI_RED "STATUS:\t");
-    print_value(*((sigma16_reg_t*)&cpu->status));
-    printf("\t");
-    print_status(cpu->status);
+    fprintf(out, "\n" ANSI_RED "STATUS:\t");
+    print_value(out, *((sigma16_reg_t*)&cpu->status));
+    fprintf(out, "\t");
+    print_status(out, cpu->status);
 
-    puts(ANSI_OFF "\nStatus Register Flags:");
-    printf(ANSI_RED "SYS:\t");
-    print_value(cpu->sys);
+    fputs(ANSI_OFF "\nStatus Register Flags:\n", out);
+    fprintf(out, ANSI_RED "SYS:\t");
+    print_value(out, cpu->sys);
 
-    printf("\n" ANSI_RED "IE:\t");
-    print_value(cpu->ie);
+    fprintf(out, "\n" ANSI_RED "IE:\t");
+    print_value(out, cpu->ie);
 
-    puts(ANSI_OFF "\nInterrupt and Exceptions:");
-    printf(ANSI_RED "MASK:\t");
-    print_value(cpu->mask);
+    fputs(ANSI_OFF "\nInterrupt and Exceptions:\n", out);
+    fprintf(out, ANSI_RED "MASK:\t");
+    print_value(out, cpu->mask);
 
-    printf("\n" ANSI_RED "REQ:\t");
-    print_value(cpu->req);
+    fprintf(out, "\n" ANSI_RED "REQ:\t");
+    print_value(out, cpu->req);
 
-    printf("\n" ANSI_RED "ISTAT:\t");
-    print_value(*((sigma16_reg_t*)&cpu->istat));
-    printf("\t");
-    print_status(cpu->istat);
+    fprintf(out, "\n" ANSI_RED "ISTAT:\t");
+    print_value(out, cpu->istat);
 
-    printf("\n" ANSI_RED "IPC:\t");
-    print_value(cpu->ipc);
+    fprintf(out, "\n" ANSI_RED "IPC:\t");
+    print_value(out, cpu->ipc);
 
-    printf("\n" ANSI_RED "VECT:\t");
-    print_value(cpu->vect);
-    printf("\n");
+    fprintf(out, "\n" ANSI_RED "VECT:\t");
+    print_value(out, cpu->vect);
+
+    /* the icount it fires at, which may not fit a word */
+    fprintf(out, "\n" ANSI_RED "TIMER:\t");
+    if (cpu->timer_at) {
+        fprintf(out, ANSI_CYAN "%llu" ANSI_OFF,
+                (unsigned long long)cpu->timer_at);
+    } else {
+        fputs(ANSI_WHITE "off" ANSI_OFF, out);
+    }
+    fprintf(out, "\n");
 }
 
-static void print_array_char(char* buf, int size) {
+static void print_array_char(FILE* out, char* buf, int size) {
     char printable;
 
     for (int j = 0; j < size; ++j) {
         printable = buf[j];
         if (printable != '.') {
-            printf(ANSI_YELLOW "%c" ANSI_OFF, printable);
+            fprintf(out, ANSI_YELLOW "%c" ANSI_OFF, printable);
         } else {
-            printf(ANSI_WHITE "%c" ANSI_OFF, printable);
+            fprintf(out, ANSI_WHITE "%c" ANSI_OFF, printable);
         }
     }
-    printf("\n");
+    fprintf(out, "\n");
 }
 
 void dump_vm_mem(sigma16_vm_t* vm, size_t start, size_t end) {
+    FILE* out = vm->out;
     int i;
     uint16_t word;
     unsigned char printable;
@@ -255,13 +307,13 @@ void dump_vm_mem(sigma16_vm_t* vm, size_t start, size_t end) {
 
         if ((i % 16) == 0) {
             if (i != 0) {
-                print_array_char(buf, 17);
+                print_array_char(out, buf, 17);
             }
-            printf("[%04x] ", i);
+            fprintf(out, "[%04x] ", i);
         }
 
-        print_value(word);
-        printf(" ");
+        print_value(out, word);
+        fprintf(out, " ");
 
         printable = word & 0xff;
         if (printable < ' ' || printable > '~') {
@@ -272,9 +324,179 @@ void dump_vm_mem(sigma16_vm_t* vm, size_t start, size_t end) {
     }
 
     while (i++ % 16 != 0) {
-        printf("     ");
+        fprintf(out, "     ");
     }
 
-    print_array_char(buf, 17);
+    print_array_char(out, buf, 17);
+}
+
+/* plain text, for reports which outlive the terminal */
+static void print_inst(FILE* out, uint16_t word, uint16_t disp) {
+    struct sigma16_disasm_rec rec;
+    char buf[64];
+
+    sigma16_disasm_decode(word, disp, &rec);
+    sigma16_disasm_format(buf, sizeof buf, &rec);
+    fputs(buf, out);
+}
+
+/*
+ * One line per record, at base plus its address: the words, '>' before
+ * jump targets and '*' before pc (-1 for none), then the assembler text.
+ */
+void dump_disasm(FILE* out, const struct sigma16_disasm_rec* recs, size_t n,
+                 uint16_t base, int pc) {
+    const struct sigma16_disasm_rec* rec;
+    uint16_t addr;
+    char buf[64];
+
+    for (size_t i = 0; i < n; ++i) {
+        rec = &recs[i];
+        addr = base + rec->addr;
+        sigma16_disasm_format(buf, sizeof buf, rec);
+        fprintf(out, "%c%c[%04x] %04x ", addr == pc ? '*' : ' ',
+                rec->flags & DISASM_TARGET ? '>' : ' ', addr, rec->word);
+        if (rec->kind == DISASM_RX || rec->kind == DISASM_EXP) {
+            fprintf(out, "%04x ", rec->disp);
+        } else {
+            fputs("     ", out);
+        }
+        fprintf(out, " %s\n", buf);
+    }
+}
+
+static int by_count(const void* a, const void* b, void* counts) {
+    uint64_t x = ((uint64_t*)counts)[*(uint16_t*)a];
+    uint64_t y = ((uint64_t*)counts)[*(uint16_t*)b];
+
+    return x < y ? 1 : x > y ? -1 : (int)*(uint16_t*)a - *(uint16_t*)b;
 }
 
+static double percent(uint64_t n, uint64_t total) {
+    return total ? 100.0 * n / total : 0;
+}
+
+static void print_mix(FILE* out, enum sigma16_disasm_kind kind,
+                      const uint64_t* counts, size_t n, uint64_t total) {
+    for (size_t i = 0; i < n; ++i) {
+        if (counts[i]) {
+            fprintf(out, "  %-8s %14llu %6.2f%%\n", mnemonic(kind, i),
+                    (unsigned long long)counts[i], percent(counts[i], total));
+        }
+    }
+}
+
+#define PRINT_MIX(out, kind, counts, total) \
+    print_mix(out, kind, counts, sizeof counts / sizeof *counts, total)
+
+/* conditional jumps by secondary opcode */
+static const int conditional_jumps[] = {4, 5, 6, 7};
+
+void dump_profile(FILE* out, sigma16_vm_t* vm) {
+    struct sigma16_profile* prof = vm->profile;
+    uint16_t* pcs;
+    uint64_t total = 0, count;
+    int n = 0;
+
+    if (!(pcs = malloc((1 << 16) * sizeof *pcs))) {
+        perror("unable to allocate profile report");
+        return;
+    }
+    for (int pc = 0; pc < 1 << 16; ++pc) {
+        if (prof->pc[pc]) {
+            total += prof->pc[pc];
+            pcs[n++] = pc;
+        }
+    }
+    qsort_r(pcs, n, sizeof *pcs, by_count, prof->pc);
+
+    fprintf(out, "Profile: %llu instructions at %d addresses\n",
+            (unsigned long long)total, n);
+    fprintf(out, "\nHot spots:\n  %-6s %14s %7s %7s  %s\n", "addr", "count",
+            "share", "taken", "instruction");
+    for (int i = 0; i < n && i < PROFILE_TOP; ++i) {
+        uint16_t pc = pcs[i];
+        uint16_t word = read_mem(vm, pc);
+
+        count = prof->pc[pc];
+        fprintf(out, "  [%04x] %14llu %6.2f%% ", pc, (unsigned long long)count,
+                percent(count, total));
+        if (word >> 12 == 0xf && (word & 0xf) >= 4 && (word & 0xf) <= 7) {
+            fprintf(out, "%6.2f%%  ", percent(prof->taken[pc], count));
+        } else {
+            fprintf(out, "%7s  ", "");
+        }
+        print_inst(out, word, read_mem(vm, pc + 1));
+        fputc('\n', out);
+    }
+
+    fputs("\nOpcode mix:\n", out);
+    PRINT_MIX(out, DISASM_RRR, prof->rrr, total);
+    PRINT_MIX(out, DISASM_RX, prof->rx, total);
+    PRINT_MIX(out, DISASM_EXP, prof->exp, total);
+
+    fprintf(out, "\nConditional jumps:\n  %-8s %14s %14s %14s %7s\n", "",
+            "executed", "taken", "not taken", "taken");
+    for (int i = 0; i < sizeof conditional_jumps / sizeof *conditional_jumps;
+         ++i) {
+        int op = conditional_jumps[i];
+
+        count = prof->rx[op];
+        fprintf(out, "  %-8s %14llu %14llu %14llu %6.2f%%\n",
+                mnemonic(DISASM_RX, op), (unsigned long long)count,
+                (unsigned long long)prof->rx_taken[op],
+                (unsigned long long)(count - prof->rx_taken[op]),
+                percent(prof->rx_taken[op], count));
+    }
+    free(pcs);
+}
+
+#ifdef ENABLE_FLIGHT_RECORDER
+static void print_record(FILE* out, struct sigma16_flight_record* rec) {
+    int d = (rec->word >> 8) & 0xf;
+    int sa = (rec->word >> 4) & 0xf;
+    int sb = rec->word & 0xf;
+
+    fprintf(out, "[%04x] %04x ", rec->pc, rec->word);
+    if (rec->word >> 12 >= 0xe) {
+        fprintf(out, "%04x ", rec->disp);
+    } else {
+        fputs("     ", out);
+    }
+    print_inst(out, rec->word, rec->disp);
+    switch (rec->word >> 12) {
+        case 0xe:
+            break;
+        case 0xf:
+            fprintf(out, "\tR%d=%04x R%d=%04x", d, rec->d, sa, rec->sa);
+            break;
+        default:
+            fprintf(out, "\tR%d=%04x R%d=%04x R%d=%04x", d, rec->d, sa,
+                    rec->sa, sb, rec->sb);
+    }
+    fprintf(out, " R15=%04x\n", rec->r15);
+}
+
+/*
+ * Oldest first. Safe to call while the vm runs in another thread: records
+ * are copied out and then checked against the head again, and the two
+ * slots after the head, which a running vm may be filling, are left out.
+ */
+void dump_flight_recorder(FILE* out, sigma16_vm_t* vm) {
+    const uint64_t keep = FLIGHT_RECORDER_SIZE - 2;
+    struct sigma16_flight_record rec;
+    uint64_t head = __atomic_load_n(&vm->flight_head, __ATOMIC_ACQUIRE);
+    uint64_t first = head > keep ? head - keep : 0;
+
+    fprintf(out, "Flight recorder, last %d of %llu instructions:\n",
+            (int)(head - first), (unsigned long long)head);
+    for (uint64_t i = first; i < head; ++i) {
+        rec = vm->flight[i & (FLIGHT_RECORDER_SIZE - 1)];
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&vm->flight_head, __ATOMIC_RELAXED) - i > keep) {
+            continue;
+        }
+        print_record(out, &rec);
+    }
+}
+#endif
@@ -1,4 +1,5 @@
 #pragma once
+#include "disasm.h"
 #include "events.h"
 #include "instructions.h"
 #include "vm.h"
@@ -13,7 +14,13 @@
 #define ANSI_CYAN "\x1b[36m"
 #define ANSI_WHITE "\x1b[37m"
 
-void dump_cpu(sigma16_cpu_t*);
+void dump_cpu(FILE*, sigma16_cpu_t*);
 void dump_vm_mem(sigma16_vm_t*, size_t, size_t);
+#ifdef ENABLE_FLIGHT_RECORDER
+void dump_flight_recorder(FILE*, sigma16_vm_t*);
+#endif
+void dump_profile(FILE*, sigma16_vm_t*);
+void dump_disasm(FILE*, const struct sigma16_disasm_rec*, size_t, uint16_t,
+                 int);
 /* user defined trace handler */
 void sigma16_trace(sigma16_vm_t*, enum sigma16_trace_event);
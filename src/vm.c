@@ -1,71 +1,73 @@
 #include "vm.h"
 
-#include <byteswap.h>
 #include <stdio.h>
 #include <string.h>
 #include <sys/mman.h>
+#include <time.h>
 #include <unistd.h>
 
+#include "block.h"
 #include "config.h"
 #include "cpu.h"
+#include "expr.h"
+#include "history.h"
 #include "instructions.h"
+#include "io.h"
+#include "jit.h"
+#include "ops.h"
+#include "tailcall.h"
 
-#ifdef ENABLE_TRACE
 #include "events.h"
+#ifdef ENABLE_FLIGHT_RECORDER
 #include "tracing.h"
 #endif
 
-static int select_bit(uint16_t val, uint8_t bit_pos) {
-    return (val >> 15 - bit_pos) & 0x1;
-}
-
-static uint16_t compute_rx_eaddr(sigma16_vm_t* vm) {
-    vm->cpu.adr = vm->cpu.regs[vm->cpu.ir.rx.sa] + vm->cpu.ir.rx.disp;
+static uint16_t compute_rx_eaddr(sigma16_vm_t* vm, sigma16_decoded_t* inst) {
+    vm->cpu.adr = vm->cpu.regs[inst->sa] + inst->disp;
     return vm->cpu.adr;
 }
 
-#define SAFE_UPDATE(vm, dst, val) \
-    if (dst != 0) vm->cpu.regs[dst] = val;
-
-#ifdef ENABLE_TRACE
-#define APPLY_OP_RRR(vm, op)                                                 \
-    INTERP_INST(vm, rrr);                                                    \
-    vm->trace_handler(vm, INST_RRR);                                         \
-    SAFE_UPDATE(                                                             \
-        vm, vm->cpu.ir.rrr.d,                                                \
-        vm->cpu.regs[vm->cpu.ir.rrr.sa] op vm->cpu.regs[vm->cpu.ir.rrr.sb]); \
-    vm->cpu.pc += sizeof vm->cpu.ir.rrr >> 1;
+#ifdef ENABLE_FLIGHT_RECORDER
+#define RECORD(vm) \
+    flight_record(vm, vm->cpu.pc, inst->d, inst->sa, inst->sb, inst->disp)
 #else
-#define APPLY_OP_RRR(vm, op)                                                 \
-    INTERP_INST(vm, rrr);                                                    \
-    SAFE_UPDATE(                                                             \
-        vm, vm->cpu.ir.rrr.d,                                                \
-        vm->cpu.regs[vm->cpu.ir.rrr.sa] op vm->cpu.regs[vm->cpu.ir.rrr.sb]); \
-    vm->cpu.pc += sizeof vm->cpu.ir.rrr >> 1;
+#define RECORD(vm)
 #endif
 
-#define INTERP_INST(vm, type) \
-    vm->cpu.ir.type = *(sigma16_inst_##type##_t*)&vm->mem[vm->cpu.pc]
-
-#define INTERP_RX(vm)    \
-    INTERP_INST(vm, rx); \
-    vm->cpu.ir.rx.disp = bswap_16(vm->cpu.ir.rx.disp)
-
-#define SETFLAG(reg, flag, val) (*(sigma16_reg_status_t*)&reg).flag = val
-
-#define CLEARFLAGS(reg) memset(&reg, 0, sizeof(sigma16_reg_status_t));
+/* drop any decoded instruction which covers addr (RX spans two words) */
+static inline void invalidate_decoded(sigma16_vm_t* vm, uint16_t addr) {
+    if (vm->decoded[addr].handler) {
+        vm->decoded[addr].handler = 0;
+    }
+    if (vm->decoded[(uint16_t)(addr - 1)].handler) {
+        vm->decoded[(uint16_t)(addr - 1)].handler = 0;
+    }
+}
 
 void write_mem(sigma16_vm_t* vm, uint16_t addr, uint16_t val) {
-    vm->mem[addr] = bswap_16(val);
+    vm->mem[addr] = MEM_SWAP(val);
+    invalidate_decoded(vm, addr);
+    if (vm->blocks) {
+        sigma16_block_invalidate(vm, addr);
+    }
 }
 
 uint16_t read_mem(sigma16_vm_t* vm, uint16_t addr) {
-    return bswap_16(vm->mem[addr]);
+    return MEM_SWAP(vm->mem[addr]);
 }
 
-int sigma16_vm_init(sigma16_vm_t** vm, char* fname) {
-    FILE* executable;
-    size_t exec_size;
+/* drop code decoded from [addr, addr + n) after writing vm->mem directly */
+void sigma16_vm_invalidate(sigma16_vm_t* vm, uint16_t addr, size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+        invalidate_decoded(vm, addr + i);
+        if (vm->blocks) {
+            sigma16_block_invalidate(vm, addr + i);
+        }
+    }
+}
+
+int sigma16_vm_init_image(sigma16_vm_t** vm, sigma16_image_t* image) {
+    size_t page = sysconf(_SC_PAGESIZE);
 
     *vm = calloc(1, sizeof **vm);
     if (!*vm) {
@@ -73,277 +75,505 @@ int sigma16_vm_init(sigma16_vm_t** vm, char* fname) {
         return -1;
     }
 
-    if (!(executable = fopen(fname, "rb"))) {
-        perror("unable to open file");
-        return -1;
+    (*vm)->out = stdout;
+    (*vm)->engine = DEFAULT_ENGINE;
+    sigma16_vm_set_budget(*vm, 0, 0);
+#ifdef ENABLE_FLIGHT_RECORDER
+    if (!((*vm)->flight =
+              calloc(FLIGHT_RECORDER_SIZE, sizeof *(*vm)->flight))) {
+        perror("unable to allocate flight recorder");
+        goto error;
     }
+#endif
 
-    fseek(executable, 0L, SEEK_END);
-    exec_size = ftell(executable);
-    fseek(executable, 0L, SEEK_SET);
-
-    if (((*vm)->mem = mmap(NULL, 1 << 16, PROT_READ | PROT_WRITE,
+    /* the whole address space, zero beyond the image */
+    if (((*vm)->mem = mmap(NULL, SIGMA16_MEM_SIZE, PROT_READ | PROT_WRITE,
                            MAP_ANON | MAP_PRIVATE, 0, 0)) == MAP_FAILED) {
         perror("unable to allocate vm memory");
         goto error;
     }
 
-    fread((*vm)->mem, exec_size, 1, executable);
+    /* private mapping, pages are only copied once the program writes them */
+    if (image->size &&
+        mmap((*vm)->mem, (image->size + page - 1) & ~(page - 1),
+             PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, image->fd,
+             0) == MAP_FAILED) {
+        perror("unable to map image");
+        munmap((*vm)->mem, SIGMA16_MEM_SIZE);
+        goto error;
+    }
+
+    /* zero-filled pages, so every slot starts out undecoded */
+    if (((*vm)->decoded = mmap(NULL, (1 << 16) * sizeof(sigma16_decoded_t),
+                               PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE,
+                               0, 0)) == MAP_FAILED) {
+        perror("unable to allocate decode cache");
+        munmap((*vm)->mem, SIGMA16_MEM_SIZE);
+        goto error;
+    }
     return 0;
 error:
+#ifdef ENABLE_FLIGHT_RECORDER
+    free((*vm)->flight);
+#endif
     free(*vm);
     return -1;
 }
 
+int sigma16_vm_init(sigma16_vm_t** vm, char* fname) {
+    sigma16_image_t* image;
+    int ret;
+
+    if (sigma16_image_load(&image, fname, LOADER_MMAP) < 0) {
+        return -1;
+    }
+    /* the mapping keeps the image alive */
+    ret = sigma16_vm_init_image(vm, image);
+    sigma16_image_del(image);
+    return ret;
+}
+
 void sigma16_vm_del(sigma16_vm_t* vm) {
-    munmap(vm->mem, 1 << 16);
+    if (vm->blocks) {
+        sigma16_block_del(vm);
+    }
+    if (vm->jit) {
+        sigma16_jit_del(vm);
+    }
+    sigma16_io_del(vm);
+    munmap(vm->decoded, (1 << 16) * sizeof(sigma16_decoded_t));
+    munmap(vm->mem, SIGMA16_MEM_SIZE);
+#ifdef ENABLE_FLIGHT_RECORDER
+    free(vm->flight);
+#endif
+    free(vm->profile);
+    sigma16_history_del(vm);
+    /* not through remove_breakpoint, decoded is already unmapped */
+    for (int i = 0; i < vm->n_breakpoints; ++i) {
+        free(vm->break_list[i].cond);
+    }
+    free(vm->break_list);
+    free(vm->breakpoints);
+    free(vm->watchpoints);
     free(vm);
 }
 
-static void trap_write(sigma16_vm_t* vm) {
-    int addr = vm->cpu.regs[vm->cpu.ir.rrr.sa];
+static uint64_t now_ns(void) {
+    struct timespec ts;
 
-    for (int i = 0; i < vm->cpu.regs[vm->cpu.ir.rrr.sb]; ++i) {
-        putc(read_mem(vm, addr + i) & 0xff, stdout);
-    }
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
 }
 
-__attribute__((always_inline)) static inline void op_div(sigma16_vm_t* vm) {
-    int a, b;
-    int quotient;
+static uint16_t status_word(const sigma16_cpu_t* cpu) {
+    return (cpu->sys ? STATUS_SYS : 0) | (cpu->ie ? STATUS_IE : 0);
+}
 
-    a = vm->cpu.regs[vm->cpu.ir.rrr.sa];
-    b = vm->cpu.regs[vm->cpu.ir.rrr.sb];
+static void set_status(sigma16_cpu_t* cpu, uint16_t status) {
+    cpu->sys = (status & STATUS_SYS) != 0;
+    cpu->ie = (status & STATUS_IE) != 0;
+}
 
-    if (!b) {
+/* raise a due timer, then enter the handler of the lowest enabled request */
+static void poll_interrupts(sigma16_vm_t* vm) {
+    sigma16_cpu_t* cpu = &vm->cpu;
+    uint16_t pending;
+    int i;
+
+    if (cpu->timer_at && vm->icount >= cpu->timer_at) {
+        cpu->req |= 1 << INT_TIMER;
+        cpu->timer_at = 0;
+    }
+    if (!cpu->ie || !(pending = cpu->req & cpu->mask)) {
         return;
     }
-    quotient = (int)(a / b);
-    SAFE_UPDATE(vm, vm->cpu.ir.rrr.d, quotient);
+    i = __builtin_ctz(pending);
+    cpu->req &= ~(1 << i);
+    cpu->istat = status_word(cpu);
+    cpu->ipc = cpu->pc;
+    cpu->ie = 0;
+    cpu->sys = 1;
+    cpu->pc = read_mem(vm, cpu->vect + i);
+}
+
+/* nonzero once icount_limit or the deadline has passed, without side effects */
+int sigma16_vm_budget_exhausted(const sigma16_vm_t* vm) {
+    return vm->icount >= vm->icount_limit ||
+           (vm->deadline && now_ns() >= vm->deadline);
+}
 
-    if (vm->cpu.ir.rrr.d != 15) {
-        vm->cpu.regs[15] = a % b;
+/*
+ * The engines' check once icount reaches next_check: nonzero if the budget
+ * is exhausted, else next_check is moved on. Also their only interrupt
+ * check, which may enter a handler: next_check is kept at or before the
+ * timer, and anything else which may leave an interrupt pending zeroes it,
+ * so pending interrupts are taken at the next taken branch or block
+ * boundary and programs which never enable them pay nothing. Debugger
+ * history snapshots are taken here too.
+ */
+int sigma16_vm_budget_check(sigma16_vm_t* vm) {
+    uint64_t next = UINT64_MAX;
+    uint64_t tick;
+
+    poll_interrupts(vm);
+    if (vm->cpu.timer_at) {
+        next = vm->cpu.timer_at;
     }
+    if (vm->history) {
+        /* snapshots are taken at budget checks, after any interrupt */
+        if ((tick = sigma16_history_tick(vm)) < next) {
+            next = tick;
+        }
+    }
+    if (vm->icount >= vm->icount_limit) {
+        return 1;
+    }
+    if (vm->deadline) {
+        if (now_ns() >= vm->deadline) {
+            return 1;
+        }
+        if (vm->icount + BUDGET_CLOCK_INTERVAL < next) {
+            next = vm->icount + BUDGET_CLOCK_INTERVAL;
+        }
+    }
+    vm->next_check = next < vm->icount_limit ? next : vm->icount_limit;
+    return 0;
 }
 
-int sigma16_vm_exec(sigma16_vm_t* vm) {
-    static const void* dispatch_table[] = {
-        &&do_add,    &&do_sub,    &&do_mul,        &&do_div,
-        &&do_cmp,    &&do_cmplt,  &&do_cmpeq,      &&do_cmpgt,
-        &&do_invold, &&do_andold, &&do_orold,      &&do_xorold,
-        &&do_nop,    &&do_trap,   &&do_decode_exp, &&do_decode_rx};
-
-    /* TODO implement EXP instructions*/
-    static const void* exp_dispatch_table[] = {&&do_rfi};
-
-    static const void* rx_dispatch_table[] = {
-        &&do_lea,    &&do_load,   &&do_store,  &&do_jump,
-        &&do_jumpc0, &&do_jumpc1, &&do_jumpf,  &&do_jumpt,
-        &&do_jal,    &&do_bad_op, &&do_bad_op, &&do_bad_op,
-        &&do_bad_op, &&do_bad_op, &&do_bad_op, &&do_bad_op};
-#define DISPATCH() goto* dispatch_table[(vm->mem[vm->cpu.pc] >> 4) & 0xf]
-
-#ifdef ENABLE_TRACE
-    vm->trace_handler(vm, EXEC_START);
-#endif
-    DISPATCH();
-
-do_add:
-    APPLY_OP_RRR(vm, +);
-    CLEARFLAGS(vm->cpu.regs[15]);
-    SETFLAG(vm->cpu.regs[15], G, vm->cpu.ir.rrr.d > 0);
-    SETFLAG(vm->cpu.regs[15], g, (int16_t)vm->cpu.ir.rrr.d > 0);
-    SETFLAG(vm->cpu.regs[15], E, vm->cpu.ir.rrr.d == 0);
-    SETFLAG(vm->cpu.regs[15], L, (int16_t)vm->cpu.ir.rrr.d < 0);
-    SETFLAG(vm->cpu.regs[15], L, vm->cpu.ir.rrr.d == 0);
-    // TODO overflow & carry
-    SETFLAG(vm->cpu.regs[15], V, vm->cpu.ir.rrr.d > 0);
-    SETFLAG(vm->cpu.regs[15], v, vm->cpu.ir.rrr.d > 0);
-    SETFLAG(vm->cpu.regs[15], C, vm->cpu.ir.rrr.d > 0);
-    DISPATCH();
-do_sub:
-    APPLY_OP_RRR(vm, -);
-    DISPATCH();
-do_mul:
-    APPLY_OP_RRR(vm, *);
-    DISPATCH();
-do_div:
-    INTERP_INST(vm, rrr);
-#ifdef ENABLE_TRACE
-    vm->trace_handler(vm, INST_RRR);
-#endif
-    op_div(vm);
-    vm->cpu.pc += sizeof vm->cpu.ir.rrr >> 1;
-    DISPATCH();
-do_cmp:
-    INTERP_INST(vm, rrr);
-#ifdef ENABLE_TRACE
-    vm->trace_handler(vm, INST_RRR);
-#endif
-    CLEARFLAGS(vm->cpu.regs[15]);
-    uint16_t a = vm->cpu.regs[vm->cpu.ir.rrr.sa];
-    uint16_t b = vm->cpu.regs[vm->cpu.ir.rrr.sb];
-    SETFLAG(vm->cpu.regs[15], G, a > b);
-    SETFLAG(vm->cpu.regs[15], g, (int16_t)a > (int16_t)b);
-    SETFLAG(vm->cpu.regs[15], E, a == b);
-    SETFLAG(vm->cpu.regs[15], l, (int16_t)a < (int16_t)b);
-    SETFLAG(vm->cpu.regs[15], L, a < b);
-
-    vm->cpu.pc += sizeof vm->cpu.ir.rrr >> 1;
-    DISPATCH();
-do_cmplt:
-    APPLY_OP_RRR(vm, <);
-    CLEARFLAGS(vm->cpu.regs[15]);
-    DISPATCH();
-do_cmpeq:
-    APPLY_OP_RRR(vm, ==);
-    CLEARFLAGS(vm->cpu.regs[15]);
-    DISPATCH();
-do_cmpgt:
-    APPLY_OP_RRR(vm, >);
-    CLEARFLAGS(vm->cpu.regs[15]);
-    DISPATCH();
-do_invold:
-    INTERP_INST(vm, rrr);
-#ifdef ENABLE_TRACE
-    vm->trace_handler(vm, INST_RRR);
-#endif
-    SAFE_UPDATE(vm, vm->cpu.ir.rrr.d, ~vm->cpu.regs[vm->cpu.ir.rrr.sa]);
-    vm->cpu.pc += sizeof vm->cpu.ir.rrr >> 1;
-
-    CLEARFLAGS(vm->cpu.regs[15]);
-    DISPATCH();
-do_andold:
-    APPLY_OP_RRR(vm, &);
-    CLEARFLAGS(vm->cpu.regs[15]);
-    DISPATCH();
-do_orold:
-    APPLY_OP_RRR(vm, |);
-    CLEARFLAGS(vm->cpu.regs[15]);
-    DISPATCH();
-do_xorold:
-    APPLY_OP_RRR(vm, ^);
-    CLEARFLAGS(vm->cpu.regs[15]);
-    DISPATCH();
-do_nop:
-#ifdef ENABLE_TRACE
-    vm->trace_handler(vm, INST_RRR);
-#endif
-    CLEARFLAGS(vm->cpu.regs[15]);
-    vm->cpu.pc += sizeof vm->cpu.ir.rrr >> 1;
-    DISPATCH();
-do_trap:
-    INTERP_INST(vm, rrr);
-#ifdef ENABLE_TRACE
-    vm->trace_handler(vm, INST_RRR);
-#endif
-    switch (vm->cpu.regs[vm->cpu.ir.rrr.d]) {
-        case 0:
-            goto end_hotloop;
-        case 2:
-            trap_write(vm);
+/*
+ * Limit the following runs to instructions more instructions and seconds
+ * of wall time, 0 for no limit. Runs stop at the first taken branch or
+ * block boundary past the budget, which may overshoot it slightly.
+ */
+void sigma16_vm_set_budget(sigma16_vm_t* vm, uint64_t instructions,
+                           double seconds) {
+    vm->icount_limit = instructions ? vm->icount + instructions : UINT64_MAX;
+    vm->deadline = seconds > 0 ? now_ns() + (uint64_t)(seconds * 1e9) : 0;
+    /* next_check is worked out by the engines' first check */
+    vm->next_check = 0;
+}
+
+/* value of control register ctl, 0 for numbers without one */
+uint16_t sigma16_vm_getctl(sigma16_vm_t* vm, int ctl) {
+    uint64_t left;
+
+    switch (ctl) {
+        case CTL_STATUS:
+            return status_word(&vm->cpu);
+        case CTL_MASK:
+            return vm->cpu.mask;
+        case CTL_REQ:
+            return vm->cpu.req;
+        case CTL_ISTAT:
+            return vm->cpu.istat;
+        case CTL_IPC:
+            return vm->cpu.ipc;
+        case CTL_VECT:
+            return vm->cpu.vect;
+        case CTL_TIMER:
+            if (vm->cpu.timer_at <= vm->icount) {
+                return 0;
+            }
+            left = vm->cpu.timer_at - vm->icount;
+            return left > 0xffff ? 0xffff : left;
+        default:
+            return 0;
+    }
+}
+
+/*
+ * Set control register ctl, ignoring numbers without one. The timer counts
+ * the instructions after this one. Any write may leave an interrupt
+ * pending, so the next budget check is brought forward to take it.
+ */
+void sigma16_vm_putctl(sigma16_vm_t* vm, int ctl, uint16_t val) {
+    switch (ctl) {
+        case CTL_STATUS:
+            set_status(&vm->cpu, val);
+            break;
+        case CTL_MASK:
+            vm->cpu.mask = val;
+            break;
+        case CTL_REQ:
+            vm->cpu.req = val;
+            break;
+        case CTL_ISTAT:
+            vm->cpu.istat = val;
+            break;
+        case CTL_IPC:
+            vm->cpu.ipc = val;
+            break;
+        case CTL_VECT:
+            vm->cpu.vect = val;
+            break;
+        case CTL_TIMER:
+            vm->cpu.timer_at = val ? vm->icount + val : 0;
             break;
     }
-    vm->cpu.pc += sizeof vm->cpu.ir.rrr >> 1;
-    CLEARFLAGS(vm->cpu.regs[15]);
-    DISPATCH();
-do_decode_exp:
-    INTERP_INST(vm, exp0);
-    goto* exp_dispatch_table[vm->cpu.ir.exp0.ab];
-do_rfi:
-#ifdef ENABLE_TRACE
-    vm->trace_handler(vm, INST_EXP0);
-#endif
-    /* TODO */
-    vm->cpu.pc += sizeof vm->cpu.ir.exp0 >> 1;
-    DISPATCH();
-/* TODO rest of exp instructions */
-do_decode_rx:
-    INTERP_RX(vm);
-    goto* rx_dispatch_table[vm->cpu.ir.rx.sb];
-do_lea:
-#ifdef ENABLE_TRACE
-    vm->trace_handler(vm, INST_RX);
-#endif
-    SAFE_UPDATE(vm, vm->cpu.ir.rx.d, compute_rx_eaddr(vm));
-    vm->cpu.pc += sizeof vm->cpu.ir.rx >> 1;
-    DISPATCH();
-do_load:
-#ifdef ENABLE_TRACE
-    vm->trace_handler(vm, INST_RX);
-#endif
-    SAFE_UPDATE(vm, vm->cpu.ir.rx.d, read_mem(vm, compute_rx_eaddr(vm)));
-    vm->cpu.pc += sizeof vm->cpu.ir.rx >> 1;
-    DISPATCH();
-do_store:
-#ifdef ENABLE_TRACE
-    vm->trace_handler(vm, INST_RX);
-#endif
-    write_mem(vm, compute_rx_eaddr(vm), vm->cpu.regs[vm->cpu.ir.rx.d]);
-    vm->cpu.pc += sizeof vm->cpu.ir.rx >> 1;
-    DISPATCH();
-// TODO rest of rx instructions
-do_jump:
-#ifdef ENABLE_TRACE
-    vm->trace_handler(vm, INST_RX);
-#endif
-    vm->cpu.pc = compute_rx_eaddr(vm);
-    DISPATCH();
-do_jumpc0:
-#ifdef ENABLE_TRACE
-    vm->trace_handler(vm, INST_RX);
-#endif
-    if (!select_bit(vm->cpu.regs[15], vm->cpu.ir.rx.d)) {
-        vm->cpu.pc = compute_rx_eaddr(vm);
-    } else {
-        vm->cpu.pc += sizeof vm->cpu.ir.rx >> 1;
-    }
-    DISPATCH();
-do_jumpc1:
-#ifdef ENABLE_TRACE
-    vm->trace_handler(vm, INST_RX);
-#endif
-    if (select_bit(vm->cpu.regs[15], vm->cpu.ir.rx.d)) {
-        vm->cpu.pc = compute_rx_eaddr(vm);
-    } else {
-        vm->cpu.pc += sizeof vm->cpu.ir.rx >> 1;
-    }
-    DISPATCH();
-do_jumpf:
-#ifdef ENABLE_TRACE
-    vm->trace_handler(vm, INST_RX);
-#endif
-    if (!vm->cpu.regs[vm->cpu.ir.rx.d]) {
-        vm->cpu.pc = compute_rx_eaddr(vm);
-    } else {
-        vm->cpu.pc += sizeof(vm->cpu.ir.rx) >> 1;
-    }
-    DISPATCH();
-do_jumpt:
-#ifdef ENABLE_TRACE
-    vm->trace_handler(vm, INST_RX);
-#endif
-    if (vm->cpu.regs[vm->cpu.ir.rx.d]) {
-        vm->cpu.pc = compute_rx_eaddr(vm);
-    } else {
-        vm->cpu.pc += sizeof(vm->cpu.ir.rx) >> 1;
-    }
-    DISPATCH();
-do_jal:
-#ifdef ENABLE_TRACE
-    vm->trace_handler(vm, INST_RX);
-#endif
-    SAFE_UPDATE(vm, vm->cpu.ir.rx.d, vm->cpu.pc + (sizeof vm->cpu.ir.rx >> 1));
-    vm->cpu.pc = compute_rx_eaddr(vm);
-    DISPATCH();
-do_bad_op:
-    fprintf(stderr, "invalid opcode: pc=%04x", vm->cpu.pc);
-    goto error;
-end_hotloop:
-#ifdef ENABLE_TRACE
-    vm->trace_handler(vm, EXEC_END);
+    vm->next_check = 0;
+}
+
+/* return from an interrupt handler, re-enabling interrupts as they were */
+void sigma16_vm_rfi(sigma16_vm_t* vm) {
+    vm->cpu.pc = vm->cpu.ipc;
+    set_status(&vm->cpu, vm->cpu.istat);
+    vm->next_check = 0;
+}
+
+/* end the current run at its next budget check, as if the budget ran out */
+void sigma16_vm_stop(sigma16_vm_t* vm) {
+    vm->icount_limit = vm->next_check = vm->icount;
+}
+
+/* start counting executions, runs then use an interpreter which counts */
+int sigma16_vm_profile(sigma16_vm_t* vm) {
+    if (!vm->profile && !(vm->profile = calloc(1, sizeof *vm->profile))) {
+        perror("unable to allocate profile");
+        return -1;
+    }
+    return 0;
+}
+
+/* returned by the traced interpreter once tracing is switched off */
+#define EXEC_SWITCH 1
+
+enum interp_variant {
+    /* none, the table may be stale after native code stored into it */
+    VARIANT_STALE = -1,
+    VARIANT_PLAIN,
+    VARIANT_TRACED,
+    VARIANT_PROFILED,
+    VARIANT_TAILCALL
+};
+
+#define INTERP_NAME exec_interp
+#include "interp_body.h"
+
+#define INTERP_NAME exec_interp_traced
+#define INTERP_TRACED 1
+#include "interp_body.h"
+
+#define INTERP_NAME exec_interp_profiled
+#define INTERP_PROFILED 1
+#include "interp_body.h"
+
+/* handler offsets are relative to one interpreter, others start over */
+static void use_decoded(sigma16_vm_t* vm, enum interp_variant variant) {
+    if (vm->decoded_variant != variant) {
+        madvise(vm->decoded, (1 << 16) * sizeof(sigma16_decoded_t),
+                MADV_DONTNEED);
+        vm->decoded_variant = variant;
+    }
+}
+
+/*
+ * Tracing and profiling always run on the interpreter, as do runs with
+ * breakpoints or watchpoints since blocks cannot stop part-way, and runs
+ * keeping history since blocks store without logging.
+ */
+int sigma16_vm_exec(sigma16_vm_t* vm) {
+    int ret;
+
+    /* resuming from a breakpoint executes it */
+    vm->break_skip = vm->icount + 1;
+    do {
+        if (vm->trace_handler) {
+            use_decoded(vm, VARIANT_TRACED);
+            ret = exec_interp_traced(vm);
+            continue;
+        }
+        if (vm->profile) {
+            use_decoded(vm, VARIANT_PROFILED);
+            ret = exec_interp_profiled(vm);
+            continue;
+        }
+        switch (vm->n_breakpoints || vm->n_watchpoints || vm->history
+                    ? ENGINE_INTERP
+                    : vm->engine) {
+            case ENGINE_BLOCK:
+            case ENGINE_JIT:
+                ret = sigma16_block_exec(vm);
+                if (vm->jit) {
+                    /* native stores only invalidate blocks */
+                    vm->decoded_variant = VARIANT_STALE;
+                }
+                break;
+#ifdef HAVE_TAILCALL
+            case ENGINE_TAILCALL:
+                use_decoded(vm, VARIANT_TAILCALL);
+                ret = sigma16_tailcall_exec(vm);
+                break;
 #endif
+            default:
+                use_decoded(vm, VARIANT_PLAIN);
+                ret = exec_interp(vm);
+        }
+    } while (ret == EXEC_SWITCH);
+    sigma16_io_flush(vm);
+    return ret;
+}
+
+static void ignore_event(sigma16_vm_t* vm, enum sigma16_trace_event event) {}
+
+/*
+ * Execute at most n more instructions, stopping early like sigma16_vm_exec.
+ * Runs on the traced interpreter, which keeps to the budget exactly, and
+ * replaces the budget.
+ */
+int sigma16_vm_step(sigma16_vm_t* vm, uint64_t n) {
+    int ret;
+
+    if (!n) {
+        return SIGMA16_EXEC_BUDGET;
+    }
+    if (!vm->trace_handler) {
+        vm->trace_handler = ignore_event;
+    }
+    sigma16_vm_set_budget(vm, n, 0);
+    ret = sigma16_vm_exec(vm);
+    if (vm->trace_handler == ignore_event) {
+        vm->trace_handler = NULL;
+    }
+    return ret;
+}
+
+/* the vm takes ownership of cond, which may be NULL */
+int sigma16_vm_add_breakpoint(sigma16_vm_t* vm, uint16_t addr,
+                              struct sigma16_expr* cond) {
+    struct sigma16_breakpoint* list;
+
+    if ((!vm->breakpoints &&
+         !(vm->breakpoints = calloc(1 << 10, sizeof *vm->breakpoints))) ||
+        !(list = realloc(vm->break_list,
+                         (vm->n_breakpoints + 1) * sizeof *list))) {
+        perror("unable to allocate breakpoint");
+        return -1;
+    }
+    list[vm->n_breakpoints++] = (struct sigma16_breakpoint){addr, cond};
+    vm->break_list = list;
+    vm->breakpoints[addr >> 6] |= (uint64_t)1 << (addr & 63);
+    /* the interpreters check for breakpoints while decoding */
+    invalidate_decoded(vm, addr);
+    return 0;
+}
+
+/* the breakpoint at addr added last */
+void sigma16_vm_remove_breakpoint(sigma16_vm_t* vm, uint16_t addr) {
+    struct sigma16_breakpoint* list = vm->break_list;
+    int i = vm->n_breakpoints;
+
+    while (--i >= 0 && list[i].addr != addr) {
+    }
+    if (i < 0) {
+        return;
+    }
+    free(list[i].cond);
+    memmove(&list[i], &list[i + 1], (--vm->n_breakpoints - i) * sizeof *list);
+    for (i = 0; i < vm->n_breakpoints && list[i].addr != addr; ++i) {
+    }
+    if (i == vm->n_breakpoints) {
+        vm->breakpoints[addr >> 6] &= ~((uint64_t)1 << (addr & 63));
+    }
+    if (!vm->n_breakpoints) {
+        free(vm->breakpoints);
+        free(vm->break_list);
+        vm->breakpoints = NULL;
+        vm->break_list = NULL;
+    }
+    invalidate_decoded(vm, addr);
+}
+
+/* called by the interpreters at addresses with breakpoints */
+int sigma16_vm_should_break(sigma16_vm_t* vm) {
+    for (int i = 0; i < vm->n_breakpoints; ++i) {
+        if (vm->break_list[i].addr == vm->cpu.pc &&
+            (!vm->break_list[i].cond ||
+             sigma16_expr_eval(vm->break_list[i].cond, vm))) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void mark_watch_pages(sigma16_vm_t* vm) {
+    struct sigma16_watchpoint* wp;
+
+    memset(vm->watch_pages, 0, sizeof vm->watch_pages);
+    for (int i = 0; i < vm->n_watchpoints; ++i) {
+        wp = &vm->watchpoints[i];
+        for (int page = wp->start >> 8; page <= wp->end >> 8; ++page) {
+            vm->watch_pages[page] |= wp->kind;
+        }
+    }
+}
+
+/* stop after accesses of kind (enum sigma16_watch_kind) to [start, end] */
+int sigma16_vm_add_watchpoint(sigma16_vm_t* vm, uint16_t start, uint16_t end,
+                              int kind) {
+    struct sigma16_watchpoint* list;
+
+    if (!(list = realloc(vm->watchpoints,
+                         (vm->n_watchpoints + 1) * sizeof *list))) {
+        perror("unable to allocate watchpoint");
+        return -1;
+    }
+    list[vm->n_watchpoints++] = (struct sigma16_watchpoint){
+        start, end < start ? start : end, kind};
+    vm->watchpoints = list;
+    mark_watch_pages(vm);
+    return 0;
+}
+
+/* every watchpoint starting at start */
+void sigma16_vm_remove_watchpoint(sigma16_vm_t* vm, uint16_t start) {
+    int n = 0;
+
+    for (int i = 0; i < vm->n_watchpoints; ++i) {
+        if (vm->watchpoints[i].start != start) {
+            vm->watchpoints[n++] = vm->watchpoints[i];
+        }
+    }
+    if (!(vm->n_watchpoints = n)) {
+        free(vm->watchpoints);
+        vm->watchpoints = NULL;
+    }
+    mark_watch_pages(vm);
+}
+
+/* the watchpoint on exactly [start, end] for kind added last */
+void sigma16_vm_remove_watch_range(sigma16_vm_t* vm, uint16_t start,
+                                   uint16_t end, int kind) {
+    struct sigma16_watchpoint* list = vm->watchpoints;
+    int i = vm->n_watchpoints;
+
+    if (end < start) {
+        end = start;
+    }
+    while (--i >= 0 && (list[i].start != start || list[i].end != end ||
+                        list[i].kind != kind)) {
+    }
+    if (i < 0) {
+        return;
+    }
+    memmove(&list[i], &list[i + 1], (--vm->n_watchpoints - i) * sizeof *list);
+    if (!vm->n_watchpoints) {
+        free(vm->watchpoints);
+        vm->watchpoints = NULL;
+    }
+    mark_watch_pages(vm);
+}
+
+/* called by the interpreters for accesses to pages with watchpoints */
+int sigma16_vm_watched(sigma16_vm_t* vm, uint16_t addr, int kind) {
+    struct sigma16_watchpoint* wp;
+
+    for (int i = 0; i < vm->n_watchpoints; ++i) {
+        wp = &vm->watchpoints[i];
+        if (wp->start <= addr && addr <= wp->end && (wp->kind & kind)) {
+            vm->watch_hit = addr;
+            vm->watch_kind = kind;
+            return 1;
+        }
+    }
     return 0;
-error:
-    return -1;
 }
@@ -4,24 +4,150 @@
 
 #include "config.h"
 #include "cpu.h"
-#ifdef ENABLE_TRACE
+#include "image.h"
 #include "events.h"
-#endif
 #include "instructions.h"
 
+enum sigma16_engine {
+    ENGINE_INTERP,
+    ENGINE_BLOCK,
+    ENGINE_JIT,
+    ENGINE_TAILCALL
+};
+
+/* returned by sigma16_vm_exec when the budget ran out, exec again to resume */
+#define SIGMA16_EXEC_BUDGET 2
+/* returned before executing a breakpoint address, see sigma16_vm_exec */
+#define SIGMA16_EXEC_BREAK 3
+/* returned after an access to a watched address, see watch_hit */
+#define SIGMA16_EXEC_WATCH 4
+
+/* accesses which stop a run at a watchpoint */
+enum sigma16_watch_kind { WATCH_READ = 1, WATCH_WRITE = 2 };
+
+/* stops a run after accesses to [start, end] */
+struct sigma16_watchpoint {
+    uint16_t start;
+    uint16_t end;
+    uint8_t kind;
+};
+
+/* stops a run before the instruction at addr if there is no cond or it holds */
+struct sigma16_breakpoint {
+    uint16_t addr;
+    struct sigma16_expr* cond;
+};
+
+/* decoded form of the instruction at each address, filled lazily */
+typedef struct _sigma16_decoded {
+    int32_t handler;
+    /* index into the dispatch table of the instruction's format */
+    uint8_t op;
+    uint8_t d;
+    uint8_t sa;
+    uint8_t sb;
+    uint16_t disp;
+} sigma16_decoded_t;
+
+/* execution counts gathered while profiling, see --profile */
+struct sigma16_profile {
+    /* executions of the instruction at each address */
+    uint64_t pc[1 << 16];
+    /* conditional jumps at each address which were taken */
+    uint64_t taken[1 << 16];
+    /* executions of each dispatch table entry */
+    uint64_t rrr[16];
+    uint64_t rx[16];
+    uint64_t exp[256];
+    /* taken conditional jumps, by secondary opcode */
+    uint64_t rx_taken[16];
+};
+
+#ifdef ENABLE_FLIGHT_RECORDER
+/* one executed instruction, register values are from before it ran */
+struct sigma16_flight_record {
+    uint16_t pc;
+    uint16_t word;
+    /* second word of RX and EXP instructions */
+    uint16_t disp;
+    uint16_t d;
+    uint16_t sa;
+    uint16_t sb;
+    uint16_t r15;
+};
+#endif
+
 typedef struct _sigma16_vm {
     sigma16_cpu_t cpu;
     uint16_t* mem;
-#ifdef ENABLE_TRACE
-    void (*trace_handler)(struct _sigma16_vm*, enum sigma16_trace_event);
+    sigma16_decoded_t* decoded;
+    /* interpreter whose handlers decoded holds */
+    int decoded_variant;
+    enum sigma16_engine engine;
+    /* instructions executed */
+    uint64_t icount;
+    /* budget, see sigma16_vm_set_budget */
+    uint64_t icount_limit;
+    /* CLOCK_MONOTONIC nanoseconds, 0 for none */
+    uint64_t deadline;
+    /* icount at which the engines next call sigma16_vm_budget_check */
+    uint64_t next_check;
+    /* destination of trap output and traces */
+    FILE* out;
+    /* trap buffers, see io.h */
+    struct sigma16_io* io;
+    struct sigma16_block_cache* blocks;
+    struct sigma16_jit* jit;
+    /* counters bumped by the interpreters while set */
+    struct sigma16_profile* profile;
+    /* snapshots and stores kept to go back in time, see history.h */
+    struct sigma16_history* history;
+#ifdef ENABLE_FLIGHT_RECORDER
+    /* ring of the last FLIGHT_RECORDER_SIZE instructions */
+    struct sigma16_flight_record* flight;
+    /* records ever written, published after each record */
+    uint64_t flight_head;
 #endif
+    /* bitmap of the addresses in break_list, NULL when it is empty */
+    uint64_t* breakpoints;
+    struct sigma16_breakpoint* break_list;
+    int n_breakpoints;
+    /* icount of the first instruction of a run, breakpoints let it pass */
+    uint64_t break_skip;
+    /* watch kinds of the watchpoints overlapping each 256 word page */
+    uint8_t watch_pages[256];
+    struct sigma16_watchpoint* watchpoints;
+    int n_watchpoints;
+    /* the access which stopped the run at a watchpoint */
+    uint16_t watch_hit;
+    uint8_t watch_kind;
+    /* called before every instruction while set, see sigma16_vm_exec */
+    void (*trace_handler)(struct _sigma16_vm*, enum sigma16_trace_event);
 #if defined(PYTHON_COMPAT) || defined(ENABLE_DEBUGGER)
     void* vm_refl;
 #endif
 } sigma16_vm_t;
 
 int sigma16_vm_init(sigma16_vm_t**, char*);
+int sigma16_vm_init_image(sigma16_vm_t**, sigma16_image_t*);
 void sigma16_vm_del(sigma16_vm_t*);
 int sigma16_vm_exec(sigma16_vm_t*);
+int sigma16_vm_profile(sigma16_vm_t*);
+void sigma16_vm_set_budget(sigma16_vm_t*, uint64_t, double);
+int sigma16_vm_budget_exhausted(const sigma16_vm_t*);
+int sigma16_vm_budget_check(sigma16_vm_t*);
+void sigma16_vm_stop(sigma16_vm_t*);
+uint16_t sigma16_vm_getctl(sigma16_vm_t*, int);
+void sigma16_vm_putctl(sigma16_vm_t*, int, uint16_t);
+void sigma16_vm_rfi(sigma16_vm_t*);
+int sigma16_vm_step(sigma16_vm_t*, uint64_t);
+int sigma16_vm_add_breakpoint(sigma16_vm_t*, uint16_t, struct sigma16_expr*);
+void sigma16_vm_remove_breakpoint(sigma16_vm_t*, uint16_t);
+int sigma16_vm_should_break(sigma16_vm_t*);
+int sigma16_vm_add_watchpoint(sigma16_vm_t*, uint16_t, uint16_t, int);
+void sigma16_vm_remove_watchpoint(sigma16_vm_t*, uint16_t);
+void sigma16_vm_remove_watch_range(sigma16_vm_t*, uint16_t, uint16_t, int);
+int sigma16_vm_watched(sigma16_vm_t*, uint16_t, int);
 uint16_t read_mem(sigma16_vm_t*, uint16_t);
 void write_mem(sigma16_vm_t*, uint16_t, uint16_t);
+void sigma16_vm_invalidate(sigma16_vm_t*, uint16_t, size_t);
@@ -69,6 +69,25 @@ class RXInstruction(Instruction):
     disp: Union[int, Identifier]
 
 
+@dataclass
+class EXPInstruction(Instruction):
+    d: Register
+    # the operand word: control register or source register on top, then
+    # the shift distance in the bottom nibble
+    e: int
+    h: int
+
+
+class ControlRegister(enum.IntEnum):
+    STATUS = 0
+    MASK = 1
+    REQ = 2
+    ISTAT = 3
+    IPC = 4
+    VECT = 5
+    TIMER = 6
+
+
 @dataclass
 class LabelBody:
     obj_offset: int
@@ -118,6 +137,12 @@ INSTRUCTIONS = {
     "JUMPGE": (-5, RXInstruction),
     "JUMPGT": (-6, RXInstruction),
     "JAL": (8, RXInstruction),
+    # EXP instructions
+    "RFI": (0, EXPInstruction),
+    "GETCTL": (1, EXPInstruction),
+    "PUTCTL": (2, EXPInstruction),
+    "SHIFTL": (3, EXPInstruction),
+    "SHIFTR": (4, EXPInstruction),
     # Custom instructions
     "MOV": (-7, PseudoInstruction),
 }
@@ -236,11 +261,46 @@ def _parse_rx_instruction(opcode: int, string: str) -> RXInstruction:
     return RXInstruction(opcode, d, sa, disp)
 
 
+def parse_control_register(reg: str) -> ControlRegister:
+    try:
+        return ControlRegister[reg]
+    except KeyError:
+        raise ParserError(f'invalid control register: "{reg}"')
+
+
+def _parse_exp_instruction(opcode: int, string: str) -> EXPInstruction:
+    operands = [c.strip() for c in string.split(",")] if string else []
+
+    if opcode == INSTRUCTIONS["RFI"][0]:
+        if operands:
+            raise ParserError("rfi takes no operands")
+        return EXPInstruction(opcode, Register["R0"], 0, 0)
+
+    if opcode in (INSTRUCTIONS["GETCTL"][0], INSTRUCTIONS["PUTCTL"][0]):
+        if len(operands) != 2:
+            raise ParserError("expected a register and a control register")
+        d, ctl = operands
+        return EXPInstruction(
+            opcode, parse_register(d), parse_control_register(ctl).value, 0
+        )
+
+    if len(operands) != 3:
+        raise ParserError("expected two registers and a shift distance")
+    d, e, h = operands
+    distance = parse_numeric(h)
+    if not 0 <= distance <= 15:
+        raise ParserError("shift distance must be between 0 and 15")
+    return EXPInstruction(
+        opcode, parse_register(d), parse_register(e).value, distance
+    )
+
+
 def parse_instruction(string: str) -> Instruction:
     handlers = {
         PseudoInstruction: _parse_pseudo_instruction,
         RRRInstruction: _parse_rrr_instruction,
         RXInstruction: _parse_rx_instruction,
+        EXPInstruction: _parse_exp_instruction,
     }
 
     chunks = string.split()
@@ -326,7 +386,7 @@ def parse_lines(lines: List[str]) -> Linker:
 def sizeof(obj: Object) -> int:
     if isinstance(obj, RRRInstruction):
         return 1
-    elif isinstance(obj, RXInstruction):
+    elif isinstance(obj, (RXInstruction, EXPInstruction)):
         return 2
     elif isinstance(obj, NumericConstant):
         return 1
@@ -365,6 +425,10 @@ def write_code(handle, objs: List[Object]) -> None:
             head = (15 << 4) | obj.d.value
             body = (obj.sa.value << 4) | obj.opcode
             handle.write(struct.pack(">BBh", head, body, obj.disp))
+        elif isinstance(obj, EXPInstruction):
+            head = (14 << 4) | obj.d.value
+            tail = (obj.e << 12) | obj.h
+            handle.write(struct.pack(">BBH", head, obj.opcode, tail))
         elif isinstance(obj, NumericConstant):
             handle.write(struct.pack(">h", obj.value))
 
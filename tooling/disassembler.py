@@ -75,8 +75,31 @@ class RXInstruction(Instruction):
         )
 
 
+@dataclass
+class EXPInstruction(Instruction):
+    d: Register
+    ab: int
+    disp: int
+
+    def __str__(self):
+        if self.mnemonic == "rfi":
+            return f"{GREEN}{self.mnemonic}{OFF}"
+        e, h = self.disp >> 12, self.disp & 0xF
+        if self.mnemonic in ("getctl", "putctl"):
+            name = CONTROL_REGISTERS[e] if e < len(CONTROL_REGISTERS) else e
+            return (
+                f"{GREEN}{self.mnemonic}\t{MAGENTA}{self.d.name:3} "
+                f"{CYAN}{name}{OFF}"
+            )
+        return (
+            f"{GREEN}{self.mnemonic}\t{MAGENTA}{self.d.name:3} "
+            f"{BLUE}{Register(e).name:3} {CYAN}{h}{OFF}"
+        )
+
+
 RRR_INST_SIZE = 2
 RX_INST_SIZE = 4
+EXP_INST_SIZE = 4
 
 
 RRR_INSTRUCTIONS = [
@@ -95,7 +118,9 @@ RRR_INSTRUCTIONS = [
     "nop",
     "trap",
 ]
-EXP_INSTRUCTIONS = []
+EXP_INSTRUCTIONS = ["rfi", "getctl", "putctl", "shiftl", "shiftr"]
+
+CONTROL_REGISTERS = ["status", "mask", "req", "istat", "ipc", "vect", "timer"]
 
 RX_INSTRUCTIONS = [
     "lea",
@@ -149,17 +174,34 @@ def decode_rx_inst(binary: bytes, offset: int) -> RXInstruction:
     )
 
 
+def decode_exp_inst(binary: bytes, offset: int) -> EXPInstruction:
+    d, opcode = split_byte(binary[offset])
+    ab = binary[offset + 1]
+    try:
+        mnemonic = EXP_INSTRUCTIONS[ab]
+    except IndexError:
+        return None
+    disp = struct.unpack(">H", binary[offset + 2 : offset + 4])[0]
+
+    return EXPInstruction(opcode, mnemonic, parse_register(d), ab, disp)
+
+
 def disasm_binary(binary: bytes):
     len_binary = len(binary) - 1
     offset = 0
 
     while offset < len_binary:
         opcode = binary[offset] >> 4
-        if 0 <= opcode < 15:
+        if 0 <= opcode < 14:
             instruction = decode_rrr_inst(binary, offset)
             offset += RRR_INST_SIZE
+        elif offset + 4 > len(binary):
+            # the second word is missing
+            instruction = None
+            offset += RRR_INST_SIZE
         elif opcode == 14:
-            raise NotImplementedError("disassembler does not support EXP instructions")
+            instruction = decode_exp_inst(binary, offset)
+            offset += EXP_INST_SIZE
         elif opcode == 15:
             instruction = decode_rx_inst(binary, offset)
             offset += RX_INST_SIZE
@@ -185,8 +227,21 @@ def annotate_rx_hex(instruction: RXInstruction) -> str:
     )
 
 
+def annotate_exp_hex(instruction: EXPInstruction) -> str:
+    return (
+        f"{YELLOW}{instruction.opcode:x}{MAGENTA}{instruction.d:x} "
+        f"{GREEN}{instruction.ab:02x} {CYAN}"
+        + binascii.hexlify(instruction.disp.to_bytes(2, "big"), " ").decode()
+        + OFF
+    )
+
+
 def annotate_inst_hex(instruction: Instruction) -> str:
-    handler = {RRRInstruction: annotate_rrr_hex, RXInstruction: annotate_rx_hex}
+    handler = {
+        RRRInstruction: annotate_rrr_hex,
+        RXInstruction: annotate_rx_hex,
+        EXPInstruction: annotate_exp_hex,
+    }
     return handler[type(instruction)](instruction)
 
 